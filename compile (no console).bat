@@ -1,2 +1,2 @@
-g++ source\virtual_computer_source.cpp -mwindows -lmingw32 -lopengl32 -lglu32 -lfreeglut -o virtual_computer.exe
+g++ source\virtual_computer_source.cpp -mwindows -lmingw32 -lopengl32 -lglu32 -lfreeglut -lws2_32 -o virtual_computer.exe
 cmd /k
\ No newline at end of file
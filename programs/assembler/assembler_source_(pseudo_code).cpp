@@ -35,8 +35,21 @@ Label references cannot set default values. There can only be one label definiti
 
 */
 
+/*
+
+    Object files (for the linker in programs/linker):
+
+        assembler_source_(pseudo_code).exe -object <module name> [-export <label>] ...
+
+    Instead of the output code, a relocatable module in the object file format of the linker is printed. Label declarations are offsets in the module, so every label reference gets a "reloc <offset>" entry. A label reference without a matching label declaration is imported ("reloc <offset> <label>") instead of causing error 17. Each "-export <label>" exports a label declaration under its name. Label names are printed in uppercase.
+
+*/
+
 #include <iostream>
+#include <string>
+#include <vector>
 #include <string.h>
+#include "../../source/virtual_computer_core.h"
 
 // Error reporting
 void throwError(int code, int curLine, int codePos, int codePosAtLastNewLine)
@@ -106,8 +119,52 @@ void throwError(int code, int curLine, int codePos, int codePosAtLastNewLine)
     }
 }
 
-int main()
+// Get the name of a label in uppercase (label names are not case-sensitive)
+std::string labelName(const char * name, int length)
 {
+    std::string upperCase(name, length);
+    for(int i = 0; i < length; i++)
+    {
+        if(upperCase[i] >= 'a' && upperCase[i] <= 'z')
+        {
+            upperCase[i] -= 32;
+        }
+    }
+
+    return upperCase;
+}
+
+int main(int argc, char** argv)
+{
+    const char * moduleName = NULL; // Print an object file instead of the output code if set (-object <module name>)
+    std::vector<std::string> exportNames; // Label declarations exported from the object file (-export <label>)
+
+    for(int i = 1; i < argc; i++)
+    {
+        std::string option = argv[i];
+
+        if(i + 1 == argc)
+        {
+            std::cout << "Error: Missing value for option '" << option << "'" << std::endl;
+            return 0;
+        }
+
+        i += 1;
+        if(option == "-object")
+        {
+            moduleName = argv[i];
+        }
+        else if(option == "-export")
+        {
+            exportNames.push_back(labelName(argv[i], strlen(argv[i])));
+        }
+        else
+        {
+            std::cout << "Error: Unknown option '" << option << "'" << std::endl;
+            return 0;
+        }
+    }
+
     const char * assemblyCode = "JMP (start) .console. = 67\n.assemblyCodeStartPoint. = 15\n.assemblyCodeEndPoint. = 17\n; execution starts here\n\n; Iterate through each character in the assembly code\n; load initial values for variables\n.start. = LAA (assemblyCodeStartPoint)\nADD 0 ; clear\nSTR (i0)\nLAA (assemblyCodeEndPoint)\nSTR (i1)\n; check if i0 <= i1\nLDA .i1. = 0\nSBA (i0)\nJIE (for_end0)\n\nLDA (console)\nSOT (i0)\n\n; increment position in the assembly code\nLDA .i0. = 0\nADD 1\nSTR (i0)\nJMP (i1)\n.for_end0. = 0 ";
 
     int assemblyCodeStartPoint = 0,
@@ -172,133 +229,11 @@ int main()
                     {
                         if(charCache_CharsStored == 3)
                         {
-                            if(charCache[0] == 'L')
-                            {
-                                if(charCache[1] == 'D')
-                                {
-                                    if(charCache[2] == 'A')
-                                    {
-                                        outputTempStore = 0;
-                                        wordIdentified = true;
-                                    }
-                                }
-                                else if(charCache[1] == 'A')
-                                {
-                                    if(charCache[2] == 'A')
-                                    {
-                                        outputTempStore = 4096; // b0001000000000000
-                                        wordIdentified = true;
-                                    }
-                                }
-                            }
-                            else if(charCache[0] == 'A')
-                            {
-                                if(charCache[1] == 'D')
-                                {
-                                    if(charCache[2] == 'D')
-                                    {
-                                        outputTempStore = 8192; // b0010000000000000
-                                        wordIdentified = true;
-                                    }
-                                    else if(charCache[2] == 'A')
-                                    {
-                                        outputTempStore = 16384; // b0100000000000000
-                                        wordIdentified = true;
-                                    }
-                                }
-                            }
-                            else if(charCache[0] == 'S')
-                            {
-                                if(charCache[1] == 'B')
-                                {
-                                    if(charCache[2] == 'D')
-                                    {
-                                        outputTempStore = 12288; // b0011000000000000
-                                        wordIdentified = true;
-                                    }
-                                    else if(charCache[2] == 'A')
-                                    {
-                                        outputTempStore = 20480; // b0101000000000000
-                                        wordIdentified = true;
-                                    }
-                                }
-                                else if(charCache[1] == 'T')
-                                {
-                                    if(charCache[2] == 'R')
-                                    {
-                                        outputTempStore = 24576; // b0110000000000000
-                                        wordIdentified = true;
-                                    }
-                                    else if(charCache[2] == 'D')
-                                    {
-                                        outputTempStore = 28672; // b0111000000000000
-                                        wordIdentified = true;
-                                    }
-                                }
-                                else if(charCache[1] == 'S')
-                                {
-                                    if(charCache[2] == 'D')
-                                    {
-                                        outputTempStore = 32768; // b1000000000000000
-                                        wordIdentified = true;
-                                    }
-                                }
-                                else if(charCache[1] == 'O')
-                                {
-                                    if(charCache[2] == 'T')
-                                    {
-                                        outputTempStore = 61440; // b1111000000000000
-                                        wordIdentified = true;
-                                    }
-                                }
-                            }
-                            else if(charCache[0] == 'J')
+                            int opCode = VC_lookupMnemonic(charCache, 3); // Generated from the instruction set table in virtual_computer_core.h
+                            if(opCode >= 0)
                             {
-                                if(charCache[1] == 'M')
-                                {
-                                    if(charCache[2] == 'P')
-                                    {
-                                        outputTempStore = 36864; // b1001000000000000
-                                        wordIdentified = true;
-                                    }
-                                }
-                                else if(charCache[1] == 'I')
-                                {
-                                    if(charCache[2] == 'Z')
-                                    {
-                                        outputTempStore = 40960; // b1010000000000000
-                                        wordIdentified = true;
-                                    }
-                                    else if(charCache[2] == 'E')
-                                    {
-                                        outputTempStore = 45056; // b1011000000000000
-                                        wordIdentified = true;
-                                    }
-                                    else if(charCache[2] == 'I')
-                                    {
-                                        outputTempStore = 49152; // b1100000000000000
-                                        wordIdentified = true;
-                                    }
-                                }
-                                else if(charCache[1] == 'B')
-                                {
-                                    if(charCache[2] == 'T')
-                                    {
-                                        outputTempStore = 53248; // b1101000000000000
-                                        wordIdentified = true;
-                                    }
-                                }
-                            }
-                            else if(charCache[0] == 'G')
-                            {
-                                if(charCache[1] == 'I')
-                                {
-                                    if(charCache[2] == 'N')
-                                    {
-                                        outputTempStore = 57344; // b1110000000000000
-                                        wordIdentified = true;
-                                    }
-                                }
+                                outputTempStore = opCode << 12;
+                                wordIdentified = true;
                             }
 
                             if(wordIdentified == true)
@@ -628,10 +563,10 @@ int main()
         }
     }
 
-    // Check if there are any label references with no declaration
+    // Check if there are any label references with no declaration (object files import them instead)
     for(int i = 0; i < labelRefCache_Stored; i++)
     {
-        if(labelRefCache_matched[i] == 0)
+        if(labelRefCache_matched[i] == 0 && moduleName == NULL)
         {
             throwError(17, 0, 0, 0);
         }
@@ -642,9 +577,63 @@ int main()
         throwError(6, curLine, assemblyCodeEndPoint - 1, codePosAtLastNewLine);
     }
 
-    // Print output code to the console
-    for(int i = 0; i < outputCode_InstructionsStored; i++)
+    if(moduleName == NULL)
     {
-        std::cout << outputCode[i] << std::endl;
+        // Print output code to the console
+        for(int i = 0; i < outputCode_InstructionsStored; i++)
+        {
+            std::cout << outputCode[i] << std::endl;
+        }
+        return 0;
+    }
+
+    // Find the output position of each exported label declaration
+    std::vector<int> exportOffsets;
+    for(size_t e = 0; e < exportNames.size(); e++)
+    {
+        int offset = -1;
+        for(int i = 0; i < labelDefCache_Stored; i++)
+        {
+            if(labelName(assemblyCode + labelDefCache[i][1], labelDefCache[i][2]) == exportNames[e])
+            {
+                offset = labelDefCache[i][0];
+                break;
+            }
+        }
+
+        if(offset < 0)
+        {
+            std::cout << "Error: Exported label '" << exportNames[e] << "' has no label declaration" << std::endl;
+            return 0;
+        }
+        exportOffsets.push_back(offset);
+    }
+
+    // Print the object file to the console (16 words per line)
+    std::cout << "module " << moduleName << std::endl;
+    for(int i = 0; i < outputCode_InstructionsStored; i += 16)
+    {
+        std::cout << "words";
+        for(int k = i; k < i + 16 && k < outputCode_InstructionsStored; k++)
+        {
+            std::cout << " " << outputCode[k];
+        }
+        std::cout << std::endl;
+    }
+
+    for(size_t e = 0; e < exportNames.size(); e++)
+    {
+        std::cout << "export " << exportNames[e] << " " << exportOffsets[e] << std::endl;
+    }
+
+    // Matched label references are offsets in the module, the others are imported
+    for(int i = 0; i < labelRefCache_Stored; i++)
+    {
+        std::cout << "reloc " << labelRefCache[i][0];
+        if(labelRefCache_matched[i] == 0)
+        {
+            std::cout << " " << labelName(assemblyCode + labelRefCache[i][1], labelRefCache[i][2]);
+        }
+        std::cout << std::endl;
     }
 }
\ No newline at end of file
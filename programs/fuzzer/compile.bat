@@ -0,0 +1,2 @@
+g++ fuzzer_source.cpp -O2 -lmingw32 -o fuzzer.exe
+cmd /k
\ No newline at end of file
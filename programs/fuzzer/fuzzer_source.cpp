@@ -0,0 +1,703 @@
+/*
+
+Differential fuzzer for the instruction set of the virtual computer.
+
+Random programs are run on the processor used by the virtual computer (source/virtual_computer_core.h) and on
+a reference model written from the instruction set specification below. After every instruction the registers
+and flags of both are compared, and after each program the RAM they can reach, the words sent to output devices
+and the number of words read from the input handler are compared. The first divergence is minimized (fewer
+instructions, removed and zeroed words, registers and inputs) and printed.
+
+Each program lives in a window at the start of RAM. Instructions that read or write RAM only use operands inside
+the window, so the rest of RAM stays zero and does not have to be reset or compared. A program ends after a set
+number of instructions, or before an instruction that is excluded or that would address RAM outside the window
+(words in the window that are not part of the program are random data and can be executed).
+
+Usage:
+
+    fuzzer.exe [options]
+
+    -programs <count>   Stop after this many programs (default 0, run until a divergence is found)
+    -threads <count>    Number of threads (default: one per processor core)
+    -length <words>     Maximum number of instructions per program (default 16)
+    -steps <count>      Maximum number of instructions executed per program (default 64)
+    -window <words>     Number of RAM words that programs can address (default 64)
+    -exclude <ops>      Comma separated op-codes that are not generated or executed, for example JBT,SSD
+    -seed <number>      Seed for the random number generator (default: taken from the clock)
+    -out <file>         Write the RAM window of the minimized program to a file (same format as rom.dat)
+
+Instruction set specification (reference model):
+
+    Words are 16 bits. An instruction is a 4 bit op-code followed by a 12 bit operand (n).
+    rA, rB and rC are 16 bit registers. Instructions that use the ALU (marked *) compute rC from rA and rB with
+    the last selected ALU operation (none, add or subtract) and then set the zero flag to (rC == 0).
+    Add sets the extra flag when the sum exceeds 65535, subtract sets it when the difference is negative
+    (rC wraps around in both cases).
+
+    LDA   rA <= n *                     LAA   rA <= ram[n] *
+    ADD   rB <= n, select add *         SBD   rB <= n, select subtract *
+    ADA   rB <= ram[n], select add *    SBA   rB <= ram[n], select subtract *
+    STR   ram[n] <= rC                  STD   rC <= rA AND NOT rB, ram[n] <= rC, select none *
+    SSD   rC <= rA rotated right by (rB mod 16) bits, select none *
+    JMP   iar <= n                      JIZ   jump to n if the zero flag is set
+    JIE   jump to n if the extra flag is set
+    JII   jump to n if the input flag is set
+    JBT   jump to n if every bit set in rB is also set in rA
+    GIN   ram[n] <= next word from the input handler (0 if there is none)
+    SOT   send n to output device rA
+
+    The iar moves to the next word after every instruction that does not jump and wraps around at the end of RAM.
+
+*/
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include "../../source/virtual_computer_core.h"
+
+// Declare constants
+const int MAX_INPUTS = 4,	   // Maximum number of words waiting in the input handler when a program starts
+		  MAX_OUTPUTS = 64;	   // Outputs recorded per program (a program cannot send more than one per instruction)
+
+// Declare types
+
+	// Everything needed to run a program again
+	struct FuzzCase
+	{
+		int window[VC_RAM_SIZE],
+			rA,
+			rB,
+			rC,
+			aluOp,
+			steps,
+			inputCount,
+			inputs[MAX_INPUTS];
+
+		bool flag[3];
+	};
+
+	// Input and output devices seen by a processor while it runs a program
+	struct FuzzIO
+	{
+		const int * inputs;
+		int inputCount,
+			inputsRead,
+			outputCount,
+			outputs[MAX_OUTPUTS][2];
+
+		int input(void)
+		{
+			if(inputsRead == inputCount)
+				return 0;
+			return inputs[inputsRead++];
+		}
+
+		void output(int io_device, int operand)
+		{
+			if(outputCount < MAX_OUTPUTS)
+			{
+				outputs[outputCount][0] = io_device;
+				outputs[outputCount][1] = operand;
+			}
+			outputCount += 1;
+		}
+	};
+
+	// Reference model state
+	struct RefState
+	{
+		uint16_t ram[VC_RAM_SIZE],
+				 iar,
+				 rA,
+				 rB,
+				 rC;
+		uint8_t aluSelect; // 0 = none, 1 = add, 2 = subtract (same values as VC_ALU_*)
+		bool zero,
+			 extra,
+			 input;
+	};
+
+	// Where two runs of a program stopped agreeing
+	struct Divergence
+	{
+		int step; // Number of instructions executed when the divergence was found
+		std::string field;
+		long long implementation,
+				  reference;
+	};
+
+// Declare variables
+int windowSize = 64,
+	maxLength = 16,
+	maxSteps = 64;
+
+bool excluded[16] = {false};
+
+std::atomic<long long> programsRun(0);
+std::atomic<bool> divergenceFound(false);
+std::mutex divergenceMutex;
+FuzzCase divergentCase;
+
+// Declare and define functions
+void fuzzThread(uint64_t seed, long long programLimit);
+void generateCase(FuzzCase & c, uint64_t & rng);
+bool runCase(const FuzzCase & c, VC_State & vc, RefState & ref, FuzzIO & vcIO, FuzzIO & refIO, Divergence & result);
+bool usesRam(int word);
+void refExecute(RefState & ref, FuzzIO & io);
+void minimizeCase(FuzzCase & c);
+void removeWords(FuzzCase & c, int start, int count);
+void printCase(const FuzzCase & c);
+
+// Random numbers (xorshift64*)
+inline uint64_t nextRandom(uint64_t & state)
+{
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+	return state * 2685821657736338717ULL;
+}
+
+int main(int argc, char** argv)
+{
+	std::cout << std::endl;
+
+	long long programLimit = 0;
+	int threadCount = std::thread::hardware_concurrency();
+	uint64_t seed = std::chrono::steady_clock::now().time_since_epoch().count();
+	const char * outPath = NULL;
+
+	for(int i = 1; i < argc; i++)
+	{
+		std::string option = argv[i];
+
+		if(i + 1 == argc)
+		{
+			std::cout << "Error: Missing value for option '" << option << "'" << std::endl;
+			return 0;
+		}
+
+		if(option == "-programs")
+			programLimit = std::atoll(argv[++i]);
+		else if(option == "-threads")
+			threadCount = std::atoi(argv[++i]);
+		else if(option == "-length")
+			maxLength = std::atoi(argv[++i]);
+		else if(option == "-steps")
+			maxSteps = std::atoi(argv[++i]);
+		else if(option == "-window")
+			windowSize = std::atoi(argv[++i]);
+		else if(option == "-seed")
+			seed = std::strtoull(argv[++i], NULL, 10);
+		else if(option == "-out")
+			outPath = argv[++i];
+		else if(option == "-exclude")
+		{
+			std::string list = argv[++i];
+			for(size_t start = 0; start < list.size(); start += 4)
+			{
+				bool found = false;
+				for(int op = 0; op < 16; op++)
+				{
+					if(list.compare(start, 3, VC_ISA[op].mnemonic) == 0)
+					{
+						excluded[op] = true;
+						found = true;
+					}
+				}
+				if(!found)
+				{
+					std::cout << "Error: Unknown op-code in '" << list << "'" << std::endl;
+					return 0;
+				}
+			}
+		}
+		else
+		{
+			std::cout << "Error: Unknown option '" << option << "'" << std::endl;
+			return 0;
+		}
+	}
+
+	int allowedOps = 0;
+	for(int op = 0; op < 16; op++)
+		allowedOps += !excluded[op];
+	if(allowedOps == 0)
+	{
+		std::cout << "Error: Every op-code is excluded" << std::endl;
+		return 0;
+	}
+
+	if(threadCount < 1)
+		threadCount = 1;
+	if(windowSize < 1 || windowSize > VC_RAM_SIZE)
+		windowSize = VC_RAM_SIZE;
+	if(maxLength < 1 || maxLength > windowSize)
+		maxLength = windowSize;
+	if(maxSteps < 1)
+		maxSteps = 1;
+
+	std::cout << "Seed: " << seed << ", threads: " << threadCount << std::endl;
+
+	std::vector<std::thread> threads;
+	for(int t = 0; t < threadCount; t++)
+		threads.push_back(std::thread(fuzzThread, seed + t * 0x9E3779B97F4A7C15ULL, programLimit));
+
+	// Report progress once per second
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	long long lastCount = 0;
+	while(!divergenceFound && (programLimit == 0 || programsRun < programLimit))
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+		double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if(elapsed >= 1.0)
+		{
+			long long count = programsRun;
+			std::cout << "Programs: " << count << " (" << (long long)((count - lastCount) / elapsed) << " per second)" << std::endl;
+			lastCount = count;
+			start = std::chrono::steady_clock::now();
+		}
+	}
+
+	for(size_t t = 0; t < threads.size(); t++)
+		threads[t].join();
+
+	if(!divergenceFound)
+	{
+		std::cout << "No divergence found in " << programsRun << " programs" << std::endl;
+		std::cout << "Done!" << std::endl;
+		return 1;
+	}
+
+	std::cout << "Divergence found after " << programsRun << " programs, minimizing..." << std::endl << std::endl;
+	minimizeCase(divergentCase);
+	printCase(divergentCase);
+
+	if(outPath != NULL)
+	{
+		std::ofstream target(outPath, std::ios::binary | std::ios::trunc);
+		if(!target.is_open())
+		{
+			std::cout << "Error: The target file failed to open" << std::endl;
+			return 0;
+		}
+		for(int i = 0; i < windowSize; i++)
+			target << (char)(divergentCase.window[i] >> 8) << (char)(divergentCase.window[i] & 255);
+		target.close();
+	}
+
+	return 0;
+}
+
+// Generate and run programs until a divergence is found (by any thread) or the program limit is reached
+void fuzzThread(uint64_t seed, long long programLimit)
+{
+	uint64_t rng = seed | 1;
+	FuzzCase * c = new FuzzCase();
+	VC_State * vc = new VC_State();
+	RefState * ref = new RefState();
+	FuzzIO vcIO, refIO;
+	Divergence divergence;
+
+	while(!divergenceFound)
+	{
+		// Count programs in batches to keep the shared counter out of the inner loop
+		for(int batch = 0; batch < 1024; batch++)
+		{
+			generateCase(*c, rng);
+			if(runCase(*c, *vc, *ref, vcIO, refIO, divergence))
+			{
+				std::lock_guard<std::mutex> lock(divergenceMutex);
+				if(!divergenceFound)
+				{
+					divergentCase = *c;
+					divergenceFound = true;
+				}
+				break;
+			}
+		}
+
+		if(programLimit != 0 && programsRun.fetch_add(1024) + 1024 >= programLimit)
+			break;
+		if(programLimit == 0)
+			programsRun += 1024;
+	}
+
+	delete c;
+	delete vc;
+	delete ref;
+}
+
+void generateCase(FuzzCase & c, uint64_t & rng)
+{
+	uint64_t r = nextRandom(rng);
+	int length = 1 + (int)(r % maxLength);
+
+	for(int i = 0; i < windowSize; i++)
+	{
+		r = nextRandom(rng);
+		if(i < length)
+		{
+			int op = (r >> 32) & 15;
+			while(excluded[op])
+				op = (op + 1) & 15;
+			c.window[i] = (op << 12) | (int)((r & 0xFFFFFFFF) % windowSize);
+		}
+		else
+		{
+			c.window[i] = (r >> 16) & 0xFFFF;
+		}
+	}
+
+	r = nextRandom(rng);
+	c.rA = r & 0xFFFF;
+	c.rB = (r >> 16) & 0xFFFF;
+	c.rC = (r >> 32) & 0xFFFF;
+	c.aluOp = (r >> 48) & 3;
+	c.flag[0] = (r >> 50) & 1;
+	c.flag[1] = (r >> 51) & 1;
+	c.flag[2] = (r >> 52) & 1;
+	c.steps = maxSteps;
+
+	r = nextRandom(rng);
+	c.inputCount = r % (MAX_INPUTS + 1);
+	for(int i = 0; i < MAX_INPUTS; i++)
+		c.inputs[i] = (r >> (8 + i * 14)) & 0xFFFF;
+}
+
+// Run a program on both processors, returns true if they diverged
+bool runCase(const FuzzCase & c, VC_State & vc, RefState & ref, FuzzIO & vcIO, FuzzIO & refIO, Divergence & result)
+{
+	for(int i = 0; i < windowSize; i++)
+	{
+		vc.ram[i] = c.window[i];
+		ref.ram[i] = c.window[i];
+	}
+	vc.iar = 0;
+	vc.rA = c.rA;
+	vc.rB = c.rB;
+	vc.rC = c.rC;
+	vc.aluOp = c.aluOp;
+	vc.flag[0] = c.flag[0];
+	vc.flag[1] = c.flag[1];
+	vc.flag[2] = c.flag[2];
+
+	ref.iar = 0;
+	ref.rA = c.rA;
+	ref.rB = c.rB;
+	ref.rC = c.rC;
+	ref.aluSelect = c.aluOp;
+	ref.zero = c.flag[0];
+	ref.extra = c.flag[1];
+	ref.input = c.flag[2];
+
+	vcIO.inputs = refIO.inputs = c.inputs;
+	vcIO.inputCount = refIO.inputCount = c.inputCount;
+	vcIO.inputsRead = refIO.inputsRead = 0;
+	vcIO.outputCount = refIO.outputCount = 0;
+
+	int log[4];
+	result.step = 0;
+
+	for(int step = 0; step < c.steps; step++)
+	{
+		int vcWord = vc.ram[vc.iar],
+			refWord = ref.ram[ref.iar];
+		if(excluded[vcWord >> 12] || excluded[refWord >> 12]
+		   || (usesRam(vcWord) && (vcWord & 4095) >= windowSize)
+		   || (usesRam(refWord) && (refWord & 4095) >= windowSize))
+			break;
+
+		VC_execute(vc, vcIO, log);
+		refExecute(ref, refIO);
+		result.step = step + 1;
+
+		const char * field = NULL;
+		long long a = 0, b = 0;
+		if(vc.iar != ref.iar) { field = "iar"; a = vc.iar; b = ref.iar; }
+		else if(vc.rA != ref.rA) { field = "rA"; a = vc.rA; b = ref.rA; }
+		else if(vc.rB != ref.rB) { field = "rB"; a = vc.rB; b = ref.rB; }
+		else if(vc.rC != ref.rC) { field = "rC"; a = vc.rC; b = ref.rC; }
+		else if(vc.aluOp != ref.aluSelect) { field = "aluOp"; a = vc.aluOp; b = ref.aluSelect; }
+		else if(vc.flag[0] != ref.zero) { field = "zero flag"; a = vc.flag[0]; b = ref.zero; }
+		else if(vc.flag[1] != ref.extra) { field = "extra flag"; a = vc.flag[1]; b = ref.extra; }
+		else if(vc.flag[2] != ref.input) { field = "input flag"; a = vc.flag[2]; b = ref.input; }
+
+		if(field != NULL)
+		{
+			result.field = field;
+			result.implementation = a;
+			result.reference = b;
+			return true;
+		}
+	}
+
+	for(int i = 0; i < windowSize; i++)
+	{
+		if(vc.ram[i] != ref.ram[i])
+		{
+			result.field = "ram[" + std::to_string(i) + "]";
+			result.implementation = vc.ram[i];
+			result.reference = ref.ram[i];
+			return true;
+		}
+	}
+
+	if(vcIO.inputsRead != refIO.inputsRead)
+	{
+		result.field = "words read from the input handler";
+		result.implementation = vcIO.inputsRead;
+		result.reference = refIO.inputsRead;
+		return true;
+	}
+
+	if(vcIO.outputCount != refIO.outputCount)
+	{
+		result.field = "words sent to output devices";
+		result.implementation = vcIO.outputCount;
+		result.reference = refIO.outputCount;
+		return true;
+	}
+
+	for(int i = 0; i < vcIO.outputCount && i < MAX_OUTPUTS; i++)
+	{
+		for(int j = 0; j < 2; j++)
+		{
+			if(vcIO.outputs[i][j] != refIO.outputs[i][j])
+			{
+				result.field = std::string(j == 0 ? "device" : "word") + " of output " + std::to_string(i);
+				result.implementation = vcIO.outputs[i][j];
+				result.reference = refIO.outputs[i][j];
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+// Whether an instruction reads or writes ram[operand]
+bool usesRam(int word)
+{
+	int operand = VC_ISA[word >> 12].operand;
+	return operand == VC_OPERAND_READ || operand == VC_OPERAND_WRITE;
+}
+
+// Execute one instruction on the reference model (see the specification at the top of this file)
+void refExecute(RefState & ref, FuzzIO & io)
+{
+	uint16_t word = ref.ram[ref.iar],
+			 n = word & 0x0FFF,
+			 next = (ref.iar + 1) & 0x0FFF;
+	bool useAlu = false;
+
+	switch(word >> 12)
+	{
+		case VC_OP_LDA: ref.rA = n; useAlu = true; break;
+		case VC_OP_LAA: ref.rA = ref.ram[n]; useAlu = true; break;
+		case VC_OP_ADD: ref.rB = n; ref.aluSelect = VC_ALU_ADD; useAlu = true; break;
+		case VC_OP_SBD: ref.rB = n; ref.aluSelect = VC_ALU_SUB; useAlu = true; break;
+		case VC_OP_ADA: ref.rB = ref.ram[n]; ref.aluSelect = VC_ALU_ADD; useAlu = true; break;
+		case VC_OP_SBA: ref.rB = ref.ram[n]; ref.aluSelect = VC_ALU_SUB; useAlu = true; break;
+		case VC_OP_STR: ref.ram[n] = ref.rC; break;
+		case VC_OP_STD:
+			ref.rC = ref.rA & ~ref.rB;
+			ref.ram[n] = ref.rC;
+			ref.aluSelect = VC_ALU_OTHER;
+			useAlu = true;
+			break;
+		case VC_OP_SSD:
+		{
+			int shift = ref.rB & 15;
+			ref.rC = (uint16_t)((ref.rA >> shift) | (ref.rA << ((16 - shift) & 15)));
+			ref.aluSelect = VC_ALU_OTHER;
+			useAlu = true;
+			break;
+		}
+		case VC_OP_JMP: next = n; break;
+		case VC_OP_JIZ: if(ref.zero) next = n; break;
+		case VC_OP_JIE: if(ref.extra) next = n; break;
+		case VC_OP_JII: if(ref.input) next = n; break;
+		case VC_OP_JBT: if((ref.rA & ref.rB) == ref.rB) next = n; break;
+		case VC_OP_GIN: ref.ram[n] = io.input(); break;
+		case VC_OP_SOT: io.output(ref.rA, n); break;
+	}
+
+	if(useAlu)
+	{
+		if(ref.aluSelect == VC_ALU_ADD)
+		{
+			ref.extra = ref.rA + ref.rB > 0xFFFF;
+			ref.rC = ref.rA + ref.rB;
+		}
+		else if(ref.aluSelect == VC_ALU_SUB)
+		{
+			ref.extra = ref.rA < ref.rB;
+			ref.rC = ref.rA - ref.rB;
+		}
+		ref.zero = ref.rC == 0;
+	}
+
+	ref.iar = next;
+}
+
+// Shrink a divergent program while it still diverges
+void minimizeCase(FuzzCase & c)
+{
+	VC_State * vc = new VC_State();
+	RefState * ref = new RefState();
+	FuzzIO vcIO, refIO;
+	Divergence divergence;
+
+	runCase(c, *vc, *ref, vcIO, refIO, divergence);
+	c.steps = divergence.step;
+
+	bool changed = true;
+	while(changed)
+	{
+		changed = false;
+
+		// Try each simplification and keep it if the program still diverges
+		FuzzCase trial = c;
+
+		// Remove runs of words, halving the length of the runs down to one word (delta debugging)
+		int length = windowSize;
+		while(length > 0 && trial.window[length - 1] == 0)
+			length--;
+		for(int count = length > 1 ? length / 2 : 1; count > 0; count /= 2)
+		{
+			for(int start = 0; start + count <= length;)
+			{
+				FuzzCase removed = trial;
+				removeWords(removed, start, count);
+				if(runCase(removed, *vc, *ref, vcIO, refIO, divergence))
+				{
+					trial = removed;
+					length -= count;
+					changed = true;
+				}
+				else
+					start += count;
+			}
+		}
+
+		// Zero each word
+		for(int i = 0; i < windowSize; i++)
+		{
+			int old = trial.window[i];
+			if(old == 0)
+				continue;
+			trial.window[i] = 0;
+			if(runCase(trial, *vc, *ref, vcIO, refIO, divergence))
+				changed = true;
+			else
+				trial.window[i] = old;
+		}
+
+		int * registers[4] = {&trial.rA, &trial.rB, &trial.rC, &trial.aluOp};
+		for(int i = 0; i < 4; i++)
+		{
+			int old = *registers[i];
+			if(old == 0)
+				continue;
+			*registers[i] = 0;
+			if(runCase(trial, *vc, *ref, vcIO, refIO, divergence))
+				changed = true;
+			else
+				*registers[i] = old;
+		}
+
+		for(int i = 0; i < 3; i++)
+		{
+			if(!trial.flag[i])
+				continue;
+			trial.flag[i] = false;
+			if(runCase(trial, *vc, *ref, vcIO, refIO, divergence))
+				changed = true;
+			else
+				trial.flag[i] = true;
+		}
+
+		if(trial.inputCount > 0)
+		{
+			trial.inputCount -= 1;
+			if(runCase(trial, *vc, *ref, vcIO, refIO, divergence))
+				changed = true;
+			else
+				trial.inputCount += 1;
+		}
+
+		// Stop as soon as the programs diverge
+		runCase(trial, *vc, *ref, vcIO, refIO, divergence);
+		if(divergence.step < trial.steps)
+		{
+			trial.steps = divergence.step;
+			changed = true;
+		}
+
+		c = trial;
+	}
+
+	delete vc;
+	delete ref;
+}
+
+// Remove words from the RAM window of a program and move the words after them down
+	// Operands that address RAM or jump past the removed words are moved down with them, operands that address one
+	// of the removed words address the word after them
+void removeWords(FuzzCase & c, int start, int count)
+{
+	for(int i = start; i < windowSize; i++)
+		c.window[i] = i + count < windowSize ? c.window[i + count] : 0;
+
+	for(int i = 0; i < windowSize - count; i++)
+	{
+		int word = c.window[i],
+			operand = word & 4095;
+		if(!usesRam(word) && VC_ISA[word >> 12].operand != VC_OPERAND_JUMP)
+			continue;
+
+		if(operand >= start + count)
+			operand -= count;
+		else if(operand >= start)
+			operand = start;
+		c.window[i] = (word & ~4095) | operand;
+	}
+}
+
+void printCase(const FuzzCase & c)
+{
+	VC_State * vc = new VC_State();
+	RefState * ref = new RefState();
+	FuzzIO vcIO, refIO;
+	Divergence divergence;
+	runCase(c, *vc, *ref, vcIO, refIO, divergence);
+
+	std::cout << "Initial state: iar 0, rA " << c.rA << ", rB " << c.rB << ", rC " << c.rC << ", aluOp " << c.aluOp
+			  << ", flags " << c.flag[0] << c.flag[1] << c.flag[2] << std::endl;
+
+	std::cout << "Input handler:";
+	for(int i = 0; i < c.inputCount; i++)
+		std::cout << " " << c.inputs[i];
+	std::cout << (c.inputCount == 0 ? " (empty)" : "") << std::endl;
+
+	std::cout << "RAM (zero words are not shown):" << std::endl;
+	for(int i = 0; i < windowSize; i++)
+		if(c.window[i] != 0)
+			std::cout << "    " << i << ": " << c.window[i] << "   | " << VC_ISA[c.window[i] >> 12].mnemonic << " " << (c.window[i] & 4095) << std::endl;
+
+	std::cout << "Diverged after " << divergence.step << " instruction(s): " << divergence.field
+			  << " is " << divergence.implementation << " in the virtual computer and "
+			  << divergence.reference << " in the reference model" << std::endl;
+
+	delete vc;
+	delete ref;
+}
@@ -0,0 +1,2 @@
+fuzzer.exe -out minimized_rom.dat
+cmd /k
\ No newline at end of file
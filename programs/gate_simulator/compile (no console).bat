@@ -0,0 +1,2 @@
+g++ gate_simulator_source.cpp -O2 -mwindows -lmingw32 -o gate_simulator.exe
+cmd /k
\ No newline at end of file
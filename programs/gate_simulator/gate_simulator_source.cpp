@@ -0,0 +1,1312 @@
+/*
+
+Gate-level simulator for the CircuitJS description of the virtual computer (circuit-js-CVC.txt).
+
+The netlist is flattened into nets and cells. Element posts that share a coordinate are joined into one net
+(wires join both of their posts, and labeled nodes with the same text are joined to each other). Custom
+composite chips are expanded into the gates of their model, and multi-bit full adders are expanded into
+one-bit adders built from gates.
+
+Signal values are stored as bits (64 nets per word). Cells are only evaluated when one of their inputs
+changes (event-driven). Combinational cells are sorted into levels so that a cell is normally evaluated
+once per change, after all of its inputs have settled. Cells in feedback loops (such as latches made of
+gates) are evaluated again until the loop settles.
+
+Nets that no cell drives are floating. They read as low, except that an SRAM chip doesn't write while its
+write enable or address pins are floating and doesn't drive its data pins while its output enable is floating.
+
+Usage:
+
+    gate_simulator.exe <circuit file> <rom file> <cycles> [options]
+
+    The rom file is loaded into the first SRAM chip of the circuit (use "-" to skip loading a rom).
+    One cycle drives the clock net high, lets the circuit settle, drives it low and lets it settle again.
+
+    -clock <label>          Name of the labeled node used as the clock (default "clock")
+    -set <label> <0 or 1>   Drive a labeled node with a fixed value
+    -trace                  Print the value of every labeled node after each cycle
+    -dump <file>            Write the contents of the first SRAM chip to a file (same format as rom.dat)
+    -stats                  Print information about the flattened netlist (with the number of every latch)
+    -compare <cycles>       Run the rom on the processor of the virtual computer (source/virtual_computer_core.h)
+                            for one instruction every <cycles> cycles and compare RAM with the first SRAM chip
+    -register <name> <latch>    Also compare a register (iar, rA, rB or rC) with the outputs of a latch (see -stats)
+
+    The sequence generators of circuit-js-CVC.txt make a four phase clock from the clock net, so one instruction
+    takes four cycles:
+
+        gate_simulator.exe circuit-js-CVC.txt rom.dat 400 -compare 4 -register rA 1
+
+Supported CircuitJS elements:
+
+    w (wire), 150 - 154 (AND, NAND, OR, NOR and XOR gates), I (inverter), L (logic input),
+    M (logic output), 168 (latch), 185 (demultiplexer), 188 (sequence generator), 196 (full adder),
+    207 (labeled node), 410 (custom composite chip) and 413 (SRAM). Other elements are reported and left
+    unconnected.
+
+*/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdint>
+#include "../../source/virtual_computer_core.h"
+
+// Declare constants
+
+	// Cell types
+	const int CELL_AND = 0,
+			  CELL_NAND = 1,
+			  CELL_OR = 2,
+			  CELL_NOR = 3,
+			  CELL_XOR = 4,
+			  CELL_NOT = 5,
+			  CELL_LATCH = 6,
+			  CELL_SRAM = 7,
+			  CELL_SEQGEN = 8,
+			  CELL_DEMUX = 9,
+
+			  // Chip geometry (CircuitJS places chip pins 32 units apart)
+			  CHIP_PIN_SPACING = 32,
+			  GATE_INPUT_SPACING = 16,
+			  SIDE_N = 0,
+			  SIDE_S = 1,
+			  SIDE_W = 2,
+			  SIDE_E = 3,
+			  CHIP_FLAG_FLIP_X = 1024,
+			  CHIP_FLAG_FLIP_Y = 2048,
+
+			  // Number of cell evaluations (per cell) allowed before a settle is considered to be oscillating
+			  MAX_EVALUATIONS_PER_CELL = 256;
+
+// Declare types
+
+	// A cell reads the nets listed in cellIn[inStart ... inStart + inCount - 1] and drives the nets listed in
+	// cellOut[outStart ... outStart + outCount - 1]
+	struct Cell
+	{
+		int type,
+			inStart,
+			inCount,
+			outStart,
+			outCount,
+			level,
+			data; // Index of the state of a latch, an SRAM chip or a sequence generator
+	};
+
+	// A custom composite chip model (a line starting with "." in the circuit file)
+	struct CompositeModel
+	{
+		int sizeX,
+			sizeY;
+		std::vector<int> pinNode, // Node number inside the model
+						 pinPos,
+						 pinSide;
+		std::vector<std::string> elements; // One element per entry, for example "AndGateElm 1 2 3"
+	};
+
+	struct Sram
+	{
+		int addressBits,
+			dataBits;
+		std::vector<int> contents;
+	};
+
+	// A sequence generator sends the next bit of data (lowest bit first) on each rising edge of its clock pin
+	struct SeqGen
+	{
+		int bitCount,
+			data,
+			position;
+		bool lastClock;
+	};
+
+// Declare variables
+
+	// Netlist building (before the nodes are compressed into nets)
+	std::map<std::pair<int, int>, int> postNode; // Coordinate of a post -> node
+	std::map<std::string, int> labelNode;		 // Text of a labeled node -> node
+	std::map<std::string, CompositeModel> compositeModels;
+	std::vector<int> nodeParent; // Union-find forest over nodes
+	std::vector<int> postCount;  // Number of posts attached to each node (used to find unconnected pins)
+	std::map<std::string, int> unsupportedElements;
+
+	// Cells
+	std::vector<Cell> cells;
+	std::vector<int> cellIn,
+					 cellOut;
+	std::vector<bool> latchLastLoad;
+	std::vector<std::string> latchNames; // Element (or composite model) and position of each latch, for -stats
+	std::vector<Sram> srams;
+	std::vector<SeqGen> seqGens;
+
+	// Nets
+	int netCount = 0,
+		maxLevel = 0;
+	std::vector<uint64_t> netValue; // 64 nets per word
+	std::vector<bool> netForced,
+					  netDriven; // Driven by a cell (nets that aren't driven or forced are floating)
+	std::vector<int> fanoutStart, // Cells that read net n: fanout[fanoutStart[n] ... fanoutStart[n + 1] - 1]
+					 fanout;
+	std::map<std::string, int> labelNet;
+
+	// Event queue (one list of cells per level)
+	std::vector<std::vector<int> > levelQueue;
+	std::vector<bool> cellQueued;
+	int restartLevel = 0;
+	long long evaluationCount = 0;
+
+// Declare and define functions
+bool loadCircuit(const char * path);
+std::string unescape(const std::string & text);
+int newNode(void);
+int findNode(int node);
+void joinNodes(int a, int b);
+int nodeAtPost(int x, int y);
+void addCell(int type, const std::vector<int> & in, const std::vector<int> & out, int data = 0);
+void addGate(int type, const std::vector<int> & nodes);
+void addFullAdder(const std::vector<int> & nodes);
+void addLatch(const std::vector<int> & nodes, const std::string & name);
+void addSeqGen(const std::vector<int> & nodes, int bitCount, int data);
+void addDemux(const std::vector<int> & nodes, int selectBits);
+void addSram(const std::vector<int> & nodes, int addressBits, int dataBits, const std::vector<int> & contents);
+void addModelElement(const std::string & element, const std::vector<int> & localNodes, const std::string & name);
+std::vector<int> chipPosts(int x, int y, int flags, int sizeX, const std::vector<int> & pos, const std::vector<int> & side, int sizeY = 0);
+void buildNets(void);
+void levelize(void);
+bool getNet(int net);
+bool netFloating(int net);
+void setNet(int net, bool value);
+void forceNet(int net, bool value);
+void schedule(int cell);
+void evaluateCell(int cell);
+bool settle(void);
+bool loadRom(const char * path);
+bool dumpSram(const char * path);
+void printLabels(void);
+bool compareWithCore(const char * romPath, long long instructions, const std::vector<std::pair<std::string, int> > & registers);
+
+int main(int argc, char** argv)
+{
+	std::cout << std::endl;
+
+	if(argc < 4)
+	{
+		std::cout << "Error: Incorrect number of arguments" << std::endl;
+		return 0;
+	}
+
+	std::string clockLabel = "clock";
+	std::vector<std::pair<std::string, bool> > setLabels;
+	std::vector<std::pair<std::string, int> > registers; // Register name -> latch
+	const char * dumpPath = NULL;
+	bool trace = false,
+		 stats = false;
+	long long cycles = std::atoll(argv[3]),
+			  compareCycles = 0; // Cycles per instruction (0 (zero) if the rom isn't compared)
+
+	for(int i = 4; i < argc; i++)
+	{
+		std::string option = argv[i];
+
+		if(option == "-clock" && i + 1 < argc)
+			clockLabel = argv[++i];
+		else if(option == "-set" && i + 2 < argc)
+		{
+			setLabels.push_back(std::make_pair(std::string(argv[i + 1]), argv[i + 2][0] == '1'));
+			i += 2;
+		}
+		else if(option == "-dump" && i + 1 < argc)
+			dumpPath = argv[++i];
+		else if(option == "-compare" && i + 1 < argc)
+			compareCycles = std::max(std::atoll(argv[++i]), 1LL);
+		else if(option == "-register" && i + 2 < argc)
+		{
+			std::string name = argv[i + 1];
+			if(name != "iar" && name != "rA" && name != "rB" && name != "rC")
+			{
+				std::cout << "Error: Unknown register '" << name << "'" << std::endl;
+				return 0;
+			}
+			registers.push_back(std::make_pair(name, std::atoi(argv[i + 2])));
+			i += 2;
+		}
+		else if(option == "-trace")
+			trace = true;
+		else if(option == "-stats")
+			stats = true;
+		else
+		{
+			std::cout << "Error: Unknown option '" << option << "'" << std::endl;
+			return 0;
+		}
+	}
+
+	if(!loadCircuit(argv[1]))
+		return 0;
+
+	buildNets();
+	levelize();
+
+	if(std::string(argv[2]) != "-" && !loadRom(argv[2]))
+		return 0;
+
+	if(compareCycles != 0 && std::string(argv[2]) == "-")
+	{
+		std::cout << "Error: -compare needs a rom file" << std::endl;
+		return 0;
+	}
+	for(size_t i = 0; i < registers.size(); i++)
+	{
+		if(registers[i].second < 0 || registers[i].second >= (int)latchNames.size())
+		{
+			std::cout << "Error: There is no latch " << registers[i].second << " (see -stats)" << std::endl;
+			return 0;
+		}
+	}
+
+	for(std::map<std::string, int>::iterator it = unsupportedElements.begin(); it != unsupportedElements.end(); it++)
+		std::cout << "Warning: " << it->second << " unsupported element(s) of type '" << it->first << "' were left unconnected" << std::endl;
+
+	if(stats)
+	{
+		int unconnected = 0;
+		for(int n = 0; n < (int)postCount.size(); n++)
+			if(findNode(n) == n && postCount[n] == 1)
+				unconnected += 1;
+
+		std::cout << "Nets: " << netCount << std::endl;
+		std::cout << "Cells: " << cells.size() << std::endl;
+		std::cout << "Levels: " << maxLevel + 1 << std::endl;
+		std::cout << "SRAM chips: " << srams.size() << std::endl;
+		std::cout << "Sequence generators: " << seqGens.size() << std::endl;
+		std::cout << "Unconnected posts: " << unconnected << std::endl;
+
+		// Cell inputs that nothing drives (labels that are used once, unconnected pins)
+		int floatingInputs = 0;
+		for(size_t i = 0; i < cellIn.size(); i++)
+			floatingInputs += !netDriven[cellIn[i]];
+		std::cout << "Floating cell inputs: " << floatingInputs << std::endl;
+
+		for(size_t l = 0; l < latchNames.size(); l++)
+			std::cout << "Latch " << l << ": " << latchNames[l] << std::endl;
+	}
+
+	// Apply fixed inputs
+	for(size_t i = 0; i < setLabels.size(); i++)
+	{
+		if(labelNet.count(setLabels[i].first) == 0)
+		{
+			std::cout << "Error: Unknown label '" << setLabels[i].first << "'" << std::endl;
+			return 0;
+		}
+		forceNet(labelNet[setLabels[i].first], setLabels[i].second);
+	}
+
+	int clockNet = -1;
+	if(labelNet.count(clockLabel) != 0)
+		clockNet = labelNet[clockLabel];
+	else
+		std::cout << "Warning: The clock label '" << clockLabel << "' was not found, the circuit will not be clocked" << std::endl;
+
+	// Let the power-on state settle, then run the clock
+	for(int c = 0; c < (int)cells.size(); c++)
+		schedule(c);
+	if(!settle())
+		return 0;
+
+	for(long long cycle = 0; cycle < cycles && clockNet != -1; cycle++)
+	{
+		forceNet(clockNet, true);
+		if(!settle())
+			return 0;
+		forceNet(clockNet, false);
+		if(!settle())
+			return 0;
+
+		if(trace)
+		{
+			std::cout << "Cycle " << cycle + 1 << ":" << std::endl;
+			printLabels();
+		}
+	}
+
+	if(!trace)
+		printLabels();
+
+	if(stats)
+		std::cout << "Cell evaluations: " << evaluationCount << std::endl;
+
+	if(dumpPath != NULL && !dumpSram(dumpPath))
+		return 0;
+
+	if(compareCycles != 0 && !compareWithCore(argv[2], cycles / compareCycles, registers))
+		return 0;
+
+	std::cout << "Done!" << std::endl;
+	return 1;
+}
+
+// Read the circuit file and create nodes and cells for every supported element
+bool loadCircuit(const char * path)
+{
+	std::ifstream source(path);
+	if(!source.is_open())
+	{
+		std::cout << "Error: The circuit file failed to open" << std::endl;
+		return false;
+	}
+
+	// Composite models are stored after the elements that use them, so read them first
+	std::vector<std::string> lines;
+	std::string line;
+	while(std::getline(source, line))
+	{
+		if(!line.empty() && line[line.size() - 1] == '\r')
+			line.erase(line.size() - 1);
+		lines.push_back(line);
+
+		if(line.size() < 2 || line[0] != '.' || line[1] != ' ')
+			continue;
+
+		std::istringstream tokens(line);
+		std::string dot, name;
+		int flags, pinCount;
+		CompositeModel model;
+		tokens >> dot >> name >> flags >> model.sizeX >> model.sizeY >> pinCount;
+
+		for(int i = 0; i < pinCount; i++)
+		{
+			std::string pinName;
+			int node, pos, side;
+			tokens >> pinName >> node >> pos >> side;
+			model.pinNode.push_back(node);
+			model.pinPos.push_back(pos);
+			model.pinSide.push_back(side);
+		}
+
+		std::string elementList;
+		tokens >> elementList;
+		elementList = unescape(elementList);
+
+		size_t start = 0;
+		while(start < elementList.size())
+		{
+			size_t end = elementList.find('\r', start);
+			if(end == std::string::npos)
+				end = elementList.size();
+			model.elements.push_back(elementList.substr(start, end - start));
+			start = end + 1;
+		}
+
+		compositeModels[unescape(name)] = model;
+	}
+
+	source.close();
+
+	for(size_t l = 0; l < lines.size(); l++)
+	{
+		std::istringstream tokens(lines[l]);
+		std::string type;
+		int x1, y1, x2, y2, flags;
+		if(!(tokens >> type) || type == "$" || type == "." || type == "o" || type == "h")
+			continue;
+		if(!(tokens >> x1 >> y1 >> x2 >> y2 >> flags))
+			continue;
+
+		if(type == "w")
+		{
+			joinNodes(nodeAtPost(x1, y1), nodeAtPost(x2, y2));
+		}
+		else if(type == "207") // Labeled node
+		{
+			std::string text;
+			tokens >> text;
+			text = unescape(text);
+
+			int node = nodeAtPost(x1, y1);
+			if(labelNode.count(text) == 0)
+				labelNode[text] = node;
+			else
+				joinNodes(labelNode[text], node);
+		}
+		else if(type == "L") // Logic input (a gate without inputs drives a constant, position 0 is low)
+		{
+			int position;
+			tokens >> position;
+
+			std::vector<int> nodes(1, nodeAtPost(x1, y1));
+			addGate(position != 0 ? CELL_NOR : CELL_OR, nodes);
+		}
+		else if(type == "M") // Logic output (only reads its post)
+		{
+			nodeAtPost(x1, y1);
+		}
+		else if(type == "I") // Inverter
+		{
+			std::vector<int> nodes;
+			nodes.push_back(nodeAtPost(x1, y1));
+			nodes.push_back(nodeAtPost(x2, y2));
+			addGate(CELL_NOT, nodes);
+		}
+		else if(type == "150" || type == "151" || type == "152" || type == "153" || type == "154") // Gates
+		{
+			int inputCount;
+			tokens >> inputCount;
+
+			// Inputs are spread out perpendicular to the line from the first point to the output
+			int length = std::max(std::abs(x2 - x1), std::abs(y2 - y1)),
+				perpX = (y2 - y1) / (length == 0 ? 1 : length),
+				perpY = (x1 - x2) / (length == 0 ? 1 : length),
+				offset = -inputCount / 2;
+
+			std::vector<int> nodes;
+			for(int i = 0; i < inputCount; i++, offset++)
+			{
+				if(offset == 0 && inputCount % 2 == 0)
+					offset += 1;
+				nodes.push_back(nodeAtPost(x1 + perpX * GATE_INPUT_SPACING * offset, y1 + perpY * GATE_INPUT_SPACING * offset));
+			}
+			nodes.push_back(nodeAtPost(x2, y2));
+
+			const int gateTypes[5] = {CELL_AND, CELL_NAND, CELL_OR, CELL_NOR, CELL_XOR};
+			addGate(gateTypes[std::atoi(type.c_str()) - 150], nodes);
+		}
+		else if(type == "168") // Latch
+		{
+			int bits;
+			tokens >> bits;
+
+			std::vector<int> pos, side;
+			for(int i = 0; i < bits; i++)
+			{
+				pos.push_back(bits - 1 - i);
+				side.push_back(SIDE_W);
+			}
+			for(int i = 0; i < bits; i++)
+			{
+				pos.push_back(bits - 1 - i);
+				side.push_back(SIDE_E);
+			}
+			pos.push_back(bits);
+			side.push_back(SIDE_W);
+
+			addLatch(chipPosts(x1, y1, flags, 2, pos, side), "168 at (" + std::to_string(x1) + ", " + std::to_string(y1) + ")");
+		}
+		else if(type == "185") // Demultiplexer
+		{
+			int selectBits;
+			tokens >> selectBits;
+
+			// Outputs on the east side, select bits (lowest first) on the south side, the input on the west side
+			int outputCount = 1 << selectBits;
+			std::vector<int> pos, side;
+			for(int i = 0; i < outputCount; i++)
+			{
+				pos.push_back(i);
+				side.push_back(SIDE_E);
+			}
+			for(int i = 0; i < selectBits; i++)
+			{
+				pos.push_back(i);
+				side.push_back(SIDE_S);
+			}
+			pos.push_back(0);
+			side.push_back(SIDE_W);
+
+			addDemux(chipPosts(x1, y1, flags, 1 + selectBits, pos, side, 1 + outputCount), selectBits);
+		}
+		else if(type == "188") // Sequence generator
+		{
+			int bitCount, data;
+			tokens >> bitCount >> data;
+
+			// The clock on the west side, the output on the east side one pin lower
+			std::vector<int> pos, side;
+			pos.push_back(0);
+			side.push_back(SIDE_W);
+			pos.push_back(1);
+			side.push_back(SIDE_E);
+
+			addSeqGen(chipPosts(x1, y1, flags, 2, pos, side), bitCount, data);
+		}
+		else if(type == "196") // Full adder
+		{
+			int bits;
+			tokens >> bits;
+
+			std::vector<int> pos, side;
+			for(int i = 0; i < bits; i++) // A
+			{
+				pos.push_back(bits - 1 - i);
+				side.push_back(SIDE_W);
+			}
+			for(int i = 0; i < bits; i++) // B
+			{
+				pos.push_back(bits * 2 - 1 - i);
+				side.push_back(SIDE_W);
+			}
+			for(int i = 0; i < bits; i++) // Sum
+			{
+				pos.push_back(bits - 1 - i);
+				side.push_back(SIDE_E);
+			}
+			pos.push_back(bits * 2); // Carry in
+			side.push_back(SIDE_W);
+			pos.push_back(bits); // Carry out
+			side.push_back(SIDE_E);
+
+			addFullAdder(chipPosts(x1, y1, flags, 5, pos, side));
+		}
+		else if(type == "413") // SRAM
+		{
+			int addressBits, dataBits, value;
+			tokens >> addressBits >> dataBits;
+
+			// Contents are stored as runs: a start address followed by values, ended by -1 (the list ends with -2)
+			std::vector<int> contents(1 << addressBits, 0);
+			while(tokens >> value && value >= 0)
+			{
+				int address = value;
+				while(tokens >> value && value >= 0)
+				{
+					if(address < (int)contents.size())
+						contents[address] = value;
+					address += 1;
+				}
+				if(value == -2)
+					break;
+			}
+
+			int sizeY = std::max(addressBits, dataBits) + 1;
+			std::vector<int> pos, side;
+			pos.push_back(0); // Write enable (active low)
+			side.push_back(SIDE_W);
+			pos.push_back(0); // Output enable (active low)
+			side.push_back(SIDE_E);
+			for(int i = 0; i < addressBits; i++) // Most significant bit first
+			{
+				pos.push_back(sizeY - addressBits + i);
+				side.push_back(SIDE_W);
+			}
+			for(int i = 0; i < dataBits; i++)
+			{
+				pos.push_back(sizeY - dataBits + i);
+				side.push_back(SIDE_E);
+			}
+
+			addSram(chipPosts(x1, y1, flags, 5, pos, side), addressBits, dataBits, contents);
+		}
+		else if(type == "410") // Custom composite chip
+		{
+			std::string name;
+			tokens >> name;
+			name = unescape(name);
+
+			if(compositeModels.count(name) == 0)
+			{
+				std::cout << "Error: Unknown composite model '" << name << "'" << std::endl;
+				return false;
+			}
+
+			CompositeModel & model = compositeModels[name];
+			std::vector<int> posts = chipPosts(x1, y1, flags, model.sizeX, model.pinPos, model.pinSide);
+
+			// Nodes inside the model are private to this chip unless they are connected to a pin
+			std::map<int, int> localNodes;
+			for(size_t p = 0; p < posts.size(); p++)
+			{
+				if(localNodes.count(model.pinNode[p]) == 0)
+					localNodes[model.pinNode[p]] = posts[p];
+				else
+					joinNodes(localNodes[model.pinNode[p]], posts[p]);
+			}
+
+			for(size_t e = 0; e < model.elements.size(); e++)
+			{
+				std::istringstream elementTokens(model.elements[e]);
+				std::string elementType;
+				std::vector<int> nodes;
+				int node;
+				elementTokens >> elementType;
+				while(elementTokens >> node)
+				{
+					if(localNodes.count(node) == 0)
+						localNodes[node] = newNode();
+					nodes.push_back(localNodes[node]);
+				}
+
+				addModelElement(elementType, nodes, name + " at (" + std::to_string(x1) + ", " + std::to_string(y1) + ")");
+			}
+		}
+		else
+		{
+			unsupportedElements[type] += 1;
+		}
+	}
+
+	return true;
+}
+
+// Undo the escaping CircuitJS applies to text stored in the circuit file
+std::string unescape(const std::string & text)
+{
+	std::string result;
+	for(size_t i = 0; i < text.size(); i++)
+	{
+		if(text[i] != '\\' || i + 1 == text.size())
+		{
+			result += text[i];
+			continue;
+		}
+
+		i += 1;
+		switch(text[i])
+		{
+			case 's': result += ' '; break;
+			case 'p': result += '+'; break;
+			case 'q': result += '='; break;
+			case 'h': result += '#'; break;
+			case 'a': result += '&'; break;
+			case 'r': result += '\r'; break;
+			case 'n': result += '\n'; break;
+			default: result += text[i]; break;
+		}
+	}
+	return result;
+}
+
+// Create a node that is not attached to any post
+int newNode(void)
+{
+	nodeParent.push_back(nodeParent.size());
+	postCount.push_back(0);
+	return nodeParent.size() - 1;
+}
+
+int findNode(int node)
+{
+	while(nodeParent[node] != node)
+	{
+		nodeParent[node] = nodeParent[nodeParent[node]];
+		node = nodeParent[node];
+	}
+	return node;
+}
+
+void joinNodes(int a, int b)
+{
+	a = findNode(a);
+	b = findNode(b);
+	if(a != b)
+	{
+		nodeParent[b] = a;
+		postCount[a] += postCount[b];
+	}
+}
+
+// Get the node attached to a post, creating it if this is the first post at that coordinate
+int nodeAtPost(int x, int y)
+{
+	std::pair<int, int> point(x, y);
+	if(postNode.count(point) == 0)
+		postNode[point] = newNode();
+
+	postCount[findNode(postNode[point])] += 1;
+	return postNode[point];
+}
+
+// Get the posts of a chip from the position and side of each pin
+	// sizeY is the height of the chip in pins (0 (zero) if it is one more than the lowest pin on the west or east side)
+std::vector<int> chipPosts(int x, int y, int flags, int sizeX, const std::vector<int> & pos, const std::vector<int> & side, int sizeY)
+{
+	std::vector<int> posts;
+	int maxPos = sizeY - 1;
+	for(size_t i = 0; i < pos.size() && sizeY == 0; i++)
+		if(side[i] == SIDE_W || side[i] == SIDE_E)
+			maxPos = std::max(maxPos, pos[i]);
+
+	for(size_t i = 0; i < pos.size(); i++)
+	{
+		int s = side[i];
+		if((flags & CHIP_FLAG_FLIP_X) != 0 && (s == SIDE_W || s == SIDE_E))
+			s = (s == SIDE_W) ? SIDE_E : SIDE_W;
+		if((flags & CHIP_FLAG_FLIP_Y) != 0 && (s == SIDE_N || s == SIDE_S))
+			s = (s == SIDE_N) ? SIDE_S : SIDE_N;
+
+		int px = x,
+			py = y;
+		switch(s)
+		{
+			case SIDE_N:
+				px = x + CHIP_PIN_SPACING * (pos[i] + 1);
+				py = y - CHIP_PIN_SPACING;
+				break;
+			case SIDE_S:
+				px = x + CHIP_PIN_SPACING * (pos[i] + 1);
+				py = y + CHIP_PIN_SPACING * (maxPos + 1);
+				break;
+			case SIDE_W:
+				py = y + CHIP_PIN_SPACING * pos[i];
+				break;
+			case SIDE_E:
+				px = x + CHIP_PIN_SPACING * (sizeX + 1);
+				py = y + CHIP_PIN_SPACING * pos[i];
+				break;
+		}
+		posts.push_back(nodeAtPost(px, py));
+	}
+	return posts;
+}
+
+void addCell(int type, const std::vector<int> & in, const std::vector<int> & out, int data)
+{
+	Cell cell;
+	cell.type = type;
+	cell.inStart = cellIn.size();
+	cell.inCount = in.size();
+	cell.outStart = cellOut.size();
+	cell.outCount = out.size();
+	cell.level = 0;
+	cell.data = data;
+
+	cellIn.insert(cellIn.end(), in.begin(), in.end());
+	cellOut.insert(cellOut.end(), out.begin(), out.end());
+	cells.push_back(cell);
+}
+
+// The last node of a gate is its output
+void addGate(int type, const std::vector<int> & nodes)
+{
+	std::vector<int> in(nodes.begin(), nodes.end() - 1),
+					 out(1, nodes.back());
+	addCell(type, in, out);
+}
+
+// Nodes: A[bits], B[bits], sum[bits], carry in, carry out
+void addFullAdder(const std::vector<int> & nodes)
+{
+	int bits = (nodes.size() - 2) / 3,
+		carry = nodes[bits * 3];
+
+	for(int i = 0; i < bits; i++)
+	{
+		int a = nodes[i],
+			b = nodes[bits + i],
+			halfSum = newNode(),
+			carryA = newNode(),
+			carryB = newNode(),
+			carryOut = (i == bits - 1) ? nodes[bits * 3 + 1] : newNode();
+
+		std::vector<int> gate;
+		gate.push_back(a); gate.push_back(b); gate.push_back(halfSum);
+		addGate(CELL_XOR, gate);
+		gate.clear(); gate.push_back(halfSum); gate.push_back(carry); gate.push_back(nodes[bits * 2 + i]);
+		addGate(CELL_XOR, gate);
+		gate.clear(); gate.push_back(a); gate.push_back(b); gate.push_back(carryA);
+		addGate(CELL_AND, gate);
+		gate.clear(); gate.push_back(halfSum); gate.push_back(carry); gate.push_back(carryB);
+		addGate(CELL_AND, gate);
+		gate.clear(); gate.push_back(carryA); gate.push_back(carryB); gate.push_back(carryOut);
+		addGate(CELL_OR, gate);
+
+		carry = carryOut;
+	}
+}
+
+// Nodes: data in[bits], data out[bits], load
+void addLatch(const std::vector<int> & nodes, const std::string & name)
+{
+	int bits = (nodes.size() - 1) / 2;
+	std::vector<int> in(nodes.begin(), nodes.begin() + bits),
+					 out(nodes.begin() + bits, nodes.begin() + bits * 2);
+	in.push_back(nodes.back());
+
+	latchLastLoad.push_back(false);
+	latchNames.push_back(std::to_string(bits) + " bits, " + name);
+	addCell(CELL_LATCH, in, out, latchLastLoad.size() - 1);
+}
+
+// Nodes: clock, output
+void addSeqGen(const std::vector<int> & nodes, int bitCount, int data)
+{
+	SeqGen seqGen;
+	seqGen.bitCount = std::max(bitCount, 1);
+	seqGen.data = data;
+	seqGen.position = 0;
+	seqGen.lastClock = false;
+	seqGens.push_back(seqGen);
+
+	std::vector<int> in(1, nodes[0]),
+					 out(1, nodes[1]);
+	addCell(CELL_SEQGEN, in, out, seqGens.size() - 1);
+}
+
+// Nodes: outputs[1 << selectBits], select[selectBits] (lowest bit first), input
+void addDemux(const std::vector<int> & nodes, int selectBits)
+{
+	int outputCount = 1 << selectBits;
+	std::vector<int> in(nodes.begin() + outputCount, nodes.end()),
+					 out(nodes.begin(), nodes.begin() + outputCount);
+	addCell(CELL_DEMUX, in, out);
+}
+
+// Nodes: write enable, output enable, address[addressBits], data[dataBits]
+void addSram(const std::vector<int> & nodes, int addressBits, int dataBits, const std::vector<int> & contents)
+{
+	Sram sram;
+	sram.addressBits = addressBits;
+	sram.dataBits = dataBits;
+	sram.contents = contents;
+	srams.push_back(sram);
+
+	// Inputs: address, data, write enable, output enable
+	std::vector<int> in(nodes.begin() + 2, nodes.end()),
+					 out(nodes.begin() + 2 + addressBits, nodes.end());
+	in.push_back(nodes[0]);
+	in.push_back(nodes[1]);
+	addCell(CELL_SRAM, in, out, srams.size() - 1);
+}
+
+// Add an element found inside a composite model
+void addModelElement(const std::string & element, const std::vector<int> & localNodes, const std::string & name)
+{
+	if(element == "AndGateElm")
+		addGate(CELL_AND, localNodes);
+	else if(element == "NandGateElm")
+		addGate(CELL_NAND, localNodes);
+	else if(element == "OrGateElm")
+		addGate(CELL_OR, localNodes);
+	else if(element == "NorGateElm")
+		addGate(CELL_NOR, localNodes);
+	else if(element == "XorGateElm")
+		addGate(CELL_XOR, localNodes);
+	else if(element == "InverterElm")
+		addGate(CELL_NOT, localNodes);
+	else if(element == "FullAdderElm")
+		addFullAdder(localNodes);
+	else if(element == "LatchElm")
+		addLatch(localNodes, name);
+	else
+		unsupportedElements[element] += 1;
+}
+
+// Compress nodes into nets and build the fanout lists. Nets with more than one driver get a private net per
+// driver and an OR cell that combines them (an undriven output pulls low).
+void buildNets(void)
+{
+	std::vector<int> nodeNet(nodeParent.size(), -1);
+	for(size_t n = 0; n < nodeParent.size(); n++)
+	{
+		int root = findNode(n);
+		if(nodeNet[root] == -1)
+			nodeNet[root] = netCount++;
+		nodeNet[n] = nodeNet[root];
+	}
+
+	for(size_t i = 0; i < cellIn.size(); i++)
+		cellIn[i] = nodeNet[cellIn[i]];
+	for(size_t i = 0; i < cellOut.size(); i++)
+		cellOut[i] = nodeNet[cellOut[i]];
+	for(std::map<std::string, int>::iterator it = labelNode.begin(); it != labelNode.end(); it++)
+		labelNet[it->first] = nodeNet[it->second];
+
+	std::vector<std::vector<int> > drivers(netCount);
+	for(size_t i = 0; i < cellOut.size(); i++)
+		drivers[cellOut[i]].push_back(i);
+
+	netDriven.assign(netCount, false);
+	for(int net = 0; net < (int)drivers.size(); net++)
+		netDriven[net] = !drivers[net].empty();
+
+	for(int net = 0; net < (int)drivers.size(); net++)
+	{
+		if(drivers[net].size() < 2)
+			continue;
+
+		std::vector<int> privateNets,
+						 out(1, net);
+		for(size_t d = 0; d < drivers[net].size(); d++)
+		{
+			cellOut[drivers[net][d]] = netCount;
+			privateNets.push_back(netCount++);
+		}
+		addCell(CELL_OR, privateNets, out);
+	}
+
+	fanoutStart.assign(netCount + 1, 0);
+	for(size_t i = 0; i < cellIn.size(); i++)
+		fanoutStart[cellIn[i] + 1] += 1;
+	for(int n = 0; n < netCount; n++)
+		fanoutStart[n + 1] += fanoutStart[n];
+
+	fanout.resize(cellIn.size());
+	std::vector<int> fill(fanoutStart.begin(), fanoutStart.end() - 1);
+	for(size_t c = 0; c < cells.size(); c++)
+		for(int i = 0; i < cells[c].inCount; i++)
+			fanout[fill[cellIn[cells[c].inStart + i]]++] = c;
+
+	netValue.assign((netCount + 63) / 64, 0);
+	netForced.assign(netCount, false);
+	netDriven.resize(netCount, true); // The private nets of a net with several drivers
+	cellQueued.assign(cells.size(), false);
+}
+
+// Give every cell a level one higher than the cells driving its inputs. Latch and sequence generator outputs do
+// not pass their level on (they only change on a clock edge), and edges that close a feedback loop are ignored.
+void levelize(void)
+{
+	std::vector<int> netDriver(netCount, -1);
+	for(size_t c = 0; c < cells.size(); c++)
+		if(cells[c].type != CELL_LATCH && cells[c].type != CELL_SEQGEN)
+			for(int o = 0; o < cells[c].outCount; o++)
+				netDriver[cellOut[cells[c].outStart + o]] = c;
+
+	// Iterative depth-first search, a cell is placed after all of its (non-feedback) drivers
+	std::vector<int> state(cells.size(), 0), // 0 = not visited, 1 = on the stack, 2 = done
+					 order;
+	std::vector<std::pair<int, int> > stack;
+	for(size_t root = 0; root < cells.size(); root++)
+	{
+		if(state[root] != 0)
+			continue;
+
+		stack.push_back(std::make_pair((int)root, 0));
+		state[root] = 1;
+		while(!stack.empty())
+		{
+			int c = stack.back().first,
+				i = stack.back().second;
+			if(i < cells[c].inCount)
+			{
+				stack.back().second += 1;
+				int driver = netDriver[cellIn[cells[c].inStart + i]];
+				if(driver != -1 && state[driver] == 0)
+				{
+					state[driver] = 1;
+					stack.push_back(std::make_pair(driver, 0));
+				}
+			}
+			else
+			{
+				state[c] = 2;
+				order.push_back(c);
+				stack.pop_back();
+			}
+		}
+	}
+
+	std::vector<int> done(cells.size(), 0);
+	for(size_t i = 0; i < order.size(); i++)
+	{
+		Cell & cell = cells[order[i]];
+		cell.level = 0;
+		for(int j = 0; j < cell.inCount; j++)
+		{
+			int driver = netDriver[cellIn[cell.inStart + j]];
+			if(driver != -1 && done[driver])
+				cell.level = std::max(cell.level, cells[driver].level + 1);
+		}
+		done[order[i]] = 1;
+		maxLevel = std::max(maxLevel, cell.level);
+	}
+
+	levelQueue.assign(maxLevel + 1, std::vector<int>());
+}
+
+inline bool getNet(int net)
+{
+	return (netValue[net >> 6] >> (net & 63)) & 1;
+}
+
+inline bool netFloating(int net)
+{
+	return !netDriven[net] && !netForced[net];
+}
+
+// Change the value of a net and schedule every cell that reads it
+inline void setNet(int net, bool value)
+{
+	if(getNet(net) == value || netForced[net])
+		return;
+
+	netValue[net >> 6] ^= (uint64_t)1 << (net & 63);
+	for(int i = fanoutStart[net]; i < fanoutStart[net + 1]; i++)
+		schedule(fanout[i]);
+}
+
+// Drive a net from outside of the circuit (cells can no longer change it)
+void forceNet(int net, bool value)
+{
+	netForced[net] = false;
+	setNet(net, value);
+	netForced[net] = true;
+}
+
+inline void schedule(int cell)
+{
+	if(cellQueued[cell])
+		return;
+
+	cellQueued[cell] = true;
+	levelQueue[cells[cell].level].push_back(cell);
+	restartLevel = std::min(restartLevel, cells[cell].level);
+}
+
+void evaluateCell(int c)
+{
+	const Cell & cell = cells[c];
+	const int * in = &cellIn[cell.inStart];
+	bool value;
+
+	evaluationCount += 1;
+
+	switch(cell.type)
+	{
+		case CELL_AND:
+		case CELL_NAND:
+			value = true;
+			for(int i = 0; i < cell.inCount && value; i++)
+				value = getNet(in[i]);
+			setNet(cellOut[cell.outStart], value != (cell.type == CELL_NAND));
+			break;
+		case CELL_OR:
+		case CELL_NOR:
+			value = false;
+			for(int i = 0; i < cell.inCount && !value; i++)
+				value = getNet(in[i]);
+			setNet(cellOut[cell.outStart], value != (cell.type == CELL_NOR));
+			break;
+		case CELL_XOR:
+			value = false;
+			for(int i = 0; i < cell.inCount; i++)
+				value = value != getNet(in[i]);
+			setNet(cellOut[cell.outStart], value);
+			break;
+		case CELL_NOT:
+			setNet(cellOut[cell.outStart], !getNet(in[0]));
+			break;
+		case CELL_LATCH:
+		{
+			// Copy the inputs to the outputs on the rising edge of the load pin
+			bool load = getNet(in[cell.inCount - 1]);
+			if(load && !latchLastLoad[cell.data])
+				for(int i = 0; i < cell.outCount; i++)
+					setNet(cellOut[cell.outStart + i], getNet(in[i]));
+			latchLastLoad[cell.data] = load;
+			break;
+		}
+		case CELL_SRAM:
+		{
+			Sram & sram = srams[cell.data];
+			int address = 0,
+				data = 0;
+			for(int i = 0; i < sram.addressBits; i++)
+				address = (address << 1) | getNet(in[i]);
+			for(int i = 0; i < sram.dataBits; i++)
+				data = (data << 1) | getNet(in[sram.addressBits + i]);
+
+			// The enable pins are active low, a floating pin (or a floating address) is not an enable
+			bool addressFloating = false;
+			for(int i = 0; i < sram.addressBits; i++)
+				addressFloating = addressFloating || netFloating(in[i]);
+
+			int writePin = in[cell.inCount - 2],
+				outputPin = in[cell.inCount - 1];
+			bool writeEnable = !netFloating(writePin) && !getNet(writePin) && !addressFloating,
+				 outputEnable = !netFloating(outputPin) && !getNet(outputPin) && !writeEnable;
+
+			if(writeEnable)
+				sram.contents[address] = data;
+
+			for(int i = 0; i < sram.dataBits; i++)
+				setNet(cellOut[cell.outStart + i], outputEnable && ((sram.contents[address] >> (sram.dataBits - 1 - i)) & 1));
+			break;
+		}
+		case CELL_SEQGEN:
+		{
+			SeqGen & seqGen = seqGens[cell.data];
+			bool clock = getNet(in[0]);
+			if(clock && !seqGen.lastClock)
+			{
+				setNet(cellOut[cell.outStart], (seqGen.data >> seqGen.position) & 1);
+				seqGen.position = (seqGen.position + 1) % seqGen.bitCount;
+			}
+			seqGen.lastClock = clock;
+			break;
+		}
+		case CELL_DEMUX:
+		{
+			// The selected output follows the input, the others are low
+			int select = 0;
+			for(int i = 0; i < cell.inCount - 1; i++)
+				select |= getNet(in[i]) << i;
+			for(int i = 0; i < cell.outCount; i++)
+				setNet(cellOut[cell.outStart + i], i == select && getNet(in[cell.inCount - 1]));
+			break;
+		}
+	}
+}
+
+// Evaluate scheduled cells, lowest level first, until no more cells are scheduled
+bool settle(void)
+{
+	long long limit = evaluationCount + (long long)MAX_EVALUATIONS_PER_CELL * (cells.size() + 1);
+
+	for(int level = restartLevel; level <= maxLevel; level++)
+	{
+		restartLevel = maxLevel + 1;
+
+		std::vector<int> & queue = levelQueue[level];
+		for(size_t i = 0; i < queue.size(); i++) // Cells on this level may schedule other cells on this level
+		{
+			cellQueued[queue[i]] = false;
+			evaluateCell(queue[i]);
+		}
+		queue.clear();
+
+		// A feedback loop scheduled a cell on a lower level
+		if(restartLevel <= level)
+			level = restartLevel - 1;
+
+		if(evaluationCount > limit)
+		{
+			std::cout << "Error: The circuit did not settle (it may contain an oscillating feedback loop)" << std::endl;
+			return false;
+		}
+	}
+
+	restartLevel = maxLevel + 1;
+	return true;
+}
+
+// Load a rom file (two bytes per word, high byte first) into the first SRAM chip
+bool loadRom(const char * path)
+{
+	if(srams.empty())
+	{
+		std::cout << "Error: The circuit does not contain an SRAM chip to load the ROM into" << std::endl;
+		return false;
+	}
+
+	std::ifstream source(path, std::ios::binary);
+	if(!source.is_open())
+	{
+		std::cout << "Error: ROM file failed to open" << std::endl;
+		return false;
+	}
+
+	Sram & sram = srams[0];
+	char high, low;
+	for(size_t address = 0; address < sram.contents.size() && source.get(high) && source.get(low); address++)
+		sram.contents[address] = ((unsigned char)high * 256 + (unsigned char)low) & ((1 << sram.dataBits) - 1);
+
+	source.close();
+	return true;
+}
+
+// Write the contents of the first SRAM chip to a file (two bytes per word, high byte first)
+bool dumpSram(const char * path)
+{
+	if(srams.empty())
+	{
+		std::cout << "Error: The circuit does not contain an SRAM chip to dump" << std::endl;
+		return false;
+	}
+
+	std::ofstream target(path, std::ios::binary | std::ios::trunc);
+	if(!target.is_open())
+	{
+		std::cout << "Error: The dump file failed to open" << std::endl;
+		return false;
+	}
+
+	for(size_t address = 0; address < srams[0].contents.size(); address++)
+		target << (char)(srams[0].contents[address] >> 8) << (char)(srams[0].contents[address] & 255);
+
+	target.close();
+	return true;
+}
+
+void printLabels(void)
+{
+	for(std::map<std::string, int>::iterator it = labelNet.begin(); it != labelNet.end(); it++)
+		std::cout << "    " << it->first << ": " << getNet(it->second) << std::endl;
+}
+
+// Run the rom on the processor of the virtual computer and compare its RAM and registers with the circuit
+	// GIN reads 0 (zero) and SOT is ignored, as the circuit has no I/O devices
+bool compareWithCore(const char * romPath, long long instructions, const std::vector<std::pair<std::string, int> > & registers)
+{
+	std::ifstream source(romPath, std::ios::binary);
+	if(!source.is_open())
+	{
+		std::cout << "Error: ROM file failed to open" << std::endl;
+		return false;
+	}
+
+	VC_State * vc = new VC_State();
+	char high, low;
+	for(int address = 0; address < VC_RAM_SIZE && source.get(high) && source.get(low); address++)
+		vc->ram[address] = (unsigned char)high * 256 + (unsigned char)low;
+	source.close();
+
+	VC_NoIO io;
+	int log[4];
+	for(long long i = 0; i < instructions; i++)
+		VC_execute(*vc, io, log);
+
+	std::cout << "Compared with the virtual computer after " << instructions << " instruction(s):" << std::endl;
+
+	int differences = 0,
+		first = -1;
+	const std::vector<int> & ram = srams[0].contents;
+	for(int address = 0; address < VC_RAM_SIZE; address++)
+	{
+		int word = address < (int)ram.size() ? ram[address] : 0;
+		if(word != vc->ram[address])
+		{
+			differences += 1;
+			if(first < 0)
+				first = address;
+		}
+	}
+	if(differences == 0)
+		std::cout << "    RAM: same" << std::endl;
+	else
+		std::cout << "    RAM: " << differences << " word(s) differ, the first is ram[" << first << "] (circuit "
+				  << (first < (int)ram.size() ? ram[first] : 0) << ", virtual computer " << vc->ram[first] << ")" << std::endl;
+
+	for(size_t r = 0; r < registers.size(); r++)
+	{
+		const std::string & name = registers[r].first;
+		int expected = name == "iar" ? vc->iar : name == "rA" ? vc->rA : name == "rB" ? vc->rB : vc->rC,
+			value = 0;
+
+		// Find the cell of the latch (output i is bit i)
+		for(size_t c = 0; c < cells.size(); c++)
+		{
+			if(cells[c].type == CELL_LATCH && cells[c].data == registers[r].second)
+			{
+				for(int i = 0; i < cells[c].outCount; i++)
+					value |= getNet(cellOut[cells[c].outStart + i]) << i;
+				break;
+			}
+		}
+
+		std::cout << "    " << name << ": circuit " << value << ", virtual computer " << expected << std::endl;
+		differences += value != expected;
+	}
+	delete vc;
+
+	if(differences != 0)
+	{
+		std::cout << "Error: The circuit and the virtual computer differ" << std::endl;
+		return false;
+	}
+	return true;
+}
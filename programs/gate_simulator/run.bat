@@ -0,0 +1,2 @@
+gate_simulator.exe ..\..\circuit-js-CVC.txt ..\..\data\bin_data\rom.dat 1000 -stats -compare 4
+cmd /k
\ No newline at end of file
@@ -0,0 +1,2 @@
+g++ linker_source.cpp -O2 -mwindows -lmingw32 -o linker.exe
+cmd /k
\ No newline at end of file
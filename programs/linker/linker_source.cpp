@@ -0,0 +1,462 @@
+/*
+
+Linker for the virtual computer.
+
+Guest programs can be split into modules that are assembled on their own into relocatable object files. The
+linker lays the modules out one after another from ram[0] (where execution starts), resolves the symbols they
+import from each other, fixes up the 12 bit operands that refer to addresses and writes one image in the same
+format as rom.dat. Only modules that changed have to be assembled again before linking.
+
+Modules in library files are only linked if another linked module imports one of their symbols, so a program
+can list a whole library of shared routines and get only the routines it uses. A module that is given more than
+once (by name, for example a library routine listed by several libraries) is linked once.
+
+Usage:
+
+    linker.exe [options] <object files>
+
+    -lib <file>         Object file of library modules (linked only when used, can be given more than once)
+    -out <file>         Image file (default: rom.dat)
+    -map <file>         Write the address of every module and symbol to a text file
+
+    Modules are laid out in the order they are given, starting with the first module of the first object file.
+    Library modules follow in the order they are first used.
+
+Object file format:
+
+    Object files are text files. Everything after a ";" (semi-colon) on a line is a comment.
+
+    module <name>               Start a module (a file can hold any number of modules)
+    words <word> ...            Append words to the module (decimal, 0 to 65535, any number per line)
+    export <symbol> <offset>    The symbol is the address of word <offset> of the module
+    reloc <offset>              The operand of word <offset> is an offset in the module (the address of the
+                                module is added to it)
+    reloc <offset> <symbol>     The symbol is imported, its address is added to the operand of word <offset>
+
+    Offsets start at 0 (zero) for the first word of the module. Relocated operands are the low 12 bits of a word
+    and must still be less than 4096 after the address is added.
+
+    Example (a module that jumps to a routine exported by another module):
+
+        module main
+        words 36865 0 36864     ; JMP 1, LDA 0, JMP 0
+        reloc 0                 ; JMP 1 jumps to word 1 of this module
+        reloc 2 print           ; JMP 0 jumps to the symbol print
+        export main 0
+
+*/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <cstdlib>
+#include "../../source/virtual_computer_core.h"
+
+// Declare types
+
+	// A symbol exported by a module
+	struct Symbol
+	{
+		std::string name;
+		int offset;
+	};
+
+	// An operand to fix up when the module is placed
+		// symbol is empty for operands that are offsets in the module
+	struct Relocation
+	{
+		int offset;
+		std::string symbol;
+	};
+
+	struct Module
+	{
+		std::string name,
+					path;
+		std::vector<int> words;
+		std::vector<Symbol> exports;
+		std::vector<Relocation> relocations;
+		bool library,
+			 linked;
+		int address;
+	};
+
+// Declare variables
+std::vector<Module> modules;
+std::map<std::string, int> moduleIndex; // Module name -> index in modules
+int duplicateModules = 0; // Modules skipped because a module with the same name was already loaded
+
+// Declare functions
+bool loadObjectFile(const std::string & path, bool library);
+bool addModule(Module & module);
+bool sameModule(const Module & a, const Module & b);
+bool writeMap(const char * path, const std::map<std::string, int> & symbols);
+
+int main(int argc, char** argv)
+{
+	std::cout << std::endl;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	const char * outPath = "rom.dat",
+			   * mapPath = NULL;
+	bool fileGiven = false;
+
+	for(int i = 1; i < argc; i++)
+	{
+		std::string option = argv[i];
+
+		if(option[0] != '-')
+		{
+			if(!loadObjectFile(option, false))
+				return 0;
+			fileGiven = true;
+			continue;
+		}
+
+		if(i + 1 == argc)
+		{
+			std::cout << "Error: Missing value for option '" << option << "'" << std::endl;
+			return 0;
+		}
+
+		if(option == "-lib")
+		{
+			if(!loadObjectFile(argv[++i], true))
+				return 0;
+		}
+		else if(option == "-out")
+			outPath = argv[++i];
+		else if(option == "-map")
+			mapPath = argv[++i];
+		else
+		{
+			std::cout << "Error: Unknown option '" << option << "'" << std::endl;
+			return 0;
+		}
+	}
+
+	if(!fileGiven)
+	{
+		std::cout << "Error: No object files were given" << std::endl;
+		return 0;
+	}
+
+	// Find the module that exports each symbol
+	std::map<std::string, int> exporter;
+	for(size_t m = 0; m < modules.size(); m++)
+	{
+		for(size_t s = 0; s < modules[m].exports.size(); s++)
+		{
+			const Symbol & symbol = modules[m].exports[s];
+			if(exporter.count(symbol.name) != 0)
+			{
+				std::cout << "Error: Symbol '" << symbol.name << "' is exported by both '" << modules[exporter[symbol.name]].name
+						  << "' and '" << modules[m].name << "'" << std::endl;
+				return 0;
+			}
+			exporter[symbol.name] = m;
+		}
+	}
+
+	// Link every module that isn't in a library, then every library module that a linked module imports from
+		// order is the layout order
+	std::vector<int> order;
+	for(size_t m = 0; m < modules.size(); m++)
+	{
+		if(!modules[m].library)
+		{
+			modules[m].linked = true;
+			order.push_back(m);
+		}
+	}
+
+	for(size_t i = 0; i < order.size(); i++)
+	{
+		const Module & module = modules[order[i]];
+		for(size_t r = 0; r < module.relocations.size(); r++)
+		{
+			const std::string & symbol = module.relocations[r].symbol;
+			if(symbol.empty())
+				continue;
+
+			std::map<std::string, int>::iterator found = exporter.find(symbol);
+			if(found == exporter.end())
+			{
+				std::cout << "Error: Symbol '" << symbol << "' imported by '" << module.name << "' is not exported by any module" << std::endl;
+				return 0;
+			}
+
+			if(!modules[found->second].linked)
+			{
+				modules[found->second].linked = true;
+				order.push_back(found->second);
+			}
+		}
+	}
+
+	// Lay out the modules
+	int size = 0;
+	for(size_t i = 0; i < order.size(); i++)
+	{
+		Module & module = modules[order[i]];
+		module.address = size;
+		size += module.words.size();
+	}
+
+	if(size > VC_RAM_SIZE)
+	{
+		std::cout << "Error: The linked modules need " << size << " words, RAM has " << VC_RAM_SIZE << std::endl;
+		return 0;
+	}
+
+	std::map<std::string, int> symbols; // Symbol -> address (linked modules only)
+	for(size_t i = 0; i < order.size(); i++)
+	{
+		const Module & module = modules[order[i]];
+		for(size_t s = 0; s < module.exports.size(); s++)
+			symbols[module.exports[s].name] = module.address + module.exports[s].offset;
+	}
+
+	// Build the image and fix up the relocated operands
+	std::vector<int> image(size, 0);
+	for(size_t i = 0; i < order.size(); i++)
+	{
+		const Module & module = modules[order[i]];
+		for(size_t w = 0; w < module.words.size(); w++)
+			image[module.address + w] = module.words[w];
+
+		for(size_t r = 0; r < module.relocations.size(); r++)
+		{
+			const Relocation & relocation = module.relocations[r];
+			int & word = image[module.address + relocation.offset],
+				operand = (word & 4095) + (relocation.symbol.empty() ? module.address : symbols[relocation.symbol]);
+
+			if(operand > 4095)
+			{
+				std::cout << "Error: Operand of word " << relocation.offset << " of '" << module.name << "' is " << operand
+						  << " after relocation (exceeds 4095)" << std::endl;
+				return 0;
+			}
+			word = (word & ~4095) | operand;
+		}
+	}
+
+	std::ofstream target(outPath, std::ios::binary | std::ios::trunc);
+	if(!target.is_open())
+	{
+		std::cout << "Error: The target file failed to open" << std::endl;
+		return 0;
+	}
+	for(int i = 0; i < size; i++)
+		target << (char)(image[i] >> 8) << (char)(image[i] & 255);
+	target.close();
+
+	if(mapPath != NULL && !writeMap(mapPath, symbols))
+		return 0;
+
+	// Report address space usage
+	std::cout << "Module                          Address   Words" << std::endl;
+	for(size_t i = 0; i < order.size(); i++)
+	{
+		const Module & module = modules[order[i]];
+		std::string name = module.name + (module.library ? " (library)" : "");
+		name.resize(name.size() < 32 ? 32 : name.size(), ' ');
+		std::cout << name << module.address;
+		std::cout << std::string(10 - std::to_string(module.address).size(), ' ') << module.words.size() << std::endl;
+	}
+
+	int unused = 0;
+	for(size_t m = 0; m < modules.size(); m++)
+		unused += !modules[m].linked;
+
+	std::cout << std::endl;
+	std::cout << "Used: " << size << " of " << VC_RAM_SIZE << " words (" << (size * 100 / VC_RAM_SIZE) << "%), free: "
+			  << VC_RAM_SIZE - size << " words from address " << size << std::endl;
+	std::cout << "Modules: " << order.size() << " linked, " << unused << " unused library module(s), "
+			  << duplicateModules << " duplicate(s) skipped" << std::endl;
+	std::cout << "Linked in " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()
+			  << " ms" << std::endl;
+	std::cout << "Done!" << std::endl;
+
+	return 1;
+}
+
+// Read the modules in an object file (see the object file format at the top of this file)
+bool loadObjectFile(const std::string & path, bool library)
+{
+	std::ifstream source(path);
+	if(!source.is_open())
+	{
+		std::cout << "Error: Object file '" << path << "' failed to open" << std::endl;
+		return false;
+	}
+
+	Module module;
+	bool inModule = false;
+	std::string line;
+	for(int lineNumber = 1; std::getline(source, line); lineNumber++)
+	{
+		size_t comment = line.find(';');
+		if(comment != std::string::npos)
+			line.erase(comment);
+
+		std::istringstream tokens(line);
+		std::string keyword;
+		if(!(tokens >> keyword))
+			continue;
+
+		if(keyword == "module")
+		{
+			if(inModule && !addModule(module))
+				return false;
+
+			module = Module();
+			module.path = path;
+			module.library = library;
+			module.linked = false;
+			module.address = 0;
+			inModule = (bool)(tokens >> module.name);
+			if(!inModule)
+			{
+				std::cout << "Error: Missing module name in '" << path << "' at line " << lineNumber << std::endl;
+				return false;
+			}
+			continue;
+		}
+
+		if(!inModule)
+		{
+			std::cout << "Error: '" << keyword << "' before the first module in '" << path << "' at line " << lineNumber << std::endl;
+			return false;
+		}
+
+		bool valid = true;
+		if(keyword == "words")
+		{
+			long word;
+			while(tokens >> word)
+			{
+				if(word < 0 || word > 65535)
+					valid = false;
+				module.words.push_back(word);
+			}
+			valid = valid && tokens.eof();
+		}
+		else if(keyword == "export")
+		{
+			Symbol symbol;
+			valid = (bool)(tokens >> symbol.name >> symbol.offset) && symbol.offset >= 0;
+			module.exports.push_back(symbol);
+		}
+		else if(keyword == "reloc")
+		{
+			Relocation relocation;
+			valid = (bool)(tokens >> relocation.offset) && relocation.offset >= 0;
+			tokens >> relocation.symbol;
+			module.relocations.push_back(relocation);
+		}
+		else
+		{
+			valid = false;
+		}
+
+		if(!valid)
+		{
+			std::cout << "Error: Invalid line in '" << path << "' at line " << lineNumber << std::endl;
+			return false;
+		}
+	}
+
+	if(!inModule)
+	{
+		std::cout << "Error: No modules in '" << path << "'" << std::endl;
+		return false;
+	}
+	return addModule(module);
+}
+
+// Add a module that was read from an object file (modules that were already added are skipped)
+bool addModule(Module & module)
+{
+	for(size_t s = 0; s < module.exports.size(); s++)
+	{
+		if(module.exports[s].offset >= (int)module.words.size())
+		{
+			std::cout << "Error: Symbol '" << module.exports[s].name << "' of '" << module.name << "' is outside the module" << std::endl;
+			return false;
+		}
+	}
+	for(size_t r = 0; r < module.relocations.size(); r++)
+	{
+		if(module.relocations[r].offset >= (int)module.words.size())
+		{
+			std::cout << "Error: Relocation of word " << module.relocations[r].offset << " of '" << module.name << "' is outside the module" << std::endl;
+			return false;
+		}
+	}
+
+	std::map<std::string, int>::iterator found = moduleIndex.find(module.name);
+	if(found != moduleIndex.end())
+	{
+		Module & existing = modules[found->second];
+		if(!sameModule(existing, module))
+		{
+			std::cout << "Error: Module '" << module.name << "' in '" << module.path << "' is different from the module with the same name in '"
+					  << existing.path << "'" << std::endl;
+			return false;
+		}
+
+		// A module given as a program module is always linked
+		existing.library = existing.library && module.library;
+		duplicateModules += 1;
+		return true;
+	}
+
+	moduleIndex[module.name] = modules.size();
+	modules.push_back(module);
+	return true;
+}
+
+bool sameModule(const Module & a, const Module & b)
+{
+	if(a.words != b.words || a.exports.size() != b.exports.size() || a.relocations.size() != b.relocations.size())
+		return false;
+
+	for(size_t s = 0; s < a.exports.size(); s++)
+	{
+		if(a.exports[s].name != b.exports[s].name || a.exports[s].offset != b.exports[s].offset)
+			return false;
+	}
+	for(size_t r = 0; r < a.relocations.size(); r++)
+	{
+		if(a.relocations[r].offset != b.relocations[r].offset || a.relocations[r].symbol != b.relocations[r].symbol)
+			return false;
+	}
+	return true;
+}
+
+// Write the address of every linked module and symbol
+bool writeMap(const char * path, const std::map<std::string, int> & symbols)
+{
+	std::ofstream target(path, std::ios::trunc);
+	if(!target.is_open())
+	{
+		std::cout << "Error: The map file failed to open" << std::endl;
+		return false;
+	}
+
+	for(size_t m = 0; m < modules.size(); m++)
+	{
+		if(modules[m].linked)
+			target << "module " << modules[m].name << " " << modules[m].address << " " << modules[m].words.size() << "\n";
+	}
+	for(std::map<std::string, int>::const_iterator symbol = symbols.begin(); symbol != symbols.end(); ++symbol)
+		target << "symbol " << symbol->first << " " << symbol->second << "\n";
+
+	target.close();
+	return true;
+}
@@ -0,0 +1,2 @@
+g++ rom_archive_source.cpp -O2 -lmingw32 -o rom_archive.exe
+cmd /k
\ No newline at end of file
@@ -0,0 +1,525 @@
+/*
+
+ROM archive tool for the virtual computer.
+
+Packs a corpus of ROM images (test programs, demos, fuzzer finds) into one archive file with the metadata needed
+to run each one: its name, the words it reads from the input handler, the outputs it is expected to send and the
+number of instructions to run. The entries are indexed at the start of the file and sorted by name, and the file
+is mapped into memory when it is opened, so a batch run starts executing within milliseconds however many images
+the archive holds (see source/virtual_computer_archive.h for the file format).
+
+The virtual computer runs one image of an archive with virtual_computer.exe -archive <file>:<name>.
+
+Usage:
+
+    rom_archive.exe build <archive> <manifest>      Build an archive from a manifest file
+    rom_archive.exe list <archive>                  List the images in an archive
+    rom_archive.exe extract <archive> <directory>   Write every image as <name>.dat and a manifest.txt that
+                                                    builds the same archive (the directory must exist)
+    rom_archive.exe run <archive> [name]            Run every image (or one) and check its outputs
+
+    run executes images on the processor only: GIN reads the words of the input script in order (0 after the
+    last one, and the input flag is set while words are left) and SOT records the device and word it sends
+    without sending them to a device. An image passes when the words it sent match its expected outputs.
+
+Manifest format:
+
+    Manifests are text files. Everything after a ";" (semi-colon) on a line is a comment.
+
+    rom <name> <file>           Start an entry. The file is in the same format as rom.dat (at most 4096 words),
+                                relative paths are relative to the directory of the manifest. Names are made of
+                                letters, digits, "_", "-" and "."
+    budget <count>              Instructions to run (default 1000000)
+    input <word> ...            Append words to the input script (at most 4096 words)
+    expect <device> <word> ...  Append expected outputs (pairs of a device and a word). An entry without an
+                                expect line isn't checked, "expect" on its own expects no outputs
+
+    Words are decimal, or hexadecimal with a "0x" prefix.
+
+    Example:
+
+        rom echo roms/echo.dat
+        budget 5000
+        input 72 105
+        expect 1 72 1 105
+
+*/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include "../../source/virtual_computer_archive.h"
+
+// Declare types
+
+	// An entry read from a manifest
+	struct Image
+	{
+		std::string name;
+		std::vector<int> words,
+						 input,
+						 expect;
+		bool checked; // Has an expect line
+		uint64_t budget;
+	};
+
+	// Input and output devices seen by an image while it runs
+	struct ArchiveIO
+	{
+		const VC_Archive * archive;
+		const VC_ArchiveEntry * entry;
+		uint32_t inputsRead,
+				 outputCount;
+		long long mismatch; // Index of the first output that differs from the expected outputs (-1 if none has)
+
+		int input(void)
+		{
+			if(inputsRead == entry->inputWords)
+				return 0;
+			return VC_archiveWord(*archive, entry->inputOffset, inputsRead++);
+		}
+
+		void output(int io_device, int operand)
+		{
+			if(mismatch < 0 && (2 * outputCount >= entry->expectWords
+								|| VC_archiveWord(*archive, entry->expectOffset, 2 * outputCount) != io_device
+								|| VC_archiveWord(*archive, entry->expectOffset, 2 * outputCount + 1) != operand))
+				mismatch = outputCount;
+			outputCount += 1;
+		}
+	};
+
+// Declare functions
+bool readManifest(const std::string & path, std::vector<Image> & images);
+bool readRom(const std::string & path, std::vector<int> & words);
+bool parseWord(const std::string & text, int & word);
+bool validName(const std::string & name);
+bool buildArchive(const std::string & path, const std::string & manifest);
+bool listArchive(const VC_Archive & archive);
+bool extractArchive(const VC_Archive & archive, const std::string & directory);
+bool runArchive(const VC_Archive & archive, const char * name, std::chrono::steady_clock::time_point start);
+void putWord(std::string & data, int word);
+
+int main(int argc, char** argv)
+{
+	std::cout << std::endl;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	if(argc < 3)
+	{
+		std::cout << "Usage: rom_archive.exe <build | list | extract | run> <archive> [manifest | directory | name]" << std::endl;
+		return 0;
+	}
+
+	std::string command = argv[1],
+				path = argv[2];
+
+	if(command == "build")
+	{
+		if(argc < 4)
+		{
+			std::cout << "Error: 'build' needs a manifest file" << std::endl;
+			return 0;
+		}
+		if(!buildArchive(path, argv[3]))
+			return 0;
+	}
+	else if(command == "list" || command == "extract" || command == "run")
+	{
+		VC_Archive archive;
+		if(!VC_openArchive(archive, path))
+		{
+			std::cout << "Error: Archive '" << path << "' failed to open or is not a ROM archive" << std::endl;
+			return 0;
+		}
+
+		bool done;
+		if(command == "list")
+			done = listArchive(archive);
+		else if(command == "extract" && argc >= 4)
+			done = extractArchive(archive, argv[3]);
+		else if(command == "extract")
+		{
+			std::cout << "Error: 'extract' needs a directory" << std::endl;
+			done = false;
+		}
+		else
+			done = runArchive(archive, argc >= 4 ? argv[3] : NULL, start);
+
+		VC_closeArchive(archive);
+		if(!done)
+			return 0;
+	}
+	else
+	{
+		std::cout << "Error: Unknown command '" << command << "'" << std::endl;
+		return 0;
+	}
+
+	std::cout << "Done in " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()
+			  << " ms" << std::endl;
+	return 1;
+}
+
+// Read the entries of a manifest (see the manifest format at the top of this file)
+bool readManifest(const std::string & path, std::vector<Image> & images)
+{
+	std::ifstream source(path);
+	if(!source.is_open())
+	{
+		std::cout << "Error: Manifest '" << path << "' failed to open" << std::endl;
+		return false;
+	}
+
+	// Relative ROM paths start from the directory of the manifest
+	size_t slash = path.find_last_of("/\\");
+	std::string directory = slash == std::string::npos ? "" : path.substr(0, slash + 1);
+
+	std::string line;
+	for(int lineNumber = 1; std::getline(source, line); lineNumber++)
+	{
+		size_t comment = line.find(';');
+		if(comment != std::string::npos)
+			line.erase(comment);
+
+		std::istringstream tokens(line);
+		std::string keyword;
+		if(!(tokens >> keyword))
+			continue;
+
+		if(keyword == "rom")
+		{
+			Image image;
+			std::string file;
+			image.checked = false;
+			image.budget = VC_ARCHIVE_DEFAULT_BUDGET;
+			if(!(tokens >> image.name >> file) || !validName(image.name))
+			{
+				std::cout << "Error: Invalid name or missing file in '" << path << "' at line " << lineNumber << std::endl;
+				return false;
+			}
+
+			bool absolute = file[0] == '/' || file[0] == '\\' || (file.size() > 1 && file[1] == ':');
+			if(!readRom(absolute ? file : directory + file, image.words))
+				return false;
+			images.push_back(image);
+			continue;
+		}
+
+		if(images.empty())
+		{
+			std::cout << "Error: '" << keyword << "' before the first rom in '" << path << "' at line " << lineNumber << std::endl;
+			return false;
+		}
+
+		Image & image = images.back();
+		bool valid = true;
+		std::string text;
+		if(keyword == "budget")
+		{
+			long long budget;
+			valid = (bool)(tokens >> budget) && budget >= 0;
+			image.budget = budget;
+		}
+		else if(keyword == "input" || keyword == "expect")
+		{
+			std::vector<int> & words = keyword == "input" ? image.input : image.expect;
+			int word;
+			while(tokens >> text)
+			{
+				valid = valid && parseWord(text, word);
+				words.push_back(word);
+			}
+			image.checked = image.checked || keyword == "expect";
+		}
+		else
+		{
+			valid = false;
+		}
+
+		if(!valid)
+		{
+			std::cout << "Error: Invalid line in '" << path << "' at line " << lineNumber << std::endl;
+			return false;
+		}
+		if(image.input.size() > (size_t)VC_RAM_SIZE || image.expect.size() % 2 != 0)
+		{
+			std::cout << "Error: '" << image.name << "' has more than " << VC_RAM_SIZE << " input words or an expected output"
+					  << " without a word, in '" << path << "' at line " << lineNumber << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+// Read an image in the format of rom.dat (16 bit big endian words)
+bool readRom(const std::string & path, std::vector<int> & words)
+{
+	std::ifstream source(path, std::ios::binary);
+	if(!source.is_open())
+	{
+		std::cout << "Error: ROM file '" << path << "' failed to open" << std::endl;
+		return false;
+	}
+
+	char bytes[2];
+	while(source.read(bytes, 2))
+		words.push_back((unsigned char)bytes[0] * 256 + (unsigned char)bytes[1]);
+
+	if(source.gcount() != 0 || words.size() > (size_t)VC_RAM_SIZE)
+	{
+		std::cout << "Error: ROM file '" << path << "' has an odd number of bytes or more than " << VC_RAM_SIZE << " words" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// Read a word from 0 to 65535 (decimal, or hexadecimal with a "0x" prefix)
+bool parseWord(const std::string & text, int & word)
+{
+	char * end;
+	long long number = std::strtoll(text.c_str(), &end, 0);
+	word = (int)number;
+	return *end == '\0' && number >= 0 && number <= 65535;
+}
+
+// Names are used as file names by extract and follow a ':' in -archive <file>:<name>
+bool validName(const std::string & name)
+{
+	for(size_t i = 0; i < name.size(); i++)
+	{
+		char c = name[i];
+		if(!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-' || c == '.'))
+			return false;
+	}
+	return !name.empty();
+}
+
+// Write an archive: the header, the entries sorted by name, then the names and words of every entry
+bool buildArchive(const std::string & path, const std::string & manifest)
+{
+	std::vector<Image> images;
+	if(!readManifest(manifest, images))
+		return false;
+
+	std::sort(images.begin(), images.end(), [](const Image & a, const Image & b) { return a.name < b.name; });
+	for(size_t i = 1; i < images.size(); i++)
+	{
+		if(images[i].name == images[i - 1].name)
+		{
+			std::cout << "Error: '" << images[i].name << "' is in the manifest more than once" << std::endl;
+			return false;
+		}
+	}
+
+	VC_ArchiveHeader header = {};
+	std::memcpy(header.magic, VC_ARCHIVE_MAGIC, 4);
+	header.version = VC_ARCHIVE_VERSION;
+	header.entryCount = images.size();
+
+	std::vector<VC_ArchiveEntry> entries(images.size());
+	std::string data;
+	uint64_t dataStart = sizeof(VC_ArchiveHeader) + images.size() * sizeof(VC_ArchiveEntry);
+	for(size_t i = 0; i < images.size(); i++)
+	{
+		const Image & image = images[i];
+		VC_ArchiveEntry & entry = entries[i];
+
+		entry.nameOffset = dataStart + data.size();
+		entry.nameLength = image.name.size();
+		data += image.name;
+		if(data.size() % 2 != 0)
+			data += '\0';
+
+		entry.imageOffset = dataStart + data.size();
+		entry.imageWords = image.words.size();
+		for(size_t w = 0; w < image.words.size(); w++)
+			putWord(data, image.words[w]);
+
+		entry.inputOffset = dataStart + data.size();
+		entry.inputWords = image.input.size();
+		for(size_t w = 0; w < image.input.size(); w++)
+			putWord(data, image.input[w]);
+
+		entry.expectOffset = image.checked ? dataStart + data.size() : 0; // 0 (zero): not checked
+		entry.expectWords = image.expect.size();
+		for(size_t w = 0; w < image.expect.size(); w++)
+			putWord(data, image.expect[w]);
+
+		entry.budget = image.budget;
+	}
+	header.size = dataStart + data.size();
+
+	std::ofstream target(path, std::ios::binary | std::ios::trunc);
+	if(!target.is_open())
+	{
+		std::cout << "Error: The archive file failed to open" << std::endl;
+		return false;
+	}
+	target.write((const char *)&header, sizeof(header));
+	if(!entries.empty())
+		target.write((const char *)&entries[0], entries.size() * sizeof(VC_ArchiveEntry));
+	target.write(data.data(), data.size());
+	target.close();
+
+	std::cout << "Archived " << images.size() << " image(s), " << header.size << " bytes" << std::endl;
+	return true;
+}
+
+// Show the entries of an archive
+bool listArchive(const VC_Archive & archive)
+{
+	std::cout << "Name                            Words     Input     Outputs   Budget" << std::endl;
+	for(uint32_t i = 0; i < archive.entryCount; i++)
+	{
+		const VC_ArchiveEntry & entry = archive.entries[i];
+		std::string columns[5] = {VC_archiveName(archive, entry), std::to_string(entry.imageWords), std::to_string(entry.inputWords),
+								  entry.expectOffset == 0 ? "-" : std::to_string(entry.expectWords / 2), std::to_string(entry.budget)};
+		columns[0].resize(columns[0].size() < 32 ? 32 : columns[0].size(), ' ');
+		for(int c = 1; c < 4; c++)
+			columns[c].resize(columns[c].size() < 10 ? 10 : columns[c].size(), ' ');
+		std::cout << columns[0] << columns[1] << columns[2] << columns[3] << columns[4] << std::endl;
+	}
+	std::cout << std::endl << archive.entryCount << " image(s)" << std::endl;
+	return true;
+}
+
+// Write every image as a rom.dat file and a manifest that lists them with their metadata
+bool extractArchive(const VC_Archive & archive, const std::string & directory)
+{
+	std::string prefix = directory;
+	if(!prefix.empty() && prefix.back() != '/' && prefix.back() != '\\')
+		prefix += '/';
+
+	std::ofstream manifest(prefix + "manifest.txt", std::ios::trunc);
+	if(!manifest.is_open())
+	{
+		std::cout << "Error: '" << prefix << "manifest.txt' failed to open" << std::endl;
+		return false;
+	}
+
+	for(uint32_t i = 0; i < archive.entryCount; i++)
+	{
+		const VC_ArchiveEntry & entry = archive.entries[i];
+		std::string name = VC_archiveName(archive, entry);
+
+		std::ofstream target(prefix + name + ".dat", std::ios::binary | std::ios::trunc);
+		if(!target.is_open())
+		{
+			std::cout << "Error: '" << prefix << name << ".dat' failed to open" << std::endl;
+			return false;
+		}
+		for(uint32_t w = 0; w < entry.imageWords; w++)
+		{
+			int word = VC_archiveWord(archive, entry.imageOffset, w);
+			target << (char)(word >> 8) << (char)(word & 255);
+		}
+		target.close();
+
+		manifest << "rom " << name << " " << name << ".dat" << std::endl;
+		manifest << "budget " << entry.budget << std::endl;
+		if(entry.inputWords > 0)
+		{
+			manifest << "input";
+			for(uint32_t w = 0; w < entry.inputWords; w++)
+				manifest << " " << VC_archiveWord(archive, entry.inputOffset, w);
+			manifest << std::endl;
+		}
+		if(entry.expectOffset != 0)
+		{
+			manifest << "expect";
+			for(uint32_t w = 0; w < entry.expectWords; w++)
+				manifest << " " << VC_archiveWord(archive, entry.expectOffset, w);
+			manifest << std::endl;
+		}
+	}
+
+	std::cout << "Extracted " << archive.entryCount << " image(s) to '" << directory << "'" << std::endl;
+	return true;
+}
+
+// Run every image (or the one called name) for its budget and compare its outputs with the expected outputs
+bool runArchive(const VC_Archive & archive, const char * name, std::chrono::steady_clock::time_point start)
+{
+	uint32_t first = 0,
+			 last = archive.entryCount;
+	if(name != NULL)
+	{
+		const VC_ArchiveEntry * entry = VC_findArchiveEntry(archive, name);
+		if(entry == NULL)
+		{
+			std::cout << "Error: '" << name << "' is not in the archive" << std::endl;
+			return false;
+		}
+		first = entry - archive.entries;
+		last = first + 1;
+	}
+
+	VC_State * vc = new VC_State();
+	int log[4];
+	uint32_t passed = 0,
+			 failed = 0,
+			 unchecked = 0;
+	double firstInstruction = -1;
+
+	for(uint32_t i = first; i < last; i++)
+	{
+		const VC_ArchiveEntry & entry = archive.entries[i];
+		*vc = VC_State();
+		VC_loadArchiveImage(archive, entry, vc->ram);
+		ArchiveIO io = {&archive, &entry, 0, 0, -1};
+
+		if(firstInstruction < 0)
+			firstInstruction = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		for(uint64_t step = 0; step < entry.budget; step++)
+		{
+			vc->flag[2] = io.inputsRead < entry.inputWords;
+			VC_execute(*vc, io, log);
+		}
+
+		if(entry.expectOffset == 0)
+		{
+			unchecked += 1;
+			continue;
+		}
+
+		// Fewer outputs than expected is a mismatch at the first missing one
+		if(io.mismatch < 0 && 2 * io.outputCount < entry.expectWords)
+			io.mismatch = io.outputCount;
+
+		if(io.mismatch < 0)
+		{
+			passed += 1;
+			continue;
+		}
+
+		failed += 1;
+		std::cout << "FAIL " << VC_archiveName(archive, entry) << ": output " << io.mismatch << " differs (" << io.outputCount << " sent)";
+		if(2 * io.mismatch < entry.expectWords)
+			std::cout << " (expected device " << VC_archiveWord(archive, entry.expectOffset, 2 * io.mismatch) << " word "
+					  << VC_archiveWord(archive, entry.expectOffset, 2 * io.mismatch + 1) << ")";
+		else
+			std::cout << " (no more outputs expected)";
+		std::cout << std::endl;
+	}
+	delete vc;
+
+	std::cout << std::endl << "Passed: " << passed << ", failed: " << failed << ", not checked: " << unchecked << std::endl;
+	if(firstInstruction >= 0)
+		std::cout << "First instruction after " << firstInstruction << " ms" << std::endl;
+	return true;
+}
+
+// Append a 16 bit little endian word
+void putWord(std::string & data, int word)
+{
+	data += (char)(word & 255);
+	data += (char)(word >> 8);
+}
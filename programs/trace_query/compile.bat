@@ -0,0 +1,2 @@
+g++ trace_query_source.cpp -O2 -lmingw32 -o trace_query.exe
+cmd /k
\ No newline at end of file
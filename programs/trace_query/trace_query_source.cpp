@@ -0,0 +1,168 @@
+/*
+
+Trace query tool for the virtual computer.
+
+Answers questions about an execution trace written by the virtual computer (virtual_computer.exe -exectrace
+<file>) without reading the whole trace. The first query builds an index file next to the trace (the name of the
+trace followed by ".idx") that lists the writes to each address and the instructions executed at each address.
+Every query after that is a few binary searches, so it takes about as long on a trace of billions of instructions
+as on a short one.
+
+Usage:
+
+    trace_query.exe <trace file> <query>
+
+    index                           Build the index again (other queries build it when it is missing or was made
+                                    from a shorter trace)
+    lastwrite <address> [count]     The last write to ram[address] before the instruction at count (default: the
+                                    end of the trace)
+    visits <address> [from] [to]    Every instruction executed at address with an instruction count from from to
+                                    to - 1 (default: the whole trace)
+    value <address> <count>         The value of ram[address] before the instruction at count
+    registers <count>               The registers before the instruction at count
+
+    Addresses and counts are decimal, or hexadecimal with a "0x" prefix. Instruction counts are the same as the
+    counts shown by the debug console (the first instruction is 0).
+
+    Example (which instruction last wrote ram[0x2A0] before iar first reached 0x100):
+
+        trace_query.exe trace.bin visits 0x100          ; the first line is the first visit, say count 5120
+        trace_query.exe trace.bin lastwrite 0x2A0 5120
+
+*/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include "../../source/virtual_computer_exec_trace.h"
+
+// Declare prototypes
+
+bool parseNumber(const char * text, long long & number);
+void printRecord(const VC_ExecRecord & record);
+void printRegisters(const VC_ExecRecord & record);
+
+int main(int argc, char** argv)
+{
+	std::cout << std::endl;
+
+	if(argc < 3)
+	{
+		std::cout << "Usage: trace_query.exe <trace file> <index | lastwrite | visits | value | registers> [arguments]" << std::endl;
+		return 0;
+	}
+
+	std::string path = argv[1],
+				query = argv[2];
+	long long arguments[3] = {-1, -1, -1};
+	int argumentCount = argc - 3;
+	for(int i = 0; i < argumentCount; i++)
+	{
+		if(i == 3 || !parseNumber(argv[3 + i], arguments[i]))
+		{
+			std::cout << "Error: Invalid argument '" << argv[3 + i] << "'" << std::endl;
+			return 0;
+		}
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	if(query == "index" && !VC_indexExecTrace(path))
+	{
+		std::cout << "Error: Trace file '" << path << "' could not be indexed" << std::endl;
+		return 0;
+	}
+
+	VC_ExecTrace trace;
+	if(!VC_loadExecTrace(trace, path))
+	{
+		std::cout << "Error: Trace file '" << path << "' failed to open or is not an execution trace" << std::endl;
+		return 0;
+	}
+
+	// The instruction count after the last record
+	long long end = trace.records == 0 ? 0 : VC_readExecRecord(trace.file, trace.records - 1).count + 1;
+
+	bool needsAddress = query == "lastwrite" || query == "visits" || query == "value";
+	if(needsAddress && (argumentCount < 1 || arguments[0] >= VC_RAM_SIZE))
+	{
+		std::cout << "Error: '" << query << "' needs an address from 0 to " << VC_RAM_SIZE - 1 << std::endl;
+		return 0;
+	}
+
+	if(query == "index")
+	{
+		std::cout << "Indexed " << trace.records << " records" << std::endl;
+	}
+	else if(query == "lastwrite")
+	{
+		long long count = argumentCount >= 2 ? arguments[1] : end;
+		long long number = VC_findLastWrite(trace, arguments[0], count);
+		if(number < 0)
+			std::cout << "ram[" << arguments[0] << "] was not written before instruction " << count << std::endl;
+		else
+			printRecord(VC_readExecRecord(trace.file, number));
+	}
+	else if(query == "visits")
+	{
+		std::vector<uint64_t> visits = VC_findVisits(trace, arguments[0], argumentCount >= 2 ? arguments[1] : 0,
+													 argumentCount >= 3 ? arguments[2] : end);
+		for(size_t i = 0; i < visits.size(); i++)
+			printRecord(VC_readExecRecord(trace.file, visits[i]));
+		std::cout << visits.size() << " instructions were executed at " << arguments[0] << std::endl;
+	}
+	else if(query == "value" && argumentCount >= 2)
+	{
+		std::cout << "ram[" << arguments[0] << "] = " << VC_findValue(trace, arguments[0], arguments[1])
+				  << " before instruction " << arguments[1] << std::endl;
+	}
+	else if(query == "registers" && argumentCount >= 1)
+	{
+		printRegisters(VC_findRegisters(trace, arguments[0]));
+	}
+	else
+	{
+		std::cout << "Error: Unknown query '" << query << "' or missing arguments" << std::endl;
+		return 0;
+	}
+
+	double time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	std::cout << std::endl << "Query took " << time << " ms (" << trace.records << " records)" << std::endl;
+	return 0;
+}
+
+// Read a decimal or hexadecimal ("0x" prefix) number that isn't negative
+bool parseNumber(const char * text, long long & number)
+{
+	char * end;
+	number = std::strtoll(text, &end, 0);
+	return *text != '\0' && *end == '\0' && number >= 0;
+}
+
+// Show a record on one line
+void printRecord(const VC_ExecRecord & record)
+{
+	std::cout << "count " << record.count << ": ";
+	if(record.type == VC_EXEC_INSTRUCTION)
+		std::cout << "iar " << record.at << " " << VC_ISA[record.word >> 12].mnemonic << " " << record.word % 4096;
+	else if(record.type == VC_EXEC_DEVICE)
+		std::cout << "device (SOT at iar " << record.at << ")";
+	else
+		std::cout << "edit (before iar " << record.at << ")";
+
+	if(record.address != VC_EXEC_NO_ADDRESS)
+		std::cout << ", ram[" << record.address << "] = " << record.value;
+	std::cout << std::endl;
+}
+
+void printRegisters(const VC_ExecRecord & record)
+{
+	std::cout << "iar = " << record.iar << std::endl
+			  << "rA = " << record.rA << std::endl
+			  << "rB = " << record.rB << std::endl
+			  << "rC = " << record.rC << std::endl
+			  << "aluOp = " << record.aluOp << std::endl
+			  << "flags = " << record.flags << std::endl;
+}
@@ -0,0 +1,201 @@
+#ifndef VIRTUAL_COMPUTER_ARCHIVE_H
+#define VIRTUAL_COMPUTER_ARCHIVE_H
+
+// ROM archives: many ROM images with their metadata in one file
+// Shared by the virtual computer (source/virtual_computer_source.cpp), which runs an image from an archive with
+// -archive <file>:<name>, and the archive tool (programs/rom_archive), which builds, lists, extracts and runs them
+// An archive is a VC_ArchiveHeader, then a VC_ArchiveEntry for every image (sorted by name), then the names and words
+// the entries refer to. The whole file is mapped into memory at once, so opening an archive costs the same however
+// many images it holds, finding an image is a binary search of the entries and its words are read where they are.
+// Words are stored as 16 bit little endian numbers (images in rom.dat files are big endian).
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include "virtual_computer_core.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Declare constants
+
+	// ROM archive constants
+	const char VC_ARCHIVE_MAGIC[4] = {'V', 'C', 'R', 'A'};
+	const uint32_t VC_ARCHIVE_VERSION = 1;
+	const uint64_t VC_ARCHIVE_DEFAULT_BUDGET = 1000000; // Instructions run when an entry doesn't set a budget
+
+// Declare types
+
+	// Start of an archive file
+	struct VC_ArchiveHeader
+	{
+		char magic[4];
+		uint32_t version,
+				 entryCount,
+				 reserved;
+		uint64_t size; // Size of the archive file
+	};
+
+	// Offsets are from the start of the file
+	struct VC_ArchiveEntry
+	{
+		uint64_t nameOffset,
+				 imageOffset, // Image (loaded into RAM from ram[0])
+				 inputOffset, // Words for the input handler, in the order GIN reads them
+				 expectOffset, // Expected outputs: device and word of each SOT, in order (0 (zero) if they aren't checked)
+				 budget; // Instructions to run
+		uint32_t nameLength,
+				 imageWords,
+				 inputWords,
+				 expectWords; // Two words for each output
+	};
+
+	// An archive mapped into memory
+	struct VC_Archive
+	{
+		const unsigned char * data;
+		uint64_t size;
+		const VC_ArchiveEntry * entries;
+		uint32_t entryCount;
+#ifdef _WIN32
+		HANDLE file,
+			   mapping;
+#endif
+	};
+
+	static_assert(sizeof(VC_ArchiveHeader) == 24 && sizeof(VC_ArchiveEntry) == 56, "Archives have a fixed layout");
+
+// Unmap an archive (also called by VC_openArchive when it fails)
+inline void VC_closeArchive(VC_Archive & archive)
+{
+#ifdef _WIN32
+	if(archive.data != NULL)
+		UnmapViewOfFile(archive.data);
+	if(archive.mapping != NULL)
+		CloseHandle(archive.mapping);
+	if(archive.file != NULL && archive.file != INVALID_HANDLE_VALUE)
+		CloseHandle(archive.file);
+#else
+	if(archive.data != NULL)
+		munmap((void *)archive.data, archive.size);
+#endif
+	archive = VC_Archive();
+}
+
+// Whether a number of bytes from an offset are inside the archive (offsets are read from the file, so the check can't add them)
+inline bool VC_archiveContains(const VC_Archive & archive, uint64_t offset, uint64_t length)
+{
+	return offset <= archive.size && length <= archive.size - offset;
+}
+
+// Map an archive file into memory and check that every entry is inside it
+inline bool VC_openArchive(VC_Archive & archive, const std::string & path)
+{
+	archive = VC_Archive();
+
+#ifdef _WIN32
+	archive.file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	LARGE_INTEGER size;
+	if(archive.file == INVALID_HANDLE_VALUE || !GetFileSizeEx(archive.file, &size) || size.QuadPart < (LONGLONG)sizeof(VC_ArchiveHeader))
+	{
+		VC_closeArchive(archive);
+		return false;
+	}
+	archive.size = size.QuadPart;
+
+	archive.mapping = CreateFileMappingA(archive.file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if(archive.mapping != NULL)
+		archive.data = (const unsigned char *)MapViewOfFile(archive.mapping, FILE_MAP_READ, 0, 0, 0);
+	if(archive.data == NULL)
+	{
+		VC_closeArchive(archive);
+		return false;
+	}
+#else
+	int file = open(path.c_str(), O_RDONLY);
+	struct stat status;
+	if(file < 0 || fstat(file, &status) != 0 || status.st_size < (off_t)sizeof(VC_ArchiveHeader))
+	{
+		if(file >= 0)
+			close(file);
+		return false;
+	}
+	archive.size = status.st_size;
+
+	void * data = mmap(NULL, archive.size, PROT_READ, MAP_SHARED, file, 0);
+	close(file); // The mapping stays until munmap
+	if(data == MAP_FAILED)
+		return false;
+	archive.data = (const unsigned char *)data;
+#endif
+
+	const VC_ArchiveHeader & header = *(const VC_ArchiveHeader *)archive.data;
+	if(std::memcmp(header.magic, VC_ARCHIVE_MAGIC, 4) != 0 || header.version != VC_ARCHIVE_VERSION || header.size != archive.size
+	   || (archive.size - sizeof(VC_ArchiveHeader)) / sizeof(VC_ArchiveEntry) < header.entryCount)
+	{
+		VC_closeArchive(archive);
+		return false;
+	}
+
+	archive.entries = (const VC_ArchiveEntry *)(archive.data + sizeof(VC_ArchiveHeader));
+	archive.entryCount = header.entryCount;
+	for(uint32_t i = 0; i < archive.entryCount; i++)
+	{
+		const VC_ArchiveEntry & entry = archive.entries[i];
+		if(!VC_archiveContains(archive, entry.nameOffset, entry.nameLength)
+		   || !VC_archiveContains(archive, entry.imageOffset, 2 * (uint64_t)entry.imageWords)
+		   || !VC_archiveContains(archive, entry.inputOffset, 2 * (uint64_t)entry.inputWords)
+		   || !VC_archiveContains(archive, entry.expectOffset, 2 * (uint64_t)entry.expectWords)
+		   || entry.imageWords > (uint32_t)VC_RAM_SIZE)
+		{
+			VC_closeArchive(archive);
+			return false;
+		}
+	}
+	return true;
+}
+
+inline std::string VC_archiveName(const VC_Archive & archive, const VC_ArchiveEntry & entry)
+{
+	return std::string((const char *)archive.data + entry.nameOffset, entry.nameLength);
+}
+
+// Read word i of the words at an offset
+inline int VC_archiveWord(const VC_Archive & archive, uint64_t offset, uint32_t i)
+{
+	return archive.data[offset + 2 * i] | archive.data[offset + 2 * i + 1] << 8;
+}
+
+// Find an entry by name (returns NULL if there is none)
+inline const VC_ArchiveEntry * VC_findArchiveEntry(const VC_Archive & archive, const std::string & name)
+{
+	uint32_t first = 0,
+			 last = archive.entryCount;
+	while(first < last)
+	{
+		uint32_t middle = first + (last - first) / 2;
+		int order = VC_archiveName(archive, archive.entries[middle]).compare(name);
+		if(order == 0)
+			return &archive.entries[middle];
+		if(order < 0)
+			first = middle + 1;
+		else
+			last = middle;
+	}
+	return NULL;
+}
+
+// Copy the image of an entry to RAM (the rest of RAM is set to zero)
+inline void VC_loadArchiveImage(const VC_Archive & archive, const VC_ArchiveEntry & entry, int * ram)
+{
+	for(int i = 0; i < VC_RAM_SIZE; i++)
+		ram[i] = (uint32_t)i < entry.imageWords ? VC_archiveWord(archive, entry.imageOffset, i) : 0;
+}
+
+#endif
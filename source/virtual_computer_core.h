@@ -0,0 +1,524 @@
+#ifndef VIRTUAL_COMPUTER_CORE_H
+#define VIRTUAL_COMPUTER_CORE_H
+
+// The processor of the virtual computer (RAM, registers, ALU and instruction set)
+// Shared by the virtual computer (source/virtual_computer_source.cpp) and the tools in programs/ so that they all
+// execute instructions the same way
+// The instruction set is described once in VC_ISA. The instruction handlers, the dispatch table, the mnemonic lookup
+// used by the assembler and the operation log formatter are all generated from it at compile time
+// The interpreter is constexpr, so a ROM that doesn't read input can also be run by the compiler (see VC_evaluate)
+
+#include <utility>
+
+// Declare constants
+
+	// Virtual Computer constants
+	const int VC_RAM_SIZE = 4096, // The size of ram (in 16 bit words)
+
+			  // Operation codes
+			  VC_OP_LDA = 0,
+			  VC_OP_LAA = 1,
+			  VC_OP_ADD = 2,
+			  VC_OP_SBD = 3,
+			  VC_OP_ADA = 4,
+			  VC_OP_SBA = 5,
+			  VC_OP_STR = 6,
+			  VC_OP_STD = 7,
+			  VC_OP_SSD = 8,
+			  VC_OP_JMP = 9,
+			  VC_OP_JIZ = 10,
+			  VC_OP_JIE = 11,
+			  VC_OP_JII = 12,
+			  VC_OP_JBT = 13,
+			  VC_OP_GIN = 14,
+			  VC_OP_SOT = 15,
+			  VC_OP_COUNT = 16,
+
+			  // ALU constants
+			  VC_ALU_ADD = 1,
+			  VC_ALU_SUB = 2,
+			  VC_ALU_OTHER = 3,
+
+			  // What an instruction does (VC_Instruction::action)
+			  VC_ACTION_LOAD_A = 0, // rA <= value
+			  VC_ACTION_LOAD_B = 1, // rB <= value
+			  VC_ACTION_STORE = 2, // ram[operand] <= rC
+			  VC_ACTION_AND_NOT = 3, // rC <= rA and not rB
+			  VC_ACTION_ROTATE = 4, // rC <= rA rotated right by rB % 16 bits
+			  VC_ACTION_JUMP = 5, // iar <= operand if the jump condition is true
+			  VC_ACTION_INPUT = 6, // ram[operand] <= a word read from the IH
+			  VC_ACTION_OUTPUT = 7, // Send the operand to output device rA
+
+			  // How the operand is used (VC_Instruction::operand)
+			  VC_OPERAND_NONE = 0, // Not used (only stored in the operation log)
+			  VC_OPERAND_IMMEDIATE = 1, // The operand is the value
+			  VC_OPERAND_READ = 2, // The value is read from ram[operand]
+			  VC_OPERAND_WRITE = 3, // The result is written to ram[operand]
+			  VC_OPERAND_JUMP = 4, // The operand is an address to jump to
+			  VC_OPERAND_DEVICE = 5, // The operand is sent to an output device
+
+			  // Jump conditions (VC_Instruction::condition)
+			  VC_JUMP_ALWAYS = 0,
+			  VC_JUMP_ZERO = 1, // Zero flag is true
+			  VC_JUMP_EXTRA = 2, // Extra flag is true
+			  VC_JUMP_INPUT = 3, // Input flag is true
+			  VC_JUMP_BITS = 4, // All bits of rB are true in rA
+
+			  // Flags an instruction can change (VC_Instruction::flags)
+			  VC_FLAG_ZERO = 1,
+			  VC_FLAG_EXTRA = 2,
+
+			  // Mnemonic lookup table size (a prime number greater than VC_OP_COUNT)
+			  VC_MNEMONIC_SLOTS = 31;
+
+// Declare types
+
+	// The state of the processor
+		// All VC variables are set to 0 (zero) by default
+	struct VC_State
+	{
+		int ram[VC_RAM_SIZE],
+			iar,
+			rA,
+			rB,
+			rC,
+			aluOp;
+
+		bool flag[3]; // Zero flag, extra (carry) flag and input flag
+	};
+
+	// A row of the instruction set table
+	struct VC_Instruction
+	{
+		int opCode; // The top 4 bits of the instruction
+		const char * mnemonic; // Three upper case characters
+		int action, // VC_ACTION_*
+			operand, // VC_OPERAND_*
+			alu, // The ALU operation set by the instruction before the ALU runs (0 (zero) to keep the last one, -1 if the ALU doesn't run)
+			condition, // VC_JUMP_* (jumps only)
+			flags, // VC_FLAG_* bits that the instruction can change
+			cycles; // Clock ticks taken to execute the instruction with no bus wait states or I/O latency (see VC_executeTimed)
+
+		// Operation log format (see VC_trace)
+			// "%2" and "%3" are replaced by log[2] and log[3]
+			// notTaken is used instead of trace by conditional jumps that didn't jump
+		const char * trace,
+				   * notTaken;
+	};
+
+// The instruction set
+	// Indexed by operation code
+	// Cycles: every instruction takes one cycle to fetch and one to execute, plus one for each word of RAM it reads or
+	// writes (LAA, ADA, SBA, STR and STD) and one for GIN to store the word it reads
+	// The operation log of each instruction is log[0] = iar, log[1] = op-code and log[2] and log[3] as shown in trace
+constexpr VC_Instruction VC_ISA[VC_OP_COUNT] =
+{
+	{VC_OP_LDA, "LDA", VC_ACTION_LOAD_A, VC_OPERAND_IMMEDIATE, 0, 0, VC_FLAG_ZERO | VC_FLAG_EXTRA, 2,
+		"rA <= %2", nullptr},
+	{VC_OP_LAA, "LAA", VC_ACTION_LOAD_A, VC_OPERAND_READ, 0, 0, VC_FLAG_ZERO | VC_FLAG_EXTRA, 3,
+		"rA <= ram[%3]   | (rA <= %2)", nullptr},
+	{VC_OP_ADD, "ADD", VC_ACTION_LOAD_B, VC_OPERAND_IMMEDIATE, VC_ALU_ADD, 0, VC_FLAG_ZERO | VC_FLAG_EXTRA, 2,
+		"rA + rB   | (rB <= %2)", nullptr},
+	{VC_OP_SBD, "SBD", VC_ACTION_LOAD_B, VC_OPERAND_IMMEDIATE, VC_ALU_SUB, 0, VC_FLAG_ZERO | VC_FLAG_EXTRA, 2,
+		"rA - rB   | (rB <= %2)", nullptr},
+	{VC_OP_ADA, "ADA", VC_ACTION_LOAD_B, VC_OPERAND_READ, VC_ALU_ADD, 0, VC_FLAG_ZERO | VC_FLAG_EXTRA, 3,
+		"rA + rB   | (rB <= ram[%3])   | (rB <= %2)", nullptr},
+	{VC_OP_SBA, "SBA", VC_ACTION_LOAD_B, VC_OPERAND_READ, VC_ALU_SUB, 0, VC_FLAG_ZERO | VC_FLAG_EXTRA, 3,
+		"rA - rB   | (rB <= ram[%3])   | (rB <= %2)", nullptr},
+	{VC_OP_STR, "STR", VC_ACTION_STORE, VC_OPERAND_WRITE, -1, 0, 0, 3,
+		"ram[%3] <= %2", nullptr},
+	{VC_OP_STD, "STD", VC_ACTION_AND_NOT, VC_OPERAND_WRITE, VC_ALU_OTHER, 0, VC_FLAG_ZERO, 3,
+		"ram[%3] <= %2", nullptr},
+	{VC_OP_SSD, "SSD", VC_ACTION_ROTATE, VC_OPERAND_NONE, VC_ALU_OTHER, 0, VC_FLAG_ZERO, 2,
+		"ram[%3] <= %2", nullptr},
+	{VC_OP_JMP, "JMP", VC_ACTION_JUMP, VC_OPERAND_JUMP, -1, VC_JUMP_ALWAYS, 0, 2,
+		"jump: %2", nullptr},
+	{VC_OP_JIZ, "JIZ", VC_ACTION_JUMP, VC_OPERAND_JUMP, -1, VC_JUMP_ZERO, 0, 2,
+		"jump: %3   | zero flag was true", "did not jump   | zero flag was false"},
+	{VC_OP_JIE, "JIE", VC_ACTION_JUMP, VC_OPERAND_JUMP, -1, VC_JUMP_EXTRA, 0, 2,
+		"jump: %3   | extra flag was true", "did not jump   | extra flag was false"},
+	{VC_OP_JII, "JII", VC_ACTION_JUMP, VC_OPERAND_JUMP, -1, VC_JUMP_INPUT, 0, 2,
+		"jump: %3   | input flag was true", "did not jump   | input flag was false"},
+	{VC_OP_JBT, "JBT", VC_ACTION_JUMP, VC_OPERAND_JUMP, -1, VC_JUMP_BITS, 0, 2,
+		"jump: %3   | all selected bits were true", "did not jump   | one or more of the selected bits were false"},
+	{VC_OP_GIN, "GIN", VC_ACTION_INPUT, VC_OPERAND_WRITE, -1, 0, 0, 3,
+		"ram[%2] <= %3", nullptr},
+	{VC_OP_SOT, "SOT", VC_ACTION_OUTPUT, VC_OPERAND_DEVICE, -1, 0, 0, 2,
+		"outputDevice(%2) <= %3", nullptr}
+};
+
+// Declare and define functions
+
+// Compile-time checks of the instruction set table
+constexpr bool VC_checkIsa(void)
+{
+	for(int i = 0; i < VC_OP_COUNT; i++)
+	{
+		const char * mnemonic = VC_ISA[i].mnemonic;
+		if(VC_ISA[i].opCode != i || mnemonic[0] == 0 || mnemonic[1] == 0 || mnemonic[2] == 0 || mnemonic[3] != 0)
+			return false;
+	}
+	return true;
+}
+static_assert(VC_checkIsa(), "VC_ISA must be in op-code order and every mnemonic must have three characters");
+
+// Mnemonic lookup (a perfect hash of the three characters into VC_MNEMONIC_SLOTS slots)
+	// The seed is the smallest one that gives every mnemonic a different slot
+constexpr int VC_mnemonicHash(const char * text, unsigned seed)
+{
+	return (int)((((unsigned char)text[0] * seed + (unsigned char)text[1]) * seed + (unsigned char)text[2]) % VC_MNEMONIC_SLOTS);
+}
+
+constexpr bool VC_mnemonicHashIsPerfect(unsigned seed)
+{
+	bool used[VC_MNEMONIC_SLOTS] = {};
+	for(int i = 0; i < VC_OP_COUNT; i++)
+	{
+		int slot = VC_mnemonicHash(VC_ISA[i].mnemonic, seed);
+		if(used[slot])
+			return false;
+		used[slot] = true;
+	}
+	return true;
+}
+
+constexpr unsigned VC_findMnemonicSeed(void)
+{
+	for(unsigned seed = 1; seed < 4096; seed++)
+	{
+		if(VC_mnemonicHashIsPerfect(seed))
+			return seed;
+	}
+	return 0;
+}
+
+constexpr unsigned VC_MNEMONIC_SEED = VC_findMnemonicSeed();
+static_assert(VC_MNEMONIC_SEED != 0, "No perfect hash of the mnemonics was found, increase VC_MNEMONIC_SLOTS");
+
+struct VC_MnemonicTable
+{
+	int opCode[VC_MNEMONIC_SLOTS]; // -1 for empty slots
+};
+
+constexpr VC_MnemonicTable VC_buildMnemonicTable(void)
+{
+	VC_MnemonicTable table = {};
+	for(int i = 0; i < VC_MNEMONIC_SLOTS; i++)
+		table.opCode[i] = -1;
+	for(int i = 0; i < VC_OP_COUNT; i++)
+		table.opCode[VC_mnemonicHash(VC_ISA[i].mnemonic, VC_MNEMONIC_SEED)] = i;
+	return table;
+}
+
+constexpr VC_MnemonicTable VC_MNEMONICS = VC_buildMnemonicTable();
+
+// Get the op-code of a mnemonic (upper case) or -1 if it isn't one
+inline int VC_lookupMnemonic(const char * text, int length)
+{
+	if(length != 3)
+		return -1;
+
+	int opCode = VC_MNEMONICS.opCode[VC_mnemonicHash(text, VC_MNEMONIC_SEED)];
+	if(opCode < 0)
+		return -1;
+
+	const char * mnemonic = VC_ISA[opCode].mnemonic;
+	if(text[0] != mnemonic[0] || text[1] != mnemonic[1] || text[2] != mnemonic[2])
+		return -1;
+	return opCode;
+}
+
+// Write the operation log entry of one instruction (without the iar)
+	// Stream is any type with operator<< for const char *, char and int (std::ostream for example)
+template<typename Stream>
+inline void VC_trace(Stream & target, const int * log)
+{
+	const VC_Instruction & instruction = VC_ISA[log[1]];
+	const char * format = (instruction.notTaken != nullptr && log[2] == 0) ? instruction.notTaken : instruction.trace;
+
+	target << instruction.mnemonic << " | ";
+	for(; *format != 0; format++)
+	{
+		if(*format == '%' && (format[1] == '2' || format[1] == '3'))
+		{
+			format++;
+			target << log[*format - '0'];
+		}
+		else
+		{
+			target << *format;
+		}
+	}
+}
+
+// Perform operations in the alu
+	// State is VC_State or any type with the same registers and a ram member that can be indexed like an array
+template<typename State>
+constexpr void VC_alu(State & vc, int op)
+{
+	long temp = 0;
+
+	if(op == VC_ALU_ADD)
+	{
+		temp = vc.rA + vc.rB;
+
+		if(temp >= 65536)
+		{
+			vc.rC = temp - 65536;
+			vc.flag[1] = true;
+		}
+		else
+		{
+			vc.rC = temp;
+			vc.flag[1] = false;
+		}
+	}
+	else if(op == VC_ALU_SUB)
+	{
+		temp = vc.rA - vc.rB;
+
+		if(temp < 0)
+		{
+			vc.rC = temp + 65536;
+			vc.flag[1] = true;
+		}
+		else
+		{
+			vc.rC = temp;
+			vc.flag[1] = false;
+		}
+	}
+	else if(op == VC_ALU_OTHER)
+	{
+		// Don't do anything
+	}
+
+	if(vc.rC == 0)
+		vc.flag[0] = true;
+	else
+		vc.flag[0] = false;
+}
+
+// Execute one instruction with op-code OP (generated from VC_ISA[OP])
+	// Every test of the table is a constant, so each handler is compiled down to the code for its own instruction
+template<int OP, typename State, typename IO>
+constexpr void VC_run(State & vc, IO & io, int operand, int * log)
+{
+	constexpr VC_Instruction instruction = VC_ISA[OP];
+	bool incIar = true;
+
+	if(instruction.action == VC_ACTION_LOAD_A || instruction.action == VC_ACTION_LOAD_B)
+	{
+		int value = operand;
+		if(instruction.operand == VC_OPERAND_READ)
+			value = vc.ram[operand];
+
+		if(instruction.action == VC_ACTION_LOAD_A)
+			vc.rA = value;
+		else
+			vc.rB = value;
+
+		log[2] = value;
+		if(instruction.operand == VC_OPERAND_READ)
+			log[3] = operand;
+	}
+	else if(instruction.action == VC_ACTION_STORE)
+	{
+		vc.ram[operand] = vc.rC;
+		log[2] = vc.rC;
+		log[3] = operand;
+	}
+	else if(instruction.action == VC_ACTION_AND_NOT || instruction.action == VC_ACTION_ROTATE)
+	{
+		if(instruction.action == VC_ACTION_AND_NOT)
+		{
+			vc.rC = ~(~vc.rA | vc.rB);
+		}
+		else
+		{
+			int rA_temp = vc.rA;
+			for(int i = 0; i < vc.rB % 16; i++)
+			{
+				if(rA_temp % 2 != 0) // If rA is odd
+					rA_temp += 65536;
+				rA_temp >>= 1; // Shift down by 1
+			}
+			vc.rC = rA_temp;
+		}
+
+		if(instruction.operand == VC_OPERAND_WRITE)
+			vc.ram[operand] = vc.rC;
+		log[2] = vc.rC;
+		log[3] = operand;
+	}
+	else if(instruction.action == VC_ACTION_JUMP)
+	{
+		// JBT is (rA & (rB == rB)), the fuzzer reports where this differs from (rA & rB) == rB
+		bool jump = instruction.condition == VC_JUMP_ALWAYS
+					|| (instruction.condition == VC_JUMP_ZERO && vc.flag[0])
+					|| (instruction.condition == VC_JUMP_EXTRA && vc.flag[1])
+					|| (instruction.condition == VC_JUMP_INPUT && vc.flag[2])
+					|| (instruction.condition == VC_JUMP_BITS && (vc.rA & (vc.rB == vc.rB)));
+
+		if(jump)
+		{
+			vc.iar = operand;
+			incIar = false;
+		}
+
+		if(instruction.condition == VC_JUMP_ALWAYS)
+		{
+			log[2] = operand;
+		}
+		else
+		{
+			log[2] = jump;
+			if(jump)
+				log[3] = operand;
+		}
+	}
+	else if(instruction.action == VC_ACTION_INPUT)
+	{
+		vc.ram[operand] = io.input(); // Read from the IH
+		log[2] = operand;
+		log[3] = vc.ram[operand];
+	}
+	else if(instruction.action == VC_ACTION_OUTPUT)
+	{
+		io.output(vc.rA, operand); // Send output
+		log[2] = vc.rA;
+		log[3] = operand;
+	}
+
+	if(instruction.alu > 0)
+		vc.aluOp = instruction.alu;
+	if(instruction.alu >= 0)
+		VC_alu(vc, vc.aluOp);
+
+	// Increment IAR
+	if(incIar)
+	{
+		vc.iar += 1;
+		if(vc.iar >= VC_RAM_SIZE)
+			vc.iar = 0;
+	}
+}
+
+// A table of every handler (a variable rather than a static in VC_dispatch, which constexpr functions can't have)
+template<typename State, typename IO, int... OPS>
+constexpr void (* VC_handlers[])(State &, IO &, int, int *) = {&VC_run<OPS, State, IO>...};
+
+// Call the handler for opCode from the table
+template<typename State, typename IO, int... OPS>
+constexpr void VC_dispatch(State & vc, IO & io, int opCode, int operand, int * log, std::integer_sequence<int, OPS...>)
+{
+	VC_handlers<State, IO, OPS...>[opCode](vc, io, operand, log);
+}
+
+// Execute one instruction
+	// io.input() is called to read a word for GIN and io.output(io_device, operand) is called to send a word for SOT
+	// log receives the four words stored for this instruction in the operation log (see VC_trace)
+template<typename State, typename IO>
+constexpr void VC_execute(State & vc, IO & io, int * log)
+{
+	// Get instruction
+	int word = vc.ram[vc.iar],
+		opCode = word >> 12,
+		operand = word % 4096;
+
+	log[0] = vc.iar;
+	log[1] = opCode;
+
+	VC_dispatch(vc, io, opCode, operand, log, std::make_integer_sequence<int, VC_OP_COUNT>());
+}
+
+
+// Timing model parameters (see VC_executeTimed)
+struct VC_Timing
+{
+	int waitStates, // Extra cycles for each RAM access (instruction fetches and operands)
+		ioLatency; // Extra cycles for each GIN and SOT
+};
+
+// Execute one instruction with op-code OP and return the cycles it took
+template<int OP, typename State, typename IO>
+constexpr int VC_runTimed(State & vc, IO & io, int operand, int * log, const VC_Timing & timing)
+{
+	constexpr VC_Instruction instruction = VC_ISA[OP];
+	constexpr int accesses = 1 + (instruction.operand == VC_OPERAND_READ || instruction.operand == VC_OPERAND_WRITE),
+				  ioAccess = instruction.action == VC_ACTION_INPUT || instruction.action == VC_ACTION_OUTPUT;
+
+	VC_run<OP>(vc, io, operand, log);
+	return instruction.cycles + accesses * timing.waitStates + ioAccess * timing.ioLatency;
+}
+
+template<typename State, typename IO, int... OPS>
+constexpr int (* VC_timedHandlers[])(State &, IO &, int, int *, const VC_Timing &) = {&VC_runTimed<OPS, State, IO>...};
+
+template<typename State, typename IO, int... OPS>
+constexpr int VC_dispatchTimed(State & vc, IO & io, int opCode, int operand, int * log, const VC_Timing & timing, std::integer_sequence<int, OPS...>)
+{
+	return VC_timedHandlers<State, IO, OPS...>[opCode](vc, io, operand, log, timing);
+}
+
+// Execute one instruction like VC_execute and return the number of clock cycles it took on the hardware
+	// The cycles of each instruction come from VC_ISA, plus the bus wait states for each RAM access and the I/O
+	// latency for GIN and SOT
+template<typename State, typename IO>
+constexpr int VC_executeTimed(State & vc, IO & io, int * log, const VC_Timing & timing)
+{
+	int word = vc.ram[vc.iar],
+		opCode = word >> 12,
+		operand = word % 4096;
+
+	log[0] = vc.iar;
+	log[1] = opCode;
+
+	return VC_dispatchTimed(vc, io, opCode, operand, log, timing, std::make_integer_sequence<int, VC_OP_COUNT>());
+}
+
+// Input and output for programs that don't read input (GIN reads 0 (zero) and SOT is ignored)
+struct VC_NoIO
+{
+	constexpr int input(void)
+	{
+		return 0;
+	}
+
+	constexpr void output(int, int)
+	{
+	}
+};
+
+// Run a ROM image (loaded from ram[0], the rest of RAM is zero) for a number of instructions with VC_NoIO
+	// Can be used in a constant expression, so the compiler runs the program and a test can static_assert on the
+	// result or a build can embed the final state, for example:
+	//     constexpr int rom[] = {...};
+	//     constexpr VC_State result = VC_evaluate(rom, 1000);
+	//     static_assert(result.ram[100] == 42, "...");
+	// Compilers limit how much they evaluate (GCC: -fconstexpr-loop-limit and -fconstexpr-ops-limit), so a large
+	// number of instructions may need a higher limit
+template<int N>
+constexpr VC_State VC_evaluate(const int (& rom)[N], long long steps)
+{
+	static_assert(N <= VC_RAM_SIZE, "The ROM image is larger than RAM");
+
+	VC_State vc = {};
+	for(int i = 0; i < N; i++)
+		vc.ram[i] = rom[i];
+
+	VC_NoIO io;
+	int log[4] = {};
+	for(long long i = 0; i < steps; i++)
+		VC_execute(vc, io, log);
+	return vc;
+}
+
+// Compile-time check that the interpreter runs in a constant expression
+	// LDA 4000, ADD 100, STR 200, LAA 200, SBD 4095, STR 201, LDA 5, SSD 0, STR 202, JMP 9
+constexpr int VC_CHECK_ROM[] = {4000, 0x2064, 0x60C8, 0x10C8, 0x3FFF, 0x60C9, 5, 0x8000, 0x60CA, 0x9009};
+constexpr VC_State VC_CHECK_STATE = VC_evaluate(VC_CHECK_ROM, 12);
+static_assert(VC_CHECK_STATE.ram[200] == 4100 && VC_CHECK_STATE.ram[201] == 5 && VC_CHECK_STATE.ram[202] == 10
+			  && VC_CHECK_STATE.iar == 9 && VC_CHECK_STATE.flag[1], "VC_evaluate must match the instruction set");
+
+#endif
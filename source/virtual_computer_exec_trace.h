@@ -0,0 +1,328 @@
+#ifndef VIRTUAL_COMPUTER_EXEC_TRACE_H
+#define VIRTUAL_COMPUTER_EXEC_TRACE_H
+
+// Execution trace files and the index used to query them
+// Shared by the virtual computer (source/virtual_computer_source.cpp), which writes traces with -exectrace, and the
+// trace query tool (programs/trace_query), which indexes and queries them
+// A trace file is a VC_ExecHeader (the state before the first instruction) followed by a VC_ExecRecord for every
+// instruction executed and for every word of RAM written by a device or the debugger, in the order they happened.
+// Every record holds the registers after it, so the records sorted by VC_execKey are also register checkpoints.
+// The index file (the name of the trace file followed by ".idx") lists the records that wrote each address and the
+// records of the instructions executed at each address. Queries are binary searches of those lists (or of the
+// records), so they read a few dozen records whatever the size of the trace.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "virtual_computer_core.h"
+
+// Declare constants
+
+	// Execution trace constants
+	const char VC_EXEC_MAGIC[4] = {'V', 'C', 'X', 'T'},
+			   VC_EXEC_INDEX_MAGIC[4] = {'V', 'C', 'X', 'I'};
+	const uint32_t VC_EXEC_VERSION = 1;
+	const uint64_t VC_EXEC_UNKNOWN = ~0ull; // Record count of a trace that wasn't closed (the size of the file is used)
+	const uint16_t VC_EXEC_NO_ADDRESS = 65535;
+	const int VC_EXEC_BLOCK = 65536, // Records read at a time while indexing
+			  VC_EXEC_LIST_BUFFER = 256; // Index entries kept for each list before they are written while indexing
+
+	// Record types
+	const int VC_EXEC_INSTRUCTION = 0,
+			  VC_EXEC_DEVICE = 1, // A word written by a device (block memory engine, event records, bank switches)
+			  VC_EXEC_EDIT = 2; // A change made by the debugger, GDB or a network message (made before the instruction)
+
+// Declare types
+
+	// Start of a trace file
+	struct VC_ExecHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t records; // Written when the trace is closed
+		uint16_t iar, // Registers before the first instruction (flags holds flag[n] in bit n)
+				 rA,
+				 rB,
+				 rC,
+				 aluOp,
+				 flags,
+				 reserved[2];
+		uint16_t ram[VC_RAM_SIZE]; // RAM before the first instruction
+	};
+
+	struct VC_ExecRecord
+	{
+		int64_t count; // Instruction count (edits are made before the instruction with this count)
+		uint16_t type, // VC_EXEC_INSTRUCTION, VC_EXEC_DEVICE or VC_EXEC_EDIT
+				 at, // Address of the instruction (device writes: the SOT instruction that made them, edits: the next instruction)
+				 word, // The instruction
+				 address, // Address of the word of RAM written (VC_EXEC_NO_ADDRESS if none)
+				 value, // The value written
+				 iar, // Registers after the record
+				 rA,
+				 rB,
+				 rC,
+				 aluOp,
+				 flags,
+				 reserved;
+	};
+
+	// Start of an index file
+		// List l holds the numbers of the records that wrote ram[l] for l < VC_RAM_SIZE, and the numbers of the
+		// instructions executed at address l - VC_RAM_SIZE after that. It is entries start[l] to start[l + 1] - 1.
+	struct VC_ExecIndexHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t records; // Records in the trace when it was indexed
+		uint64_t start[2 * VC_RAM_SIZE + 1];
+	};
+
+	// An open trace and index
+	struct VC_ExecTrace
+	{
+		std::ifstream file,
+					  index;
+		VC_ExecHeader header;
+		uint64_t records;
+		std::vector<uint64_t> start; // VC_ExecIndexHeader::start
+	};
+
+	static_assert(sizeof(VC_ExecHeader) == 32 + 2 * VC_RAM_SIZE && sizeof(VC_ExecRecord) == 32, "Trace files have a fixed layout");
+
+// Records are sorted by their key, edits come before the instruction with the same count
+inline int64_t VC_execKey(const VC_ExecRecord & record)
+{
+	return record.count * 2 + (record.type != VC_EXEC_EDIT);
+}
+
+// Keys of the records made before the instruction with this count are less than this
+inline int64_t VC_execBefore(long long count)
+{
+	return count * 2 + 1;
+}
+
+inline VC_ExecRecord VC_readExecRecord(std::istream & file, uint64_t number)
+{
+	VC_ExecRecord record = {};
+	file.clear();
+	file.seekg(sizeof(VC_ExecHeader) + number * sizeof(VC_ExecRecord));
+	file.read((char *)&record, sizeof(record));
+	return record;
+}
+
+// Find the first of records first to last - 1 with a key of at least limit (last if there are none)
+inline uint64_t VC_searchExecRecords(std::istream & file, uint64_t first, uint64_t last, int64_t limit)
+{
+	while(first < last)
+	{
+		uint64_t middle = first + (last - first) / 2;
+		if(VC_execKey(VC_readExecRecord(file, middle)) < limit)
+			first = middle + 1;
+		else
+			last = middle;
+	}
+	return first;
+}
+
+// Read the header of a trace file and count its records
+inline bool VC_readExecHeader(std::ifstream & file, VC_ExecHeader & header, uint64_t & records)
+{
+	if(!file.read((char *)&header, sizeof(header)) || std::memcmp(header.magic, VC_EXEC_MAGIC, 4) != 0 || header.version != VC_EXEC_VERSION)
+		return false;
+
+	records = header.records;
+	if(records == VC_EXEC_UNKNOWN)
+	{
+		file.seekg(0, std::ios::end);
+		records = ((uint64_t)file.tellg() - sizeof(VC_ExecHeader)) / sizeof(VC_ExecRecord);
+	}
+	return true;
+}
+
+// Build the index file of a trace file
+	// The records are read twice: once to count the entries of each list, then to write them (each list has a
+	// small buffer, so the index is written in blocks however large it is)
+inline bool VC_indexExecTrace(const std::string & path)
+{
+	std::ifstream file(path, std::ios::binary);
+	VC_ExecHeader header;
+	uint64_t records;
+	if(!file.is_open() || !VC_readExecHeader(file, header, records))
+		return false;
+
+	std::ofstream index(path + ".idx", std::ios::binary | std::ios::trunc);
+	if(!index.is_open())
+		return false;
+
+	const int LISTS = 2 * VC_RAM_SIZE;
+	VC_ExecIndexHeader indexHeader = {};
+	std::vector<VC_ExecRecord> block(VC_EXEC_BLOCK);
+
+	for(int pass = 0; pass < 2; pass++)
+	{
+		std::vector<uint64_t> next(indexHeader.start, indexHeader.start + LISTS); // Entry that each list writes next
+		std::vector<std::vector<uint64_t>> buffers(LISTS);
+
+		file.clear();
+		file.seekg(sizeof(VC_ExecHeader));
+		for(uint64_t first = 0; first < records; first += VC_EXEC_BLOCK)
+		{
+			uint64_t count = std::min((uint64_t)VC_EXEC_BLOCK, records - first);
+			file.read((char *)block.data(), count * sizeof(VC_ExecRecord));
+
+			for(uint64_t i = 0; i < count; i++)
+			{
+				int lists[2] = {block[i].address < VC_RAM_SIZE ? (int)block[i].address : -1,
+								block[i].type == VC_EXEC_INSTRUCTION ? VC_RAM_SIZE + block[i].at % VC_RAM_SIZE : -1};
+				for(int l : lists)
+				{
+					if(l < 0)
+						continue;
+					if(pass == 0)
+					{
+						indexHeader.start[l + 1] += 1;
+						continue;
+					}
+
+					buffers[l].push_back(first + i);
+					if(buffers[l].size() == (size_t)VC_EXEC_LIST_BUFFER)
+					{
+						index.seekp(sizeof(VC_ExecIndexHeader) + next[l] * sizeof(uint64_t));
+						index.write((const char *)buffers[l].data(), buffers[l].size() * sizeof(uint64_t));
+						next[l] += buffers[l].size();
+						buffers[l].clear();
+					}
+				}
+			}
+		}
+
+		if(pass == 0)
+		{
+			for(int l = 0; l < LISTS; l++)
+				indexHeader.start[l + 1] += indexHeader.start[l];
+			continue;
+		}
+
+		for(int l = 0; l < LISTS; l++)
+		{
+			index.seekp(sizeof(VC_ExecIndexHeader) + next[l] * sizeof(uint64_t));
+			index.write((const char *)buffers[l].data(), buffers[l].size() * sizeof(uint64_t));
+		}
+	}
+
+	// The header is written last, so an index that wasn't finished is built again
+	std::memcpy(indexHeader.magic, VC_EXEC_INDEX_MAGIC, 4);
+	indexHeader.version = VC_EXEC_VERSION;
+	indexHeader.records = records;
+	index.seekp(0);
+	index.write((const char *)&indexHeader, sizeof(indexHeader));
+	return (bool)file && (bool)index;
+}
+
+// Open a trace file and its index (the index is built if it is missing or was made from a shorter trace)
+inline bool VC_loadExecTrace(VC_ExecTrace & trace, const std::string & path)
+{
+	trace.file.open(path, std::ios::binary);
+	if(!trace.file.is_open() || !VC_readExecHeader(trace.file, trace.header, trace.records))
+		return false;
+
+	VC_ExecIndexHeader indexHeader;
+	for(int attempt = 0; attempt < 2; attempt++)
+	{
+		trace.index.close();
+		trace.index.clear();
+		trace.index.open(path + ".idx", std::ios::binary);
+		if(trace.index.read((char *)&indexHeader, sizeof(indexHeader)) && std::memcmp(indexHeader.magic, VC_EXEC_INDEX_MAGIC, 4) == 0
+		   && indexHeader.version == VC_EXEC_VERSION && indexHeader.records == trace.records)
+		{
+			trace.start.assign(indexHeader.start, indexHeader.start + 2 * VC_RAM_SIZE + 1);
+			return true;
+		}
+		if(attempt == 0 && !VC_indexExecTrace(path))
+			return false;
+	}
+	return false;
+}
+
+// Read entry n of the index (a record number)
+inline uint64_t VC_readExecEntry(VC_ExecTrace & trace, uint64_t n)
+{
+	uint64_t number = 0;
+	trace.index.clear();
+	trace.index.seekg(sizeof(VC_ExecIndexHeader) + n * sizeof(uint64_t));
+	trace.index.read((char *)&number, sizeof(number));
+	return number;
+}
+
+// Find the first entry of a list that refers to a record with a key of at least limit
+inline uint64_t VC_searchExecList(VC_ExecTrace & trace, int list, int64_t limit)
+{
+	uint64_t first = trace.start[list],
+			 last = trace.start[list + 1];
+	while(first < last)
+	{
+		uint64_t middle = first + (last - first) / 2;
+		if(VC_execKey(VC_readExecRecord(trace.file, VC_readExecEntry(trace, middle))) < limit)
+			first = middle + 1;
+		else
+			last = middle;
+	}
+	return first;
+}
+
+// Find the last record that wrote ram[address] before the instruction with this count
+	// Returns the record number, or -1 if there is none
+inline long long VC_findLastWrite(VC_ExecTrace & trace, int address, long long count)
+{
+	uint64_t entry = VC_searchExecList(trace, address, VC_execBefore(count));
+	if(entry == trace.start[address])
+		return -1;
+	return (long long)VC_readExecEntry(trace, entry - 1);
+}
+
+// Find the instructions executed at an address with counts from from to to - 1 (returns their record numbers)
+inline std::vector<uint64_t> VC_findVisits(VC_ExecTrace & trace, int address, long long from, long long to)
+{
+	std::vector<uint64_t> visits;
+	int list = VC_RAM_SIZE + address;
+	for(uint64_t entry = VC_searchExecList(trace, list, VC_execBefore(from)); entry < trace.start[list + 1]; entry++)
+	{
+		uint64_t number = VC_readExecEntry(trace, entry);
+		if(VC_readExecRecord(trace.file, number).count >= to)
+			break;
+		visits.push_back(number);
+	}
+	return visits;
+}
+
+// Find the value of ram[address] before the instruction with this count
+inline int VC_findValue(VC_ExecTrace & trace, int address, long long count)
+{
+	long long number = VC_findLastWrite(trace, address, count);
+	if(number < 0)
+		return trace.header.ram[address];
+	return VC_readExecRecord(trace.file, number).value;
+}
+
+// Find the registers before the instruction with this count (in the registers of the record that is returned)
+inline VC_ExecRecord VC_findRegisters(VC_ExecTrace & trace, long long count)
+{
+	uint64_t number = VC_searchExecRecords(trace.file, 0, trace.records, VC_execBefore(count));
+	if(number > 0)
+		return VC_readExecRecord(trace.file, number - 1);
+
+	VC_ExecRecord record = {};
+	record.iar = trace.header.iar;
+	record.rA = trace.header.rA;
+	record.rB = trace.header.rB;
+	record.rC = trace.header.rC;
+	record.aluOp = trace.header.aluOp;
+	record.flags = trace.header.flags;
+	return record;
+}
+
+#endif
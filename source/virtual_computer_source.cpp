@@ -1,7 +1,50 @@
+#ifdef _WIN32
+#include <winsock2.h> // Must be included before windows.h (included by freeglut)
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/un.h>
+#include <sys/select.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
 #include <GL/freeglut.h>
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <sstream>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <climits>
+#include <new>
+#include "virtual_computer_core.h"
+#include "virtual_computer_exec_trace.h"
+#include "virtual_computer_archive.h"
+
+#ifndef _WIN32
+typedef int SOCKET;
+const SOCKET INVALID_SOCKET = -1;
+#define closesocket close
+#else
+typedef int socklen_t; // Declared in ws2tcpip.h
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // Windows doesn't raise SIGPIPE
+#endif
 
 // Useful links for FreeGLUT and OpenGL:
 //    http://freeglut.sourceforge.net/docs/api.php
@@ -37,40 +80,340 @@
 			  WIN_KEYBOARD = 2,
 			  WIN_MOUSE = 3;
 
-	// Virtual Computer constants
-	const int VC_RAM_SIZE = 4096, // The size of ram (in 16 bit words)
-
-			  // Operation codes
-			  VC_OP_LDA = 0,
-			  VC_OP_LAA = 1,
-			  VC_OP_ADD = 2,
-			  VC_OP_SBD = 3,
-			  VC_OP_ADA = 4,
-			  VC_OP_SBA = 5,
-			  VC_OP_STR = 6,
-			  VC_OP_STD = 7,
-			  VC_OP_SSD = 8,
-			  VC_OP_JMP = 9,
-			  VC_OP_JIZ = 10,
-			  VC_OP_JIE = 11,
-			  VC_OP_JII = 12,
-			  VC_OP_JBT = 13,
-			  VC_OP_GIN = 14,
-			  VC_OP_SOT = 15,
-
-			  // ALU constants
-			  VC_ALU_ADD = 1,
-			  VC_ALU_SUB = 2,
-			  VC_ALU_OTHER = 3,
-
+	// Virtual Computer constants (the processor constants are declared in virtual_computer_core.h)
 			  // Constants for pheripherals
-			  VC_OH_SYS = 1,
-			  VC_OH_MBK = 2;
+	const int VC_OH_SYS = 1,
+			  VC_OH_MBK = 2,
+			  VC_OH_MTH = 4, // Math coprocessor (see VC_math)
+			  VC_OH_MEM = 5, // Block memory engine (see VC_blockOperation)
+			  VC_OH_INT = 6, // Interrupt controller (see VC_interruptControl)
+			  VC_OH_CON = 7, // Text console (see VC_consoleOutput)
+			  VC_OH_NET = 8, // Local socket (see VC_netControl)
+			  VC_OH_EVT = 9, // Input event records (see VC_eventControl)
+			  VC_OH_SND = 10, // PCM audio (see VC_audioControl)
+			  VC_MTH_RESULTS = 2, // Most words a math coprocessor operation sends to the input handler
+			  VC_CONSOLE_BUFFER_SIZE = 4096, // Characters stored before the console is written to
+			  VC_NET_CONNECTED = 256, // Status words sent by the local socket (data bytes are 0 to 255)
+			  VC_NET_CLOSED = 257, // The connection failed or was closed
+			  VC_NET_BATCH = 4096, // Most bytes read from the socket at once
+			  VC_EVENT_QUEUE_SIZE = 64, // Most event records waiting to be read (more are dropped)
+			  VC_AUDIO_RATE = 44100, // Audio samples per second of guest time
+			  VC_AUDIO_RING_SIZE = 1 << 17, // Samples waiting to be written (a power of two, more are dropped)
+			  VC_AUDIO_DRAIN_PERIOD = 100; // ms between writes to the audio file
+
+	// Input event record types (bits 8 to 11 of the first word of a record)
+	const int VC_EVENT_KEY_DOWN = 0,
+			  VC_EVENT_KEY_UP = 1,
+			  VC_EVENT_SPECIAL_DOWN = 2, // Function and arrow keys etc. (GLUT_KEY_* codes)
+			  VC_EVENT_SPECIAL_UP = 3,
+			  VC_EVENT_BUTTON_DOWN = 4,
+			  VC_EVENT_BUTTON_UP = 5,
+			  VC_EVENT_MOTION = 6, // The code is the mouse buttons held (bit n for button n)
+
+			  // Event records the guest can ask for (the others are always sent)
+			  VC_EVENT_SEND_KEY_UP = 1,
+			  VC_EVENT_SEND_SPECIAL = 2,
+			  VC_EVENT_SEND_MOTION = 4;
 
 				 // Directories
 	const char * VC_OP_LOG_DIR = "operation_log.txt",
 			   * VC_ROM_DIR = "data/bin_data/rom.dat",
-			   * VC_DRIVE_1_DIR = "data/bin_data/drive_1.dat";
+			   * VC_DRIVE_1_DIR = "data/bin_data/drive_1.dat",
+			   * VC_INPUT_LOG_DIR = "input_log.txt";
+
+	// Interrupt constants
+		// Interrupts are numbered by their bit in the enabled and pending masks (lower numbers are delivered first)
+	const int VC_INT_TIMER = 1,
+			  VC_INT_INPUT = 2, // A word from the keyboard or mouse was sent to the input handler
+			  VC_INT_DEVICE = 4, // The math coprocessor or block memory engine finished an operation
+			  VC_INT_COUNT = 3,
+			  VC_WAIT_POLL_PERIOD = 10, // ms between ticks while the virtual computer waits for an interrupt
+			  VC_LOOP_STATE_SIZE = 10; // Words compared by the idle loop detector (see VC_detectIdleLoop)
+
+	// Time travel constants
+	const long long VC_CHECKPOINT_PERIOD = 1 << 20; // Instructions executed between checkpoints
+	const int VC_KEYFRAME_PERIOD = 64; // Every 64th checkpoint stores all of RAM and the IH cache (the others only store changed words)
+	const int VC_RUN_AHEAD_LIMIT = 1 << 18; // Most cycles run ahead to reach the frames shown by run-ahead mode
+
+	// Debugger constants
+		// Registers are numbered the way they are sent to GDB
+		// The flags register holds the zero, extra and input flags in bits 0, 1 and 2
+	const int VC_REG_IAR = 0,
+			  VC_REG_RA = 1,
+			  VC_REG_RB = 2,
+			  VC_REG_RC = 3,
+			  VC_REG_ALU_OP = 4,
+			  VC_REG_FLAGS = 5,
+			  VC_REG_COUNT = 6;
+
+	const char * VC_REG_NAMES[VC_REG_COUNT] = {"iar", "rA", "rB", "rC", "aluOp", "flags"};
+
+	const unsigned long VC_GDB_BANKS = 0x10000, // GDB address of extended memory
+						VC_GDB_PACKET_SIZE = 0x4000; // Largest packet sent or received (RAM reads are limited to half of it)
+
+	// Metrics constants
+	const int VC_METRIC_DEVICES = 16, // Output calls to devices 16 and above are counted together
+			  VC_HISTOGRAM_BUCKETS = 10;
+
+	// Shared memory constants
+	const uint32_t VC_SHARED_MAGIC = 0x4D534356, // "VCSM" (little endian)
+				   VC_SHARED_VERSION = 3;
+
+	// Timeline trace constants
+	const int VC_TRACE_MAX_EVENTS = 1 << 22; // Events stored per thread between writes (more are dropped)
+
+	// Multi-core constants
+	const int VC_MAX_CORES = 16,
+			  VC_CORE_REPLIES = 8, // Words each core can hold in its SYS reply stack
+			  VC_CORE_BATCH = 1024; // Instructions a core thread executes between checks for shutdown
+
+	// Bank switching constants
+		// RAM from VC_BANK_START to the end is a window into the selected bank of extended memory
+	const int VC_BANK_START = 2048,
+			  VC_BANK_SIZE = VC_RAM_SIZE - VC_BANK_START,
+			  VC_BANK_COUNT = 4096, // 4096 banks of 2048 words (8 megawords)
+			  VC_EDIT_BANKS = 2 * VC_RAM_SIZE; // Edit targets from here on are words of extended memory (see VC_applyEdit)
+
+	// RAM page constants
+		// Everything that writes RAM or the IH cache marks the pages it wrote, so checkpoints only compare those pages
+		// Pages aren't shared copy-on-write between instances. RAM is one 16 KB block of int words converted from the
+		// 16 bit big endian ROM file, so it can't be mapped from the file, and sharing would save at most 16 KB per
+		// instance
+	const int VC_PAGE_SIZE = 256,
+			  VC_PAGE_COUNT = VC_RAM_SIZE / VC_PAGE_SIZE; // One bit of VC_dirtyPages for each page
+	static_assert(VC_PAGE_COUNT <= 32, "Dirty page masks are 32 bits");
+
+	const double VC_HISTOGRAM_BOUNDS[VC_HISTOGRAM_BUCKETS] = {0.00001, 0.0001, 0.0005, 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1}; // Upper bounds in seconds
+
+		// Register layout sent to GDB (GDB addresses bytes, so iar and RAM addresses are doubled for GDB)
+	const char * VC_GDB_TARGET_XML = "<?xml version=\"1.0\"?><!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+									 "<target version=\"1.0\"><feature name=\"org.virtual-computer.core\">"
+									 "<reg name=\"iar\" bitsize=\"16\" type=\"code_ptr\"/>"
+									 "<reg name=\"rA\" bitsize=\"16\" type=\"uint16\"/>"
+									 "<reg name=\"rB\" bitsize=\"16\" type=\"uint16\"/>"
+									 "<reg name=\"rC\" bitsize=\"16\" type=\"uint16\"/>"
+									 "<reg name=\"aluOp\" bitsize=\"16\" type=\"uint16\"/>"
+									 "<reg name=\"flags\" bitsize=\"16\" type=\"uint16\"/>"
+									 "</feature></target>";
+
+// Declare types
+
+	// A word sent to the input handler by the keyboard or mouse
+	struct VC_InputEvent
+	{
+		long long count; // Number of instructions executed when the word arrived
+		int word, // For event records, the device << 12 | type << 8 | code (see VC_eventControl)
+			x, // Position of the mouse for event records
+			y;
+		bool record; // An event record for the event queue instead of a word for the input handler
+	};
+
+	// Input event record device state (saved in checkpoints with the event queue)
+	struct VC_EventDevice
+	{
+		int records, // 1 sends keyboard and mouse input as event records instead of words
+			send, // Event records the guest asked for (VC_EVENT_SEND_*)
+			address, // Where SOT operation 1 stores the next event record
+			cache;
+		bool cacheStored;
+	};
+
+	// Interrupt controller state
+	struct VC_Interrupts
+	{
+		int enabled, // Interrupts that run their handler
+			pending,
+			vectors, // Address of the vector table (the handler address for each interrupt in order)
+			interval, // Cycles between timer interrupts (0 stops the timer)
+			timer, // Cycles since the last timer interrupt
+			saved[VC_REG_COUNT]; // Registers when the handler started (restored when it returns)
+
+		bool handling,
+			 waiting, // Waiting for an interrupt (SYS operation 8)
+			 idle; // Waiting because an idle loop was detected (ends when an interrupt is raised, even if one is already pending)
+	};
+
+	// Local socket device state (saved in checkpoints, the socket itself is not)
+	struct VC_NetDevice
+	{
+		int cache, // Operation waiting for its arguments
+			args[2],
+			argCount,
+			buffer, // Address of the receive buffer in RAM (-1 sends received bytes to the input handler)
+			bufferLength;
+		bool cacheStored;
+	};
+
+	// PCM audio device state (saved in checkpoints, the synthesizer and the audio file are not)
+	struct VC_AudioDevice
+	{
+		int frequency, // Square wave frequency in Hz (0 is silent)
+			duty, // Part of each period the square wave is high (in 256ths)
+			volume, // 0 to 255
+			sample, // Level of the last raw sample (0 to 4095, 2048 is silent)
+			raw, // 1 plays raw samples instead of the square wave
+			cache;
+		bool cacheStored;
+	};
+
+	// Idle loop detector state
+	struct VC_LoopDetector
+	{
+		int state[VC_LOOP_STATE_SIZE]; // State after the last backward jump
+		bool changed; // RAM changed or output was sent since the last backward jump
+	};
+
+	// The state of the virtual computer after a number of instructions
+	struct VC_Checkpoint
+	{
+		long long count;
+		int iar,
+			rA,
+			rB,
+			rC,
+			aluOp,
+			IH_cache_stored,
+			IH_cache_pos,
+			OH_SYS_cache,
+			OH_SYS_args[2],
+			OH_SYS_argCount,
+			OH_MBK_cache,
+			OH_MTH_cache,
+			OH_MEM_cache,
+			OH_MEM_args[3],
+			OH_MEM_argCount,
+			OH_INT_cache,
+			clockSpeed;
+
+		bool flag[3],
+			 OH_SYS_cache_stored,
+			 OH_MBK_cache_stored,
+			 OH_MTH_cache_stored,
+			 OH_MEM_cache_stored,
+			 OH_INT_cache_stored,
+			 keyframe;
+
+		// Keyframes store every word, other checkpoints store (index, value) pairs for the words that changed
+		// since the previous checkpoint
+		std::vector<int> ram,
+						 IH_cache;
+
+		// Selected bank and extended memory
+			// banks holds the bank number followed by VC_BANK_SIZE words for every bank stored (keyframes store every
+			// bank in use, other checkpoints store the banks written to since the previous checkpoint)
+		int bank;
+		std::vector<int> banks;
+
+		VC_Interrupts interrupts;
+		VC_LoopDetector loop;
+		VC_NetDevice net;
+		VC_EventDevice events;
+		VC_AudioDevice audio;
+		std::deque<VC_InputEvent> eventQueue;
+
+		long long cycles,
+				  cycleLatch;
+	};
+
+	// One core of a multi-core virtual computer (see the memory model above VC_cores)
+		// The registers have the same names as in VC_State so that VC_execute can run a core
+	struct VC_Core
+	{
+		std::atomic<int> * ram; // Shared by every core
+		int iar,
+			rA,
+			rB,
+			rC,
+			aluOp,
+			id,
+			log[4], // Operation log entry for the last instruction (not written to operation_log.txt)
+
+			// SYS device state for this core (SYS replies are only visible to the core that asked)
+			replies[VC_CORE_REPLIES],
+			replyCount,
+			sysCache,
+			sysArgs[2],
+			sysArgCount,
+			mthCache; // Math coprocessor operation waiting for its address
+
+		bool flag[3],
+			 sysCacheStored,
+			 mthCacheStored;
+
+		std::atomic<long long> instructions, // Instructions executed by this core
+							   opCounts[16]; // Instructions executed per op-code (added to the metrics)
+	};
+
+	// A latency histogram (written in the Prometheus text format)
+	struct VC_Histogram
+	{
+		long long buckets[VC_HISTOGRAM_BUCKETS + 1], // Observations per bucket (the last bucket is +Inf)
+				  count;
+		double sum;
+	};
+
+	// The shared memory block (RAM, registers and status that external monitors can map, see VC_openSharedMemory)
+		// The virtual computer always keeps its RAM and registers in this block, so sharing it copies nothing
+		// Readers copy what they need between two reads of sequence, and copy again if it was odd or changed
+		// Processes that write RAM or registers increment doorbell afterwards (see VC_openSharedMemory)
+	struct VC_SharedBlock
+	{
+		uint32_t magic, // VC_SHARED_MAGIC
+				 version, // VC_SHARED_VERSION
+				 size; // sizeof(VC_SharedBlock)
+		std::atomic<uint32_t> sequence, // Odd while VC_main is changing RAM, registers or the status
+							  doorbell; // Changes made by other processes since VC_step last checked (0 if none)
+
+		// Status (updated whenever sequence becomes even)
+		int64_t instructionCount,
+				cycleCount;
+		int32_t clockSpeed,
+				ips, // Instructions executed in the last title refresh period
+				bank, // Selected bank of extended memory
+				paused, // 1 while the debugger has paused the virtual computer
+				waiting, // 1 while waiting for an interrupt
+				running; // 0 (zero) after the program closes
+
+		VC_State state; // RAM and registers (VC_State in virtual_computer_core.h)
+	};
+
+	// Pages allocated for the shared memory block (a multiple of the Windows allocation granularity)
+	const size_t VC_SHARED_SIZE = (sizeof(VC_SharedBlock) + 65535) / 65536 * 65536;
+
+	// Increments the sequence number of the shared memory block for as long as it exists (when the block is shared)
+		// The status is written before the sequence number becomes even again
+	struct VC_SharedWrite
+	{
+		VC_SharedWrite();
+		~VC_SharedWrite();
+	};
+
+	// A timeline trace event (a Chrome trace-event "complete" event)
+	struct VC_TraceEvent
+	{
+		const char * name; // A string literal
+		double start, // Microseconds since tracing started
+			   duration;
+	};
+
+	// Trace events recorded by one thread
+		// The mutex is only contended while the events are being written to the trace file
+	struct VC_TraceBuffer
+	{
+		std::mutex mutex;
+		std::vector<VC_TraceEvent> events;
+		const char * threadName;
+		int threadId;
+		long long dropped;
+	};
+
+	// A change made to RAM or a register by the debugger
+	struct VC_EditEvent
+	{
+		long long count; // Number of instructions executed when the change was made
+		int target, // Address in RAM, or VC_RAM_SIZE + the register number
+			value;
+	};
 
 // Declare variables
 
@@ -80,37 +423,232 @@
 
 	int windowId, // Id of the main window
 		iarAtLastRefresh = 0,
-		ips = 0; // Store the number of instructions executed in the last second (instructions per second)
+		ips = 0, // Store the number of instructions executed in the last second (instructions per second)
+		WIN_mouseButtons = 0; // Mouse buttons held (bit n for button n)
 
 	// Virtual Computer variables
 		// All VC variables are set to 0 (zero) by default
-	int ram[VC_RAM_SIZE] = {0},
-		iar = 0,
-		rA = 0,
-		rB = 0,
-		rC = 0,
-		aluOp = 0,
+	VC_SharedBlock * VC_allocateSharedBlock(void);
+	VC_SharedBlock & VC_shared = *VC_allocateSharedBlock();
+	VC_State & vc = VC_shared.state; // RAM and registers
 
-		// Clock speed
-		clockSpeed = 1001, // Instructions executed per second (frequency of the clock in hertz)
-						   // If clockSpeed > 1000, there is no delay between the execution of instructions
+	std::atomic<int> clockSpeed(1001); // Instructions executed per second (frequency of the clock in hertz)
+									   // If clockSpeed > 1000, there is no delay between the execution of instructions
+									   // Atomic because every core of a multi-core virtual computer reads it and SYS 1 sets it
 
 		// Temporarily store input sent to from certain output devices
-		VC_IH_cache[VC_RAM_SIZE] = {0}, // words with even indices are the origin device and words with odd indices are the input data
+	int VC_IH_cache[VC_RAM_SIZE] = {0}, // words with even indices are the origin device and words with odd indices are the input data
 		VC_IH_cache_stored = 0,
 		VC_IH_cache_pos = 0,
 
 		// Temporarily store output sent to certain output devices
 		VC_OH_SYS_cache = 0,
+		VC_OH_SYS_args[2] = {0}, // Words stored for SYS operations that take more than two words
+		VC_OH_SYS_argCount = 0,
 		VC_OH_MBK_cache = 0,
+		VC_OH_MTH_cache = 0,
+		VC_OH_MEM_cache = 0,
+		VC_OH_MEM_args[3] = {0}, // Source, destination and length for the block memory engine
+		VC_OH_MEM_argCount = 0,
+		VC_OH_INT_cache = 0,
 
 		opLog[VC_RAM_SIZE][4] = {0},
+		opBank[VC_RAM_SIZE] = {0}, // Selected bank for each instruction in the operation log
 		opCount = 0;
 
-	bool flag[3] = {false},
-		 opOverflow = false,
+	bool opOverflow = false,
 		 VC_OH_SYS_cache_stored = false,
-		 VC_OH_MBK_cache_stored = false;
+		 VC_OH_MBK_cache_stored = false,
+		 VC_OH_MTH_cache_stored = false,
+		 VC_OH_MEM_cache_stored = false,
+		 VC_OH_INT_cache_stored = false;
+
+	// Interrupt controller variables
+		// Idle cycles spent waiting for an interrupt are counted by VC_instructionCount like instructions, so input
+		// events and timer interrupts happen at the same count when the history is replayed
+	VC_Interrupts VC_interrupts = {};
+
+	// Timing model variables (-timing, -waitstates <n> and -iolatency <n>)
+		// With the timing model, instructions take the number of cycles given by VC_executeTimed and clockSpeed is
+		// in cycles per second. Without it, every instruction takes one cycle (VC_cycleCount isn't used).
+	bool VC_timingEnabled = false;
+	VC_Timing VC_timing = {0, 0};
+	long long VC_cycleCount = 0, // Cycles since startup (idle cycles spent waiting for an interrupt are one cycle each)
+			  VC_cycleLatch = 0, // Cycle count read by SYS operation 9 (SYS operation 10 sends its high word)
+			  VC_cyclesAtRefresh = 0;
+	int VC_lastCycles = 1; // Cycles taken by the last instruction (VC_main waits this long before the next one)
+
+	// Idle loop detection variables (turned off with -noidle)
+	VC_LoopDetector VC_loop = {};
+	bool VC_idleDetection = true;
+
+	// Bank switching variables
+		// The selected bank lives in RAM (so LAA, STR etc. never translate addresses) and is copied to and from
+		// VC_banks when another bank is selected
+	int VC_bank = 0;
+	std::vector<std::vector<int> > VC_banks(VC_BANK_COUNT); // Banks that haven't been used are empty (all words are 0)
+	std::vector<int> VC_dirtyBanks; // Banks written to since the last checkpoint
+	std::vector<bool> VC_bankDirty(VC_BANK_COUNT, false);
+
+	// Time travel variables
+	long long VC_instructionCount = 0, // Number of instructions executed since startup
+			  VC_historyEnd = 0; // Highest instruction count reached (everything before it can be replayed)
+
+	std::vector<VC_InputEvent> VC_inputEvents; // Every word sent by the keyboard and mouse, in order
+	size_t VC_nextEvent = 0; // Index of the next event to send to the input handler
+	std::vector<VC_Checkpoint> VC_checkpoints; // One checkpoint every VC_CHECKPOINT_PERIOD instructions
+
+	int VC_checkpointRam[VC_RAM_SIZE] = {0}, // RAM and the IH cache at the last checkpoint (used to find changed words)
+		VC_checkpointIHCache[VC_RAM_SIZE] = {0};
+	uint32_t VC_dirtyPages = ~0u, // Pages of RAM written since the last checkpoint (every page is compared when all bits are set)
+			 VC_dirtyIHPages = ~0u; // Pages of the IH cache written since the last checkpoint
+
+	// Debugger variables
+		// The bitmaps are only checked by VC_debugStep, which replaces VC_step while any bit is set
+	uint64_t VC_breakpointBits[VC_RAM_SIZE / 64] = {0}, // Pause before executing the instruction at these addresses
+			 VC_watchReadBits[VC_RAM_SIZE / 64] = {0}, // Pause after an instruction reads from these addresses
+			 VC_watchWriteBits[VC_RAM_SIZE / 64] = {0}; // Pause after an instruction writes to these addresses
+
+	int VC_debugBitCount = 0; // Number of bits set in the bitmaps
+
+	std::vector<VC_EditEvent> VC_edits; // Every change made by the debugger, in order (replayed like input events)
+	size_t VC_nextEdit = 0; // Index of the next edit to apply
+
+	bool VC_paused = false,
+		 VC_ignoreBreakpoint = false; // Execute the instruction at a breakpoint once when resuming from it
+
+	// Debug console and GDB packets (read on separate threads and run by VC_main)
+	std::deque<std::string> VC_consoleCommands,
+							VC_gdbPackets;
+	std::mutex VC_consoleMutex;
+	std::atomic<bool> VC_commandsPending(false); // Checked by VC_main so the mutex is only locked when there is work
+
+	// Text console variables
+		// Characters are written to the console file (stdout unless -console <file> is given) in batches
+	std::string VC_consoleBuffer;
+	FILE * VC_consoleFile = stdout;
+	bool VC_stdinToConsole = false; // -stdin sends lines read from stdin to the guest instead of the debug console
+
+	// Input event record variables
+		// Records are read oldest first (unlike the input handler), and mouse motion records that haven't been read
+		// are replaced by newer ones
+	VC_EventDevice VC_events = {0, 0, 0, 0, false};
+	std::deque<VC_InputEvent> VC_eventQueue;
+
+	// Local socket variables
+		// The guest only adds requests and bytes to these, every socket call is made on the host I/O thread
+		// (VC_netThread), so SOT never blocks
+	VC_NetDevice VC_net = {0, {0, 0}, 0, -1, 0, false};
+	std::mutex VC_netMutex;
+	int VC_netRequest = 0, // Operation for VC_netThread (0 for none, 1 to connect to VC_netPort, 2 to connect to VC_netPath, 3 to close)
+		VC_netPort = 0;
+	std::string VC_netPath,
+				VC_netSendBuffer; // Bytes waiting to be sent (written in one call by VC_netThread)
+	std::deque<int> VC_netReceived; // Bytes and status words waiting to be delivered by VC_main
+	std::atomic<bool> VC_netPending(false); // Checked by VC_main so the mutex is only locked when there is data
+	bool VC_netStarted = false;
+
+	// PCM audio variables
+		// Samples are made on the GLUT thread for the instructions executed since the last time (see
+		// VC_synthesizeAudio) and written to the audio file (-audio <file>) in blocks by VC_audioThread, so the
+		// virtual computer never waits for the file. Without an audio file the device only keeps its state.
+	VC_AudioDevice VC_audio = {0, 128, 255, 2048, 0, 0, false};
+	FILE * VC_audioFile = NULL;
+	long long VC_audioCount = 0, // Instruction count (cycle count with the timing model) that samples have been made up to (never goes back)
+			  VC_audioRemainder = 0, // Part of a sample left over from the last call (in VC_AUDIO_RATE / clockSpeed)
+			  VC_audioDrops = 0; // Samples dropped because the ring buffer was full
+	uint32_t VC_audioPhase = 0; // Position in the square wave period (a full period is 2^32)
+
+	// Single producer (GLUT thread), single consumer (VC_audioThread) ring buffer
+		// The indices only increase, index % VC_AUDIO_RING_SIZE is the position in the ring
+	int16_t VC_audioRing[VC_AUDIO_RING_SIZE];
+	std::atomic<uint64_t> VC_audioWrite(0),
+						  VC_audioRead(0);
+	std::atomic<bool> VC_audioStopped(false);
+	std::thread VC_audioWriter;
+
+	// Metrics variables (written to the file given with -metrics once per title refresh)
+		// Timings are only measured when a metrics file is given
+	std::string VC_metricsPath;
+	bool VC_metricsEnabled = false;
+
+	long long VC_metricOpCounts[16] = {0}, // Instructions executed per op-code
+			  VC_metricInputWords = 0, // Words written to the IH
+			  VC_metricInputDrops = 0, // Words overwritten in the IH cache before being read
+			  VC_metricOutputCalls[VC_METRIC_DEVICES] = {0}; // SOT instructions per output device
+
+	double VC_IH_cacheTime[VC_RAM_SIZE] = {0}, // Time each word in the IH cache was written
+		   VC_lastTick = 0; // Time VC_main was last called
+
+	int VC_lastIps = 0, // Instructions executed in the last title refresh period
+		VC_lastDelay = 0; // Milliseconds VC_main last set the GLUT timer to
+
+	VC_Histogram VC_frameTime = {}, // Time taken by WIN_display
+				 VC_timerJitter = {}, // Difference between the actual and expected time between VC_main calls
+				 VC_inputLatency = {}; // Time between a word being written to the IH and a GIN instruction reading it
+
+	// Shared memory variables (-shm <name>)
+	bool VC_sharing = false;
+	std::string VC_sharedName;
+#ifdef _WIN32
+	HANDLE VC_sharedMapping = NULL;
+#endif
+
+	// Run-ahead variables (-runahead <frames>, see VC_runAhead)
+	int VC_runAheadFrames = 0, // Frames to run ahead (0 is off)
+		VC_runAheadBlits = 0; // Frames blitted while running ahead
+	bool VC_runningAhead = false,
+		 VC_runAheadDue = true; // A frame was blitted or input arrived since the last run-ahead
+	GLubyte VC_runAheadPixels[PIXEL_COUNT_X][PIXEL_COUNT_Y][4] = {0}; // The screen shown in run-ahead mode
+	std::vector<std::pair<int, std::vector<int>>> VC_runAheadBanks; // Banks as they were before running ahead changed them
+
+	// ROM archive variables (-archive <file>:<name>, see virtual_computer_archive.h)
+	const char * VC_archiveImage = NULL;
+
+	// Execution trace variables (-exectrace <file>, see virtual_computer_exec_trace.h)
+	const char * VC_execTracePath = NULL;
+	std::fstream VC_execTrace;
+	uint64_t VC_execRecords = 0; // Records in the trace (records after these were undone by an edit made in the past)
+	int VC_execAt = 0, // Address and word of the instruction being executed (for the writes made by devices)
+		VC_execWord = 0;
+
+	// Timeline trace variables (-trace <file>, or the trace debug console command)
+		// Each thread records events in its own buffer, and the buffers are written to the trace file in the Chrome
+		// trace-event JSON format (opened by chrome://tracing and ui.perfetto.dev) when tracing stops. While tracing
+		// is off, a traced scope only reads VC_tracing.
+	std::atomic<bool> VC_tracing(false);
+	std::string VC_tracePath = "trace.json";
+	std::mutex VC_traceMutex; // Held while a buffer is added to VC_traceBuffers or the buffers are written
+	std::vector<VC_TraceBuffer *> VC_traceBuffers; // Never freed (threads can still hold them)
+	thread_local VC_TraceBuffer * VC_traceBuffer = NULL;
+	thread_local const char * VC_traceThreadName = "Thread";
+	double VC_traceStart = 0, // VC_seconds() when tracing started
+		   VC_traceTimerDue = 0; // When the GLUT timer should call VC_main next (VC_seconds())
+
+	// Multi-core variables (-cores <n> and -interleave)
+		// Memory model: every core reads and writes the shared RAM one word at a time with sequentially consistent
+		// atomic operations, so all cores observe a single order of every read and write (instruction fetches are
+		// reads). The SYS test-and-set and compare-exchange operations are atomic read-modify-writes in that order.
+		// Without -interleave, each core runs on its own host thread and the order between cores is decided by the
+		// host. With -interleave, every core runs on the GLUT thread, one instruction each in order of core ID per
+		// tick, so runs with the same input are the same.
+		// The input handler and the output devices are shared and used one core at a time. SYS replies go to the
+		// reply stack of the core that asked and are read by its GIN instructions before the shared input handler.
+	int VC_coreCount = 1;
+	bool VC_interleave = false;
+	VC_Core VC_cores[VC_MAX_CORES];
+	std::atomic<int> VC_sharedRam[VC_RAM_SIZE];
+	std::vector<std::thread> VC_coreThreads;
+	std::mutex VC_ioMutex; // Held while a core uses the input handler or an output device
+	std::atomic<bool> VC_coresStopped(false),
+					  VC_shutdown(false); // Set by SYS operation 3 on a core thread (the GLUT thread closes the window)
+	long long VC_coreInstructionsAtRefresh = 0;
+
+	// GDB remote serial protocol server (started with -gdb <port>)
+	SOCKET VC_gdbServer = INVALID_SOCKET;
+	std::atomic<SOCKET> VC_gdbClient(INVALID_SOCKET); // Written by the GDB thread
+
+	bool VC_gdbRunning = false; // True after GDB resumes the virtual computer until a stop reply is sent
 
 // Declare and define functions
 void WIN_display(void);
@@ -118,11 +656,155 @@ void WIN_sizeChange(int w, int h);
 void WIN_generateTitle(int timerId);
 void WIN_keyboard(unsigned char key, int x, int y);
 void WIN_mouse(int button, int state, int x, int y);
+void WIN_keyboardUp(unsigned char key, int x, int y);
+void WIN_special(int key, int x, int y);
+void WIN_specialUp(int key, int x, int y);
+void WIN_motion(int x, int y);
 void VC_main(int timerId);
-void VC_alu(int op);
 int VC_inputHandler(bool operation, int word = 0);
 void VC_outputHandler(int io_device, int operand);
 void VC_updateLog(void);
+void VC_updateLogFiles(void);
+void VC_step(void);
+bool VC_liveInput(void);
+void VC_recordInput(int word);
+bool VC_loadArchive(const std::string & image);
+void VC_checkpoint(void);
+void VC_restoreCheckpoint(size_t index);
+void VC_seek(long long count);
+long long VC_searchBack(int address);
+void VC_consoleThread(void);
+void VC_runCommand(const std::string & command);
+void VC_printState(void);
+void VC_debugStep(void);
+bool VC_testBit(const uint64_t * bits, int address);
+void VC_setBit(uint64_t * bits, int address, bool value);
+void VC_stop(const std::string & reason);
+void VC_resume(void);
+int VC_getRegister(int reg);
+void VC_setRegister(int reg, int value);
+void VC_edit(int target, int value);
+void VC_applyEdit(int target, int value);
+void VC_truncateHistory(void);
+void VC_buildCheckpoint(size_t index, int * ram, int * IH_cache);
+bool VC_gdbListen(int port);
+void VC_gdbThread(void);
+void VC_queueGdbPacket(const std::string & packet);
+void VC_gdbPacket(const std::string & packet);
+void VC_gdbSend(const std::string & data);
+int VC_hexByte(const std::string & packet, size_t position);
+void VC_startCores(void);
+void VC_stopCores(void);
+void VC_coreThread(VC_Core * core);
+void VC_coreSys(VC_Core & core, int operand);
+void VC_coreMath(VC_Core & core, int operand);
+int VC_math(int operation, int x, int y, int * results);
+int VC_blockOperation(int operation, int source, int destination, int length);
+void VC_interruptControl(int operand);
+void VC_interrupt(void);
+void VC_detectIdleLoop(void);
+void VC_consoleOutput(int character);
+void VC_flushConsole(void);
+void VC_consoleInput(const std::string & line);
+void VC_netControl(int operand);
+void VC_netRequestConnection(int request, int port, const std::string & path);
+void VC_netThread(void);
+SOCKET VC_netOpen(int request, int port, const std::string & path, bool & connecting);
+void VC_netDeliver(void);
+void VC_recordEvent(int device, int type, int code, int x, int y);
+void VC_queueEvent(const VC_InputEvent & event);
+void VC_eventControl(int operand);
+bool VC_openAudio(const char * path);
+void VC_audioControl(int operand);
+void VC_synthesizeAudio(void);
+void VC_audioThread(void);
+void VC_closeAudio(void);
+long long VC_coreInstructions(void);
+int VC_testAndSet(int & word);
+int VC_testAndSet(std::atomic<int> & word);
+int VC_compareExchange(int & word, int expected, int desired);
+int VC_compareExchange(std::atomic<int> & word, int expected, int desired);
+double VC_seconds(void);
+bool VC_openSharedMemory(const std::string & name);
+void VC_publishStatus(void);
+void VC_closeSharedMemory(void);
+bool VC_openExecTrace(const char * path);
+void VC_recordExec(int type, int address);
+void VC_recordWrites(int address, int length);
+void VC_truncateExecTrace(void);
+void VC_closeExecTrace(void);
+void VC_saveState(VC_Checkpoint & checkpoint);
+void VC_loadState(const VC_Checkpoint & checkpoint);
+void VC_runAhead(void);
+void VC_startTrace(void);
+void VC_stopTrace(void);
+void VC_traceEvent(const char * name, double start, double end);
+void VC_observe(VC_Histogram & histogram, double value);
+void VC_writeHistogram(std::ofstream & target, const char * name, const char * help, const VC_Histogram & histogram);
+void VC_writeMetrics(void);
+void VC_selectBank(int bank);
+int VC_bankWord(int bank, int address);
+void VC_setBankWord(int bank, int address, int value);
+void VC_markBankDirty(int bank);
+void VC_markPages(int address, int length);
+bool VC_parseAddress(const std::string & text, int & bank, int & address);
+
+// Connects the processor to the input and output handlers
+struct VC_HandlerIO
+{
+	int input(void) { return VC_inputHandler(false); }
+	void output(int io_device, int operand) { VC_outputHandler(io_device, operand); }
+} VC_handlerIO;
+
+// Connects a core of a multi-core virtual computer to its SYS reply stack and the shared input and output handlers
+struct VC_CoreIO
+{
+	VC_Core * core;
+
+	int input(void)
+	{
+		if(core->replyCount != 0)
+		{
+			core->replyCount -= 1;
+			return core->replies[core->replyCount];
+		}
+
+		std::lock_guard<std::mutex> lock(VC_ioMutex);
+		return VC_inputHandler(false);
+	}
+
+	void output(int io_device, int operand)
+	{
+		if(io_device == VC_OH_SYS)
+		{
+			VC_coreSys(*core, operand);
+			return;
+		}
+		if(io_device == VC_OH_MTH)
+		{
+			VC_coreMath(*core, operand);
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(VC_ioMutex);
+		VC_outputHandler(io_device, operand);
+	}
+};
+
+// Records a trace event from its construction to the end of its scope (while tracing)
+struct VC_TraceScope
+{
+	const char * name;
+	double start;
+
+	VC_TraceScope(const char * scopeName) : name(scopeName), start(VC_tracing.load(std::memory_order_relaxed) ? VC_seconds() : -1) {}
+
+	~VC_TraceScope()
+	{
+		if(start >= 0)
+			VC_traceEvent(name, start, VC_seconds());
+	}
+};
 
 // Program execution starts here
 int main(int argc, char** argv)
@@ -149,39 +831,244 @@ int main(int argc, char** argv)
 	glutReshapeFunc(WIN_sizeChange); // Called when the window size is changed
 	glutKeyboardFunc(WIN_keyboard);	 // Called when there is a state change on the keyboard
 	glutMouseFunc(WIN_mouse);		 // Called when the mouse is moved or clicked
+	glutKeyboardUpFunc(WIN_keyboardUp);   // Called when a key is released
+	glutSpecialFunc(WIN_special);         // Called when a function or arrow key etc. is pressed
+	glutSpecialUpFunc(WIN_specialUp);     // Called when a function or arrow key etc. is released
+	glutMotionFunc(WIN_motion);           // Called when the mouse is moved with a button held
+	glutPassiveMotionFunc(WIN_motion);    // Called when the mouse is moved without a button held
 	glutCloseFunc(VC_updateLog);	 // Called to update the contents of the log file when the program closes
 
+	// Read command line options
+	for(int i = 1; i < argc; i++)
+	{
+		if((std::string)argv[i] == "-replay" && i + 1 < argc) // Replay the input events recorded in a previous session
+		{
+			std::ifstream events(argv[++i]);
+			if(!events.is_open())
+			{
+				std::cout << "Error: Input log file failed to open" << std::endl;
+				return 0;
+			}
+
+			// Input events are stored as "i <count> <word>" and debugger edits as "e <count> <target> <value>"
+			std::string type;
+			while(events >> type)
+			{
+				if(type == "i")
+				{
+					VC_InputEvent event = {};
+					events >> event.count >> event.word;
+					VC_inputEvents.push_back(event);
+				}
+				else if(type == "r") // Event record ("r <count> <word> <x> <y>")
+				{
+					VC_InputEvent event = {};
+					events >> event.count >> event.word >> event.x >> event.y;
+					event.record = true;
+					VC_inputEvents.push_back(event);
+				}
+				else if(type == "e")
+				{
+					VC_EditEvent edit;
+					events >> edit.count >> edit.target >> edit.value;
+					VC_edits.push_back(edit);
+				}
+			}
+
+			events.close();
+		}
+		else if((std::string)argv[i] == "-metrics" && i + 1 < argc) // Write metrics to a file in the Prometheus text format
+		{
+			VC_metricsPath = argv[++i];
+			VC_metricsEnabled = true;
+		}
+		else if((std::string)argv[i] == "-cores" && i + 1 < argc) // Number of cores sharing RAM
+		{
+			VC_coreCount = std::atoi(argv[++i]);
+			if(VC_coreCount < 1 || VC_coreCount > VC_MAX_CORES)
+			{
+				std::cout << "Error: The number of cores must be between 1 and " << VC_MAX_CORES << std::endl;
+				return 0;
+			}
+		}
+		else if((std::string)argv[i] == "-interleave") // Run every core on one thread in a fixed order
+		{
+			VC_interleave = true;
+		}
+		else if((std::string)argv[i] == "-timing") // Count instruction cycles with the timing model
+		{
+			VC_timingEnabled = true;
+		}
+		else if((std::string)argv[i] == "-waitstates" && i + 1 < argc) // Timing model with extra cycles for each RAM access
+		{
+			VC_timingEnabled = true;
+			VC_timing.waitStates = std::max(std::atoi(argv[++i]), 0);
+		}
+		else if((std::string)argv[i] == "-iolatency" && i + 1 < argc) // Timing model with extra cycles for each GIN and SOT
+		{
+			VC_timingEnabled = true;
+			VC_timing.ioLatency = std::max(std::atoi(argv[++i]), 0);
+		}
+		else if((std::string)argv[i] == "-noidle") // Execute idle loops instead of waiting for an interrupt
+		{
+			VC_idleDetection = false;
+		}
+		else if((std::string)argv[i] == "-console" && i + 1 < argc) // Write the text console to a file
+		{
+			VC_consoleFile = std::fopen(argv[++i], "wb");
+			if(VC_consoleFile == NULL)
+			{
+				std::cout << "Error: Console file failed to open" << std::endl;
+				return 0;
+			}
+		}
+		else if((std::string)argv[i] == "-audio" && i + 1 < argc) // Write the PCM audio device to a WAV file
+		{
+			if(!VC_openAudio(argv[++i]))
+			{
+				std::cout << "Error: Audio file failed to open" << std::endl;
+				return 0;
+			}
+		}
+		else if((std::string)argv[i] == "-shm" && i + 1 < argc) // Share RAM, registers and status with other processes
+		{
+			if(!VC_openSharedMemory(argv[++i]))
+			{
+				std::cout << "Error: Shared memory '" << argv[i] << "' failed to open" << std::endl;
+				return 0;
+			}
+		}
+		else if((std::string)argv[i] == "-runahead" && i + 1 < argc) // Show the screen a number of frames ahead
+		{
+			VC_runAheadFrames = std::max(std::atoi(argv[++i]), 0);
+		}
+		else if((std::string)argv[i] == "-archive" && i + 1 < argc) // Run an image from a ROM archive instead of rom.dat
+		{
+			VC_archiveImage = argv[++i];
+		}
+		else if((std::string)argv[i] == "-exectrace" && i + 1 < argc) // Write every instruction executed to a file
+		{
+			VC_execTracePath = argv[++i];
+		}
+		else if((std::string)argv[i] == "-trace" && i + 1 < argc) // Write a timeline trace of the emulator to a file
+		{
+			VC_tracePath = argv[++i];
+			VC_startTrace();
+		}
+		else if((std::string)argv[i] == "-stdin") // Send stdin to the text console instead of the debug console
+		{
+			VC_stdinToConsole = true;
+		}
+		else if((std::string)argv[i] == "-gdb" && i + 1 < argc) // Accept a GDB connection on a local TCP port
+		{
+			int port = std::atoi(argv[++i]);
+			if(!VC_gdbListen(port))
+			{
+				std::cout << "Error: GDB server failed to start on port " << port << std::endl;
+				return 0;
+			}
+		}
+	}
+
 	// Init Virtual Computer
-	// Load data from ROM to RAM
-	std::ifstream source(VC_ROM_DIR, std::ios::binary);
-	if(!source.is_open())
+	// Load data from ROM to RAM (or from an archive)
+	if(VC_archiveImage != NULL)
+	{
+		if(!VC_loadArchive(VC_archiveImage))
+			return 0;
+	}
+	else
 	{
-		std::cout << "Error: ROM file failed to open" << std::endl;
+		std::ifstream source(VC_ROM_DIR, std::ios::binary);
+		if(!source.is_open())
+		{
+			std::cout << "Error: ROM file failed to open" << std::endl;
+			return 0;
+		}
+
+		char c;
+		int tempNum,
+			num;
+		bool byteType = true;
+		for(int i = 1; i < VC_RAM_SIZE * 2; i++)
+		{
+			if(!source.get(c))
+				break;
+
+			tempNum = (int)c;
+			if(tempNum < 0)
+				tempNum += 256;
+
+			if(byteType)
+				num = tempNum * 256;
+			else
+				vc.ram[(i / 2) - 1] = num + tempNum;
+
+			byteType = !byteType;
+		}
+
+		source.close();
+	}
+
+	// Run-ahead executes instructions in RAM and registers and rolls them back, which other processes would see
+	if(VC_sharing && VC_runAheadFrames > 0)
+	{
+		std::cout << "Error: -runahead can't be used with -shm" << std::endl;
 		return 0;
 	}
 
-	char c;
-	int tempNum,
-		num;
-	bool byteType = true;
-	for(int i = 1; i < VC_RAM_SIZE * 2; i++)
+	if(VC_coreCount > 1)
 	{
-		if(!source.get(c))
-			break;
+		// The debugger works on one core
+		if(VC_gdbServer != INVALID_SOCKET || !VC_inputEvents.empty() || !VC_edits.empty())
+		{
+			std::cout << "Error: -gdb and -replay can't be used with more than one core" << std::endl;
+			return 0;
+		}
 
-		tempNum = (int)c;
-		if(tempNum < 0)
-			tempNum += 256;
+		// Cycles are counted on the GLUT thread
+		if(VC_timingEnabled)
+		{
+			std::cout << "Error: The timing model can't be used with more than one core" << std::endl;
+			return 0;
+		}
 
-		if(byteType)
-			num = tempNum * 256;
-		else
-			ram[(i / 2) - 1] = num + tempNum;
+		// The cores use their own shared RAM
+		if(VC_sharing)
+		{
+			std::cout << "Error: -shm can't be used with more than one core" << std::endl;
+			return 0;
+		}
+
+		if(VC_execTracePath != NULL)
+		{
+			std::cout << "Error: -exectrace can't be used with more than one core" << std::endl;
+			return 0;
+		}
+
+		if(VC_runAheadFrames > 0)
+		{
+			std::cout << "Error: -runahead can't be used with more than one core" << std::endl;
+			return 0;
+		}
 
-		byteType = !byteType;
+		VC_startCores();
 	}
+	else
+	{
+		// The first checkpoint is the state at startup
+		VC_checkpoint();
+
+		// So is the start of the execution trace
+		if(VC_execTracePath != NULL && !VC_openExecTrace(VC_execTracePath))
+		{
+			std::cout << "Error: Execution trace file failed to open" << std::endl;
+			return 0;
+		}
 
-	source.close();
+		// Start reading debug console commands
+		std::thread(VC_consoleThread).detach();
+	}
 
 	// Start timers
 	glutTimerFunc(1000 / clockSpeed, VC_main, TIMER_VC);
@@ -199,6 +1086,7 @@ int main(int argc, char** argv)
 	}
 
 	// Enter GLUT event processing cycle.
+	VC_traceThreadName = "GLUT";
 	glutMainLoop();
 
 	return 1;
@@ -207,9 +1095,16 @@ int main(int argc, char** argv)
 // Called to re-draw the window
 void WIN_display(void)
 {
+	VC_TraceScope trace("WIN_display");
+
+	double start = VC_metricsEnabled ? VC_seconds() : 0;
+
 	// Clear color buffer
 	glClear(GL_COLOR_BUFFER_BIT);
 
+	// Run-ahead mode shows the screen a few frames from now (the debugger shows the screen as it is)
+	GLubyte (* pixels)[PIXEL_COUNT_Y][4] = (VC_runAheadFrames > 0 && !VC_paused) ? VC_runAheadPixels : pixelDisplayColor;
+
 	// Draw
 	glBegin(GL_QUADS);
 
@@ -221,9 +1116,9 @@ void WIN_display(void)
 			for(GLfloat y = -1.0f; y <= 1.0f; y += PIXEL_SIZE_Y)
 			{
 				glColor3ub(
-							  pixelDisplayColor[pixelColor_x][pixelColor_y][0], 
-							  pixelDisplayColor[pixelColor_x][pixelColor_y][1], 
-							  pixelDisplayColor[pixelColor_x][pixelColor_y][2]
+							  pixels[pixelColor_x][pixelColor_y][0], 
+							  pixels[pixelColor_x][pixelColor_y][1], 
+							  pixels[pixelColor_x][pixelColor_y][2]
 							  );
 				glVertex2f(x,                y               );
 				glVertex2f(x + PIXEL_SIZE_X, y               );
@@ -240,6 +1135,9 @@ void WIN_display(void)
 	glEnd();
 
 	glutSwapBuffers();
+
+	if(VC_metricsEnabled)
+		VC_observe(VC_frameTime, VC_seconds() - start);
 }
 
 // Called when the window is resized
@@ -251,14 +1149,39 @@ void WIN_sizeChange(int w, int h)
 // Refresh the title to show the updated clockspeed
 void WIN_generateTitle(int timerId)
 {
+	VC_TraceScope trace("WIN_generateTitle");
+
 	if(timerId == TIMER_TITLE_REFRESH) // Refresh the window title and reset the timer
 	{
 		// Reset timer
 		glutTimerFunc(TITLE_REFRESH_PERIOD, WIN_generateTitle, TIMER_TITLE_REFRESH);
 
-		// Set new title
-		glutSetWindowTitle(((std::string)WIN_DEFAULT_TITLE + " - IPS: " + std::to_string(ips)).std::string::c_str());
-		iarAtLastRefresh = iar;
+		if(VC_coreCount > 1)
+		{
+			long long instructions = VC_coreInstructions();
+			ips = instructions - VC_coreInstructionsAtRefresh;
+			VC_coreInstructionsAtRefresh = instructions;
+		}
+
+		// Set new title (with the cycles per second when the timing model is used)
+		std::string title = (std::string)WIN_DEFAULT_TITLE + " - IPS: " + std::to_string(ips);
+		if(VC_timingEnabled)
+		{
+			title += " - Cycles/s: " + std::to_string(VC_cycleCount - VC_cyclesAtRefresh);
+			VC_cyclesAtRefresh = VC_cycleCount;
+		}
+		glutSetWindowTitle(title.c_str());
+		iarAtLastRefresh = vc.iar;
+
+		VC_lastIps = ips;
+		if(VC_metricsEnabled)
+			VC_writeMetrics();
+
+		// Show console output that is waiting for a newline (core threads write to the buffer while holding VC_ioMutex)
+		{
+			std::lock_guard<std::mutex> lock(VC_ioMutex);
+			VC_flushConsole();
+		}
 	}
 	else if(timerId == WIN_CREATE_WINDOW) // Create a window with the generated title
 	{
@@ -272,248 +1195,322 @@ void WIN_generateTitle(int timerId)
 // Called when there is a state change on the keyboard
 void WIN_keyboard(unsigned char key, int x, int y)
 {
+	VC_TraceScope trace("WIN_keyboard");
+
+	if(!VC_liveInput())
+		return;
+
+	if(VC_events.records == 1)
+	{
+		VC_recordEvent(WIN_KEYBOARD, VC_EVENT_KEY_DOWN, key, x, y);
+		return;
+	}
+
 	// Send keyboard state to the virtual computer via the input handler
-	VC_inputHandler(true, WIN_KEYBOARD);
-	VC_inputHandler(true, (int)key);
-	VC_inputHandler(true, WIN_KEYBOARD);
-	VC_inputHandler(true, x);
-	VC_inputHandler(true, WIN_KEYBOARD);
-	VC_inputHandler(true, y);
+	VC_recordInput(WIN_KEYBOARD);
+	VC_recordInput((int)key);
+	VC_recordInput(WIN_KEYBOARD);
+	VC_recordInput(x);
+	VC_recordInput(WIN_KEYBOARD);
+	VC_recordInput(y);
 }
 
 // Called when the mouse is moved or clicked
 void WIN_mouse(int button, int state, int x, int y)
 {
+	VC_TraceScope trace("WIN_mouse");
+
+	if(state == GLUT_DOWN)
+		WIN_mouseButtons |= 1 << button;
+	else
+		WIN_mouseButtons &= ~(1 << button);
+
+	if(!VC_liveInput())
+		return;
+
+	if(VC_events.records == 1)
+	{
+		VC_recordEvent(WIN_MOUSE, state == GLUT_DOWN ? VC_EVENT_BUTTON_DOWN : VC_EVENT_BUTTON_UP, button, x, y);
+		return;
+	}
+
 	// Send mouse state to the virtual computer via the input handler
-	VC_inputHandler(true, WIN_MOUSE);
-	VC_inputHandler(true, button);
-	VC_inputHandler(true, WIN_MOUSE);
-	VC_inputHandler(true, state);
-	VC_inputHandler(true, WIN_MOUSE);
-	VC_inputHandler(true, x);
-	VC_inputHandler(true, WIN_MOUSE);
-	VC_inputHandler(true, y);
+	VC_recordInput(WIN_MOUSE);
+	VC_recordInput(button);
+	VC_recordInput(WIN_MOUSE);
+	VC_recordInput(state);
+	VC_recordInput(WIN_MOUSE);
+	VC_recordInput(x);
+	VC_recordInput(WIN_MOUSE);
+	VC_recordInput(y);
 }
 
-// All of the following functions determine the behavior of the virtual computer
+// Called when a key is released
+	// Key releases, special keys and mouse motion are only sent as event records that the guest asked for
+void WIN_keyboardUp(unsigned char key, int x, int y)
+{
+	VC_TraceScope trace("WIN_keyboardUp");
 
-// Execute one instruction in the virtual computer
-void VC_main(int timerId)
+	if(VC_liveInput() && VC_events.records == 1 && (VC_events.send & VC_EVENT_SEND_KEY_UP))
+		VC_recordEvent(WIN_KEYBOARD, VC_EVENT_KEY_UP, key, x, y);
+}
+
+void WIN_special(int key, int x, int y)
 {
-	// Reset timer
-	glutTimerFunc(1000 / clockSpeed, VC_main, TIMER_VC);
+	VC_TraceScope trace("WIN_special");
 
-	// Increment IPS
-	ips += 1;
+	if(VC_liveInput() && VC_events.records == 1 && (VC_events.send & VC_EVENT_SEND_SPECIAL))
+		VC_recordEvent(WIN_KEYBOARD, VC_EVENT_SPECIAL_DOWN, key, x, y);
+}
 
-	// Get instruction
-	int opCode = ram[iar] >> 12,
-		operand = ram[iar] % 4096;
+void WIN_specialUp(int key, int x, int y)
+{
+	VC_TraceScope trace("WIN_specialUp");
 
-	// Execute instruction
-	bool incIar = true;
+	if(VC_liveInput() && VC_events.records == 1 && (VC_events.send & VC_EVENT_SEND_SPECIAL) && (VC_events.send & VC_EVENT_SEND_KEY_UP))
+		VC_recordEvent(WIN_KEYBOARD, VC_EVENT_SPECIAL_UP, key, x, y);
+}
 
-	opLog[opCount][0] = iar;
-	opLog[opCount][1] = opCode;
-	
-	switch(opCode)
-	{
-		case VC_OP_LDA:
-			rA = operand;
-			VC_alu(aluOp);
-			opLog[opCount][2] = rA;
-			break;
-		case VC_OP_LAA:
-			rA = ram[operand];
-			VC_alu(aluOp);
-			opLog[opCount][2] = rA;
-			opLog[opCount][3] = operand;
-			break;
-		case VC_OP_ADD:
-			rB = operand;
-			aluOp = VC_ALU_ADD;
-			VC_alu(aluOp);
-			opLog[opCount][2] = rB;
-			break;
-		case VC_OP_SBD:
-			rB = operand;
-			aluOp = VC_ALU_SUB;
-			VC_alu(aluOp);
-			opLog[opCount][2] = rB;
-			break;
-		case VC_OP_ADA:
-			rB = ram[operand];
-			aluOp = VC_ALU_ADD;
-			VC_alu(aluOp);
-			opLog[opCount][2] = rB;
-			opLog[opCount][3] = operand;
-			break;
-		case VC_OP_SBA:
-			rB = ram[operand];
-			aluOp = VC_ALU_SUB;
-			VC_alu(aluOp);
-			opLog[opCount][2] = rB;
-			opLog[opCount][3] = operand;
-			break;
-		case VC_OP_STR:
-			ram[operand] = rC;
-			opLog[opCount][2] = rC;
-			opLog[opCount][3] = operand;
-			break;
-		case VC_OP_STD:
-			rC = ~(~rA | rB);
-			ram[operand] = rC;
-			aluOp = VC_ALU_OTHER;
-			VC_alu(aluOp);
-			opLog[opCount][2] = rC;
-			opLog[opCount][3] = operand;
-			break;
-		case VC_OP_SSD:
-		{
-			int rA_temp = rA;
-			for(int i = 0; i < rB % 16; i++)
-			{
-				if(rA_temp % 2 != 0) // If rA is odd
-					rA_temp += 65536;
-				rA_temp >>= 1; // Shift down by 1
-			}
-			rC = rA_temp;
-			aluOp = VC_ALU_OTHER;
-			VC_alu(aluOp);
-			opLog[opCount][2] = rC;
-			opLog[opCount][3] = operand;
-			break;
-		}
-		case VC_OP_JMP:
-			iar = operand;
-			incIar = false;
-			opLog[opCount][2] = operand;
-			break;
-		case VC_OP_JIZ:
-			if(flag[0])
-			{
-				iar = operand;
-				incIar = false;
-				opLog[opCount][2] = 1;
-				opLog[opCount][3] = operand;
-			}
-			else
-			{
-				opLog[opCount][2] = 0;
-			}
-			break;
-		case VC_OP_JIE:
-			if(flag[1])
-			{
-				iar = operand;
-				incIar = false;
-				opLog[opCount][2] = 1;
-				opLog[opCount][3] = operand;
-			}
-			else
-			{
-				opLog[opCount][2] = 0;
-			}
-			break;
-		case VC_OP_JII:
-			if(flag[2])
-			{
-				iar = operand;
-				incIar = false;
-				opLog[opCount][2] = 1;
-				opLog[opCount][3] = operand;
-			}
-			else
-			{
-				opLog[opCount][2] = 0;
-			}
-			break;
-		case VC_OP_JBT:
-			if(rA & rB == rB)
+// Called when the mouse is moved
+void WIN_motion(int x, int y)
+{
+	VC_TraceScope trace("WIN_motion");
+
+	if(VC_liveInput() && VC_events.records == 1 && (VC_events.send & VC_EVENT_SEND_MOTION))
+		VC_recordEvent(WIN_MOUSE, VC_EVENT_MOTION, WIN_mouseButtons, x, y);
+}
+
+// All of the following functions determine the behavior of the virtual computer
+
+// Execute one instruction in the virtual computer
+void VC_main(int timerId)
+{
+	VC_TraceScope trace("VC_main");
+
+	// Show the time between when the GLUT timer was due and when it called VC_main
+	if(trace.start >= 0 && VC_traceTimerDue != 0 && trace.start > VC_traceTimerDue)
+		VC_traceEvent("GLUT timer late", VC_traceTimerDue, trace.start);
+
+	// Reset timer (the host sleeps between ticks while the virtual computer waits for an interrupt)
+	bool waiting = VC_interrupts.waiting && !VC_paused;
+	int delay = waiting ? VC_WAIT_POLL_PERIOD : VC_lastCycles * 1000 / clockSpeed;
+	glutTimerFunc(delay, VC_main, TIMER_VC);
+	if(trace.start >= 0)
+		VC_traceTimerDue = trace.start + delay / 1000.0;
+
+	// Measure how late the timer was
+	if(VC_metricsEnabled)
+	{
+		double now = VC_seconds();
+		if(VC_lastTick != 0 && !VC_paused && !waiting)
+			VC_observe(VC_timerJitter, std::fabs(now - VC_lastTick - VC_lastDelay / 1000.0));
+		VC_lastTick = now;
+		VC_lastDelay = delay;
+	}
+
+	if(VC_coreCount > 1)
+	{
+		if(VC_shutdown)
+		{
+			VC_stopCores();
+			glutDestroyWindow(windowId);
+		}
+		else if(VC_interleave)
+		{
+			for(int i = 0; i < VC_coreCount; i++)
 			{
-				iar = operand;
-				incIar = false;
-				opLog[opCount][2] = 1;
-				opLog[opCount][3] = operand;
+				VC_CoreIO io = {&VC_cores[i]};
+				VC_execute(VC_cores[i], io, VC_cores[i].log);
+				VC_cores[i].instructions += 1;
+				VC_cores[i].opCounts[VC_cores[i].log[1]] += 1;
 			}
+		}
+		return;
+	}
+
+	// Run debug console commands and GDB packets
+	if(VC_commandsPending)
+	{
+		// Readers of the shared memory block wait while commands change RAM and registers
+		VC_SharedWrite sharedWrite;
+
+		std::deque<std::string> commands,
+								packets;
+		VC_consoleMutex.lock();
+		commands.swap(VC_consoleCommands);
+		packets.swap(VC_gdbPackets);
+		VC_commandsPending = false;
+		VC_consoleMutex.unlock();
+
+		for(size_t i = 0; i < commands.size(); i++)
+		{
+			if(VC_stdinToConsole)
+				VC_consoleInput(commands[i]);
 			else
-			{
-				opLog[opCount][2] = 0;
-			}
-			break;
-		case VC_OP_GIN:
-			ram[operand] = VC_inputHandler(false); // Read from the IH
-			opLog[opCount][2] = operand;
-			opLog[opCount][3] = ram[operand];
-			break;
-		case VC_OP_SOT:
-			VC_outputHandler(rA, operand); // Send output
-			opLog[opCount][2] = rA;
-			opLog[opCount][3] = operand;
-			break;
+				VC_runCommand(commands[i]);
+		}
+		for(size_t i = 0; i < packets.size(); i++)
+			VC_gdbPacket(packets[i]);
 	}
 
-	// Increment IAR
-	if(incIar)
+	if(VC_paused)
+		return;
+
+	// Deliver data received by the local socket
+	if(VC_netPending)
 	{
-		iar += 1;
-		if(iar >= VC_RAM_SIZE)
-			iar = 0;
+		VC_SharedWrite sharedWrite;
+		VC_netDeliver();
 	}
 
-	// Increment operation count
-	opCount += 1;
-	if(opCount >= VC_RAM_SIZE)
+	// Make the audio samples for the instructions executed since the last tick
+	if(VC_audioFile != NULL)
+		VC_synthesizeAudio();
+
+	// Run the idle cycles of the time since the last tick (breakpoints aren't checked since no instructions run)
+	if(VC_interrupts.waiting)
 	{
-		opCount = 0;
-		opOverflow = true;
+		VC_flushConsole();
+
+		{
+			VC_SharedWrite sharedWrite;
+			int cycles = std::max(1, VC_WAIT_POLL_PERIOD * clockSpeed / 1000);
+			for(int i = 0; i < cycles && VC_interrupts.waiting; i++)
+				VC_step();
+		}
+
+		if(VC_runAheadFrames > 0 && VC_runAheadDue)
+			VC_runAhead();
+		return;
 	}
+
+	// Increment IPS
+	ips += 1;
+
+	// Breakpoints and watchpoints are only checked when at least one is set
+	{
+		VC_SharedWrite sharedWrite;
+		if(VC_debugBitCount == 0)
+			VC_step();
+		else
+			VC_debugStep();
+	}
+
+	if(VC_runAheadFrames > 0 && VC_runAheadDue)
+		VC_runAhead();
 }
 
-// Perform operations in the alu
-void VC_alu(int op)
+// Execute one instruction
+	// Input events recorded for the current instruction count are sent to the input handler first
+	// While waiting for an interrupt, this is an idle cycle that doesn't execute an instruction
+void VC_step(void)
 {
-	long temp;
+	bool raised = false; // An interrupt was raised in this cycle
 
-	if(op == VC_ALU_ADD)
+	while(VC_nextEdit < VC_edits.size() && VC_edits[VC_nextEdit].count <= VC_instructionCount)
 	{
-		temp = rA + rB;
+		VC_applyEdit(VC_edits[VC_nextEdit].target, VC_edits[VC_nextEdit].value);
+		VC_loop.changed = true;
+		raised = true; // Edits can change the result of an idle loop
+		VC_nextEdit += 1;
+	}
 
-		if(temp >= 65536)
-		{
-			rC = temp - 65536;
-			flag[1] = true;
-		}
+	// Another process changed the shared memory block (edits made this way can't be replayed)
+	if(VC_sharing && VC_shared.doorbell.exchange(0, std::memory_order_acquire) != 0)
+	{
+		VC_loop.changed = true;
+		raised = true;
+	}
+
+	while(VC_nextEvent < VC_inputEvents.size() && VC_inputEvents[VC_nextEvent].count <= VC_instructionCount)
+	{
+		if(VC_inputEvents[VC_nextEvent].record)
+			VC_queueEvent(VC_inputEvents[VC_nextEvent]);
 		else
+			VC_inputHandler(true, VC_inputEvents[VC_nextEvent].word);
+		VC_interrupts.pending |= VC_INT_INPUT;
+		raised = true;
+		VC_nextEvent += 1;
+	}
+
+	// Count the cycles for the timer (with the timing model, the cycles taken by the last instruction)
+	if(VC_interrupts.interval != 0)
+	{
+		VC_interrupts.timer += VC_timingEnabled ? VC_lastCycles : 1;
+		if(VC_interrupts.timer >= VC_interrupts.interval)
 		{
-			rC = temp;
-			flag[1] = false;
+			VC_interrupts.timer = 0;
+			VC_interrupts.pending |= VC_INT_TIMER;
+			raised = true;
 		}
 	}
-	else if(op == VC_ALU_SUB)
+
+	if(VC_interrupts.idle && raised)
+		VC_interrupts.waiting = VC_interrupts.idle = false;
+	if(VC_interrupts.pending != 0 && !VC_interrupts.idle)
+		VC_interrupt();
+
+	// JII jumps while the input handler has words or event records are waiting
+	vc.flag[2] = VC_IH_cache_stored != 0 || !VC_eventQueue.empty();
+
+	if(!VC_interrupts.waiting)
 	{
-		temp = rA - rB;
+		int iar = vc.iar,
+			opCode = vc.ram[iar] >> 12,
+			operand = vc.ram[iar] % 4096,
+			oldValue = vc.ram[operand];
+		VC_execAt = iar;
+		VC_execWord = vc.ram[iar];
 
-		if(temp < 0)
+		// Execute instruction (the timing model is a separate engine so the usual one doesn't count cycles)
+		opBank[opCount] = VC_bank;
+		if(VC_timingEnabled)
 		{
-			rC = temp + 65536;
-			flag[1] = true;
+			VC_lastCycles = VC_executeTimed(vc, VC_handlerIO, opLog[opCount], VC_timing);
+			VC_cycleCount += VC_lastCycles;
 		}
 		else
 		{
-			rC = temp;
-			flag[1] = false;
+			VC_execute(vc, VC_handlerIO, opLog[opCount]);
+		}
+		if(!VC_runningAhead)
+			VC_metricOpCounts[opLog[opCount][1]] += 1;
+
+		// Look for loops that can't change anything until an interrupt is raised
+		if(vc.ram[operand] != oldValue || opCode == VC_OP_SOT)
+			VC_loop.changed = true;
+
+		// Mark the page the instruction stored to (devices mark the words they write themselves)
+		if(vc.ram[operand] != oldValue)
+			VC_dirtyPages |= 1u << (operand / VC_PAGE_SIZE);
+
+		if(VC_execTrace.is_open() && VC_instructionCount >= VC_historyEnd)
+			VC_recordExec(VC_EXEC_INSTRUCTION, VC_ISA[opCode].operand == VC_OPERAND_WRITE ? operand : -1);
+		if(opCode >= VC_OP_JMP && opCode <= VC_OP_JBT && vc.iar <= iar && VC_idleDetection)
+			VC_detectIdleLoop();
+
+		// Increment operation count
+		opCount += 1;
+		if(opCount >= VC_RAM_SIZE)
+		{
+			opCount = 0;
+			opOverflow = true;
 		}
 	}
-	else if(op == VC_ALU_OTHER)
+	else if(VC_timingEnabled)
 	{
-		// Don't do anything
+		VC_lastCycles = 1;
+		VC_cycleCount += 1;
 	}
 
-	if(rC == 0)
-		flag[0] = true;
-	else
-		flag[0] = false;
+	// Extend the history and take a checkpoint when a new multiple of VC_CHECKPOINT_PERIOD is reached
+	VC_instructionCount += 1;
+	if(VC_instructionCount > VC_historyEnd)
+	{
+		VC_historyEnd = VC_instructionCount;
+		if(VC_instructionCount % VC_CHECKPOINT_PERIOD == 0)
+			VC_checkpoint();
+	}
 }
 
 // Read or write to the Input Handler
@@ -528,6 +1525,17 @@ int VC_inputHandler(bool operation, int word)
 		}
 
 		VC_IH_cache[VC_IH_cache_pos] = word;
+		VC_dirtyIHPages |= 1u << (VC_IH_cache_pos / VC_PAGE_SIZE);
+
+		// Words sent while running ahead are sent again when the instructions really run
+		if(!VC_runningAhead)
+		{
+			VC_metricInputWords += 1;
+			if(VC_IH_cache_stored >= VC_RAM_SIZE)
+				VC_metricInputDrops += 1;
+		}
+		if(VC_metricsEnabled)
+			VC_IH_cacheTime[VC_IH_cache_pos] = VC_seconds();
 
 		VC_IH_cache_stored += 1;
 
@@ -547,6 +1555,9 @@ int VC_inputHandler(bool operation, int word)
 
 			VC_IH_cache_stored -= 1;
 
+			if(VC_metricsEnabled && !VC_runningAhead)
+				VC_observe(VC_inputLatency, VC_seconds() - VC_IH_cacheTime[oldPos]);
+
 			return VC_IH_cache[oldPos];
 		}
 		else
@@ -559,6 +1570,8 @@ int VC_inputHandler(bool operation, int word)
 // Send data to output devices via the Output Handler
 void VC_outputHandler(int io_device, int operand)
 {
+	VC_metricOutputCalls[std::min(io_device, VC_METRIC_DEVICES - 1)] += 1;
+
 	switch(io_device)
 	{
 		case VC_OH_SYS: // Perform operations outside of the CPU and get information about the computer
@@ -571,16 +1584,40 @@ void VC_outputHandler(int io_device, int operand)
 						VC_inputHandler(true, VC_OH_SYS);
 						VC_inputHandler(true, clockSpeed);
 						break;
-					// Store the operand for use in operations that require two words of data
+					// Store the operand for use in operations that require two or more words of data
 					case 1:
+					case 6:
+					case 7:
 						VC_OH_SYS_cache = operand;
 						VC_OH_SYS_cache_stored = true;
+						VC_OH_SYS_argCount = 0;
 						break;
 					case 2: // Restart the computer
 						// Not currently supported
 						break;
 					case 3: // Shut down the computer
-						glutDestroyWindow(windowId);
+						if(VC_instructionCount >= VC_historyEnd) // Not while replaying earlier instructions
+							glutDestroyWindow(windowId);
+						break;
+					case 4: // Send the core ID to the input handler (see VC_coreSys for multi-core virtual computers)
+						VC_inputHandler(true, VC_OH_SYS);
+						VC_inputHandler(true, 0);
+						break;
+					case 5: // Send the number of cores to the input handler
+						VC_inputHandler(true, VC_OH_SYS);
+						VC_inputHandler(true, 1);
+						break;
+					case 8: // Wait for an interrupt (no instructions are executed until one is pending)
+						VC_interrupts.waiting = true;
+						break;
+					case 9: // Store the cycle count and send its low 16 bits to the input handler (see the timing model variables)
+						VC_cycleLatch = VC_timingEnabled ? VC_cycleCount : VC_instructionCount;
+						VC_inputHandler(true, VC_OH_SYS);
+						VC_inputHandler(true, (int)(VC_cycleLatch & 65535));
+						break;
+					case 10: // Send bits 16 to 31 of the cycle count stored by operation 9 to the input handler
+						VC_inputHandler(true, VC_OH_SYS);
+						VC_inputHandler(true, (int)((VC_cycleLatch >> 16) & 65535));
 						break;
 					default:
 						// Don't do anything
@@ -589,25 +1626,163 @@ void VC_outputHandler(int io_device, int operand)
 			}
 			else
 			{
-				// Perform actions that require two words of data
+				// Perform actions that require two or more words of data
+				bool complete = true;
 				switch(VC_OH_SYS_cache)
 				{
 					case 1: // Set the clock speed of the virtual computer
+						VC_synthesizeAudio(); // Audio made so far is timed at the old clock speed
 						clockSpeed = operand;
 						break;
+					case 6: // Test-and-set ram[operand] and send its old value to the input handler
+						VC_inputHandler(true, VC_OH_SYS);
+						VC_inputHandler(true, VC_testAndSet(vc.ram[operand]));
+						VC_recordWrites(operand, 1);
+						break;
+					case 7: // Compare-exchange (address, expected value, desired value) and send the old value to the input handler
+						if(VC_OH_SYS_argCount < 2)
+						{
+							VC_OH_SYS_args[VC_OH_SYS_argCount] = operand;
+							VC_OH_SYS_argCount += 1;
+							complete = false;
+						}
+						else
+						{
+							VC_inputHandler(true, VC_OH_SYS);
+							VC_inputHandler(true, VC_compareExchange(vc.ram[VC_OH_SYS_args[0]], VC_OH_SYS_args[1], operand));
+							VC_markPages(VC_OH_SYS_args[0], 1);
+							VC_recordWrites(VC_OH_SYS_args[0], 1);
+						}
+						break;
 					default:
 						// don't do anything
 						break;
 				}
-				VC_OH_SYS_cache_stored = false;
+				VC_OH_SYS_cache_stored = !complete;
 			}
 			break;
-		case WIN_KEYBOARD: // Keyboard
-			// Don't do anything (the keyboard is not an output device)
+		case VC_OH_MBK: // Select banks of extended memory (the keyboard uses the same number as an input device)
+			if(VC_coreCount > 1) // Bank switching isn't supported with more than one core
+				break;
+
+			if(VC_OH_MBK_cache_stored == false)
+			{
+				// Perform actions that only require one word of data
+				switch(operand)
+				{
+					case 0: // Send the selected bank to the input handler
+						VC_inputHandler(true, VC_OH_MBK);
+						VC_inputHandler(true, VC_bank);
+						break;
+					// Store the operand for use in operations that require two words of data
+					case 1:
+						VC_OH_MBK_cache = operand;
+						VC_OH_MBK_cache_stored = true;
+						break;
+					case 2: // Send the number of banks to the input handler
+						VC_inputHandler(true, VC_OH_MBK);
+						VC_inputHandler(true, VC_BANK_COUNT);
+						break;
+					default:
+						// Don't do anything
+						break;
+				}
+			}
+			else
+			{
+				// Perform actions that require two words of data
+				switch(VC_OH_MBK_cache)
+				{
+					case 1: // Select a bank (RAM from VC_BANK_START to the end shows the bank)
+						if(operand < VC_BANK_COUNT)
+							VC_selectBank(operand);
+						break;
+					default:
+						// don't do anything
+						break;
+				}
+				VC_OH_MBK_cache_stored = false;
+			}
 			break;
 		case WIN_MOUSE:
 			// Don't do anything (the mouse is not an output device)
 			break;
+		case VC_OH_MTH: // Math coprocessor
+			if(VC_OH_MTH_cache_stored == false)
+			{
+				// Store the operation until the address of its arguments is sent
+				VC_OH_MTH_cache = operand;
+				VC_OH_MTH_cache_stored = true;
+			}
+			else
+			{
+				// The arguments are ram[operand] and the word after it
+				int results[VC_MTH_RESULTS],
+					count = VC_math(VC_OH_MTH_cache, vc.ram[operand], vc.ram[(operand + 1) % VC_RAM_SIZE], results);
+
+				// Results are read like the input handler (in order, then the device)
+				VC_inputHandler(true, VC_OH_MTH);
+				for(int i = count - 1; i >= 0; i--)
+					VC_inputHandler(true, results[i]);
+				VC_interrupts.pending |= VC_INT_DEVICE;
+				VC_OH_MTH_cache_stored = false;
+			}
+			break;
+		case VC_OH_MEM: // Block memory engine
+			if(VC_coreCount > 1) // The engine works on the RAM of a single core computer
+				break;
+
+			if(VC_OH_MEM_cache_stored == false)
+			{
+				// Store the operation until its source, destination and length are sent
+				VC_OH_MEM_cache = operand;
+				VC_OH_MEM_cache_stored = true;
+				VC_OH_MEM_argCount = 0;
+			}
+			else if(VC_OH_MEM_argCount < 2)
+			{
+				VC_OH_MEM_args[VC_OH_MEM_argCount] = operand;
+				VC_OH_MEM_argCount += 1;
+			}
+			else
+			{
+				int status = VC_blockOperation(VC_OH_MEM_cache, VC_OH_MEM_args[0], VC_OH_MEM_args[1], operand);
+
+				// Send the status to the input handler once the operation is complete
+				VC_inputHandler(true, VC_OH_MEM);
+				VC_inputHandler(true, status);
+				VC_interrupts.pending |= VC_INT_DEVICE;
+				VC_OH_MEM_cache_stored = false;
+			}
+			break;
+		case VC_OH_INT: // Interrupt controller
+			if(VC_coreCount > 1) // Interrupts are only delivered to a single core computer
+				break;
+
+			VC_interruptControl(operand);
+			break;
+		case VC_OH_CON: // Text console
+			if(VC_instructionCount >= VC_historyEnd) // Not while replaying earlier instructions
+				VC_consoleOutput(operand);
+			break;
+		case VC_OH_NET: // Local socket
+			if(VC_coreCount > 1) // The socket delivers data to a single core computer
+				break;
+
+			VC_netControl(operand);
+			break;
+		case VC_OH_EVT: // Input event records
+			if(VC_coreCount > 1) // Input is sent to multi-core computers as words
+				break;
+
+			VC_eventControl(operand);
+			break;
+		case VC_OH_SND: // PCM audio
+			if(VC_coreCount > 1) // Audio is timed by the instruction count of a single core computer
+				break;
+
+			VC_audioControl(operand);
+			break;
 		default: // PRD - Communicate with other peripheral devices (not including the keyboard and mouse)
 			// Don't do anything (alternate peripheral devices are not supported)
 			break;
@@ -617,6 +1792,22 @@ void VC_outputHandler(int io_device, int operand)
 // Called to update the contents of the log file when the program closes
 void VC_updateLog(void)
 {
+	{
+		VC_TraceScope trace("VC_updateLog");
+		VC_updateLogFiles();
+	}
+	VC_stopTrace();
+}
+
+// Write the operation log, the input log and the remaining console and audio output
+void VC_updateLogFiles(void)
+{
+	VC_stopCores();
+	VC_flushConsole();
+	VC_closeAudio();
+	VC_closeSharedMemory();
+	VC_closeExecTrace();
+
 	std::ofstream target(VC_OP_LOG_DIR, std::ios::trunc);
 
 	// If opOverflow == true:
@@ -628,73 +1819,11 @@ void VC_updateLog(void)
 	{
 		target << "iar: " << opLog[i][0] << "   | ";
 
-		switch(opLog[i][1])
-		{
-			case VC_OP_LDA:
-				target << "LDA | rA <= " << opLog[i][2];
-				break;
-			case VC_OP_LAA:
-				target << "LAA | rA <= ram[" << opLog[i][3] << "]   | (rA <= " << opLog[i][2] << ")";
-				break;
-			case VC_OP_ADD:
-				target << "ADD | rA + rB   | (rB <= " << opLog[i][2] << ")";
-				break;
-			case VC_OP_SBD:
-				target << "SBD | rA - rB   | (rB <= " << opLog[i][2] << ")";
-				break;
-			case VC_OP_ADA:
-				target << "ADA | rA + rB   | (rB <= ram[" << opLog[i][3] << "])   | (rB <= " << opLog[i][2] << ")";
-				break;
-			case VC_OP_SBA:
-				target << "SBA | rA - rB   | (rB <= ram[" << opLog[i][3] << "])   | (rB <= " << opLog[i][2] << ")";
-				break;
-			case VC_OP_STR:
-				target << "STR | ram[" << opLog[i][3] << "] <= " << opLog[i][2];
-				break;
-			case VC_OP_STD:
-				target << "STD | ram[" << opLog[i][3] << "] <= " << opLog[i][2];
-				break;
-			case VC_OP_SSD:
-				target << "SSD | ram[" << opLog[i][3] << "] <= " << opLog[i][2];
-				break;
-			case VC_OP_JMP:
-				target << "JMP | jump: " << opLog[i][2];
-				break;
-			case VC_OP_JIZ:
-				target << "JIZ | ";
-				if(opLog[i][2])
-					target << "jump: " << opLog[i][3] << "   | zero flag was true";
-				else
-					target << "did not jump   | zero flag was false";
-				break;
-			case VC_OP_JIE:
-				target << "JIE | ";
-				if(opLog[i][2])
-					target << "jump: " << opLog[i][3] << "   | extra flag was true";
-				else
-					target << "did not jump   | extra flag was false";
-				break;
-			case VC_OP_JII:
-				target << "JII | ";
-				if(opLog[i][2])
-					target << "jump: " << opLog[i][3] << "   | input flag was true";
-				else
-					target << "did not jump   | input flag was false";
-				break;
-			case VC_OP_JBT:
-				target << "JBT | ";
-				if(opLog[i][2])
-					target << "jump: " << opLog[i][3] << "   | all selected bits were true";
-				else
-					target << "did not jump   | one or more of the selected bits were false";
-				break;
-			case VC_OP_GIN:
-				target << "GIN | ram[" << opLog[i][2] << "] <= " << opLog[i][3];
-				break;
-			case VC_OP_SOT:
-				target << "SOT | outputDevice(" << opLog[i][2] << ") <= " << opLog[i][3];
-				break;
-		}
+		// RAM addresses from VC_BANK_START on refer to the bank that was selected
+		if(opBank[i] != 0)
+			target << "bank: " << opBank[i] << "   | ";
+
+		VC_trace(target, opLog[i]);
 
 		if(opOverflow == true)
 		{
@@ -711,4 +1840,2716 @@ void VC_updateLog(void)
 	}
 
 	target.close();
-}
\ No newline at end of file
+
+	// Save the input events and debugger edits so this session can be replayed (-replay)
+	std::ofstream events(VC_INPUT_LOG_DIR, std::ios::trunc);
+	for(size_t i = 0; i < VC_inputEvents.size(); i++)
+	{
+		if(VC_inputEvents[i].record)
+			events << "r " << VC_inputEvents[i].count << " " << VC_inputEvents[i].word << " " << VC_inputEvents[i].x << " "
+				   << VC_inputEvents[i].y << "\n";
+		else
+			events << "i " << VC_inputEvents[i].count << " " << VC_inputEvents[i].word << "\n";
+	}
+	for(size_t i = 0; i < VC_edits.size(); i++)
+		events << "e " << VC_edits[i].count << " " << VC_edits[i].target << " " << VC_edits[i].value << "\n";
+	events.close();
+}
+
+// Input from the keyboard and mouse is only accepted at the end of the recorded history, once every recorded
+// event has been sent to the input handler (except events recorded for the current instruction count, so that
+// several callbacks can run between two instructions)
+bool VC_liveInput(void)
+{
+	return VC_instructionCount == VC_historyEnd
+		   && (VC_nextEvent == VC_inputEvents.size() || VC_inputEvents.back().count == VC_instructionCount);
+}
+
+// Record a word for the input handler (VC_step sends it before the next instruction)
+void VC_recordInput(int word)
+{
+	// Multi-core virtual computers aren't recorded, the word goes straight to the input handler
+	if(VC_coreCount > 1)
+	{
+		std::lock_guard<std::mutex> lock(VC_ioMutex);
+		VC_inputHandler(true, word);
+		return;
+	}
+
+	VC_InputEvent event = {VC_instructionCount, word, 0, 0, false};
+	VC_inputEvents.push_back(event);
+	VC_runAheadDue = true;
+}
+
+// Store the current state in a new checkpoint
+void VC_checkpoint(void)
+{
+	VC_TraceScope trace("VC_checkpoint");
+
+	VC_Checkpoint checkpoint;
+	VC_saveState(checkpoint);
+	checkpoint.keyframe = VC_checkpoints.size() % VC_KEYFRAME_PERIOD == 0;
+
+	if(checkpoint.keyframe)
+	{
+		checkpoint.ram.assign(vc.ram, vc.ram + VC_RAM_SIZE);
+		checkpoint.IH_cache.assign(VC_IH_cache, VC_IH_cache + VC_RAM_SIZE);
+	}
+	else
+	{
+		// Pages that weren't written still match the last checkpoint
+		for(int page = 0; page < VC_PAGE_COUNT; page++)
+		{
+			int start = page * VC_PAGE_SIZE;
+			if(VC_dirtyPages & (1u << page))
+			{
+				for(int i = start; i < start + VC_PAGE_SIZE; i++)
+				{
+					if(vc.ram[i] != VC_checkpointRam[i])
+					{
+						checkpoint.ram.push_back(i);
+						checkpoint.ram.push_back(vc.ram[i]);
+					}
+				}
+			}
+			if(VC_dirtyIHPages & (1u << page))
+			{
+				for(int i = start; i < start + VC_PAGE_SIZE; i++)
+				{
+					if(VC_IH_cache[i] != VC_checkpointIHCache[i])
+					{
+						checkpoint.IH_cache.push_back(i);
+						checkpoint.IH_cache.push_back(VC_IH_cache[i]);
+					}
+				}
+			}
+		}
+		checkpoint.ram.shrink_to_fit();
+		checkpoint.IH_cache.shrink_to_fit();
+	}
+
+	for(int page = 0; page < VC_PAGE_COUNT; page++)
+	{
+		int start = page * VC_PAGE_SIZE;
+		if(VC_dirtyPages & (1u << page))
+			std::copy(vc.ram + start, vc.ram + start + VC_PAGE_SIZE, VC_checkpointRam + start);
+		if(VC_dirtyIHPages & (1u << page))
+			std::copy(VC_IH_cache + start, VC_IH_cache + start + VC_PAGE_SIZE, VC_checkpointIHCache + start);
+	}
+
+	// Other processes can write shared RAM without marking pages
+	VC_dirtyPages = VC_sharing ? ~0u : 0;
+	VC_dirtyIHPages = 0;
+
+	// Banks that aren't selected only change when the window is stored in them or by the debugger
+	for(int b = 0; b < VC_BANK_COUNT; b++)
+	{
+		if(!VC_banks[b].empty() && (checkpoint.keyframe || VC_bankDirty[b]))
+		{
+			checkpoint.banks.push_back(b);
+			checkpoint.banks.insert(checkpoint.banks.end(), VC_banks[b].begin(), VC_banks[b].end());
+		}
+	}
+
+	for(size_t i = 0; i < VC_dirtyBanks.size(); i++)
+		VC_bankDirty[VC_dirtyBanks[i]] = false;
+	VC_dirtyBanks.clear();
+
+	VC_checkpoints.push_back(checkpoint);
+}
+
+// Copy the registers and the state of the devices to a checkpoint (everything but RAM, the IH cache and banks)
+void VC_saveState(VC_Checkpoint & checkpoint)
+{
+	checkpoint.count = VC_instructionCount;
+	checkpoint.iar = vc.iar;
+	checkpoint.rA = vc.rA;
+	checkpoint.rB = vc.rB;
+	checkpoint.rC = vc.rC;
+	checkpoint.aluOp = vc.aluOp;
+	checkpoint.flag[0] = vc.flag[0];
+	checkpoint.flag[1] = vc.flag[1];
+	checkpoint.flag[2] = vc.flag[2];
+	checkpoint.IH_cache_stored = VC_IH_cache_stored;
+	checkpoint.IH_cache_pos = VC_IH_cache_pos;
+	checkpoint.OH_SYS_cache = VC_OH_SYS_cache;
+	checkpoint.OH_SYS_cache_stored = VC_OH_SYS_cache_stored;
+	checkpoint.OH_SYS_args[0] = VC_OH_SYS_args[0];
+	checkpoint.OH_SYS_args[1] = VC_OH_SYS_args[1];
+	checkpoint.OH_SYS_argCount = VC_OH_SYS_argCount;
+	checkpoint.OH_MBK_cache = VC_OH_MBK_cache;
+	checkpoint.OH_MBK_cache_stored = VC_OH_MBK_cache_stored;
+	checkpoint.OH_MTH_cache = VC_OH_MTH_cache;
+	checkpoint.OH_MTH_cache_stored = VC_OH_MTH_cache_stored;
+	checkpoint.OH_MEM_cache = VC_OH_MEM_cache;
+	checkpoint.OH_MEM_cache_stored = VC_OH_MEM_cache_stored;
+	std::copy(VC_OH_MEM_args, VC_OH_MEM_args + 3, checkpoint.OH_MEM_args);
+	checkpoint.OH_MEM_argCount = VC_OH_MEM_argCount;
+	checkpoint.OH_INT_cache = VC_OH_INT_cache;
+	checkpoint.OH_INT_cache_stored = VC_OH_INT_cache_stored;
+	checkpoint.interrupts = VC_interrupts;
+	checkpoint.loop = VC_loop;
+	checkpoint.net = VC_net;
+	checkpoint.events = VC_events;
+	checkpoint.audio = VC_audio;
+	checkpoint.eventQueue = VC_eventQueue;
+	checkpoint.cycles = VC_cycleCount;
+	checkpoint.cycleLatch = VC_cycleLatch;
+	checkpoint.clockSpeed = clockSpeed;
+	checkpoint.bank = VC_bank;
+}
+
+// Copy the registers and the state of the devices from a checkpoint
+void VC_loadState(const VC_Checkpoint & checkpoint)
+{
+	VC_bank = checkpoint.bank;
+	VC_instructionCount = checkpoint.count;
+	vc.iar = checkpoint.iar;
+	vc.rA = checkpoint.rA;
+	vc.rB = checkpoint.rB;
+	vc.rC = checkpoint.rC;
+	vc.aluOp = checkpoint.aluOp;
+	vc.flag[0] = checkpoint.flag[0];
+	vc.flag[1] = checkpoint.flag[1];
+	vc.flag[2] = checkpoint.flag[2];
+	VC_IH_cache_stored = checkpoint.IH_cache_stored;
+	VC_IH_cache_pos = checkpoint.IH_cache_pos;
+	VC_OH_SYS_cache = checkpoint.OH_SYS_cache;
+	VC_OH_SYS_cache_stored = checkpoint.OH_SYS_cache_stored;
+	VC_OH_SYS_args[0] = checkpoint.OH_SYS_args[0];
+	VC_OH_SYS_args[1] = checkpoint.OH_SYS_args[1];
+	VC_OH_SYS_argCount = checkpoint.OH_SYS_argCount;
+	VC_OH_MBK_cache = checkpoint.OH_MBK_cache;
+	VC_OH_MBK_cache_stored = checkpoint.OH_MBK_cache_stored;
+	VC_OH_MTH_cache = checkpoint.OH_MTH_cache;
+	VC_OH_MTH_cache_stored = checkpoint.OH_MTH_cache_stored;
+	VC_OH_MEM_cache = checkpoint.OH_MEM_cache;
+	VC_OH_MEM_cache_stored = checkpoint.OH_MEM_cache_stored;
+	std::copy(checkpoint.OH_MEM_args, checkpoint.OH_MEM_args + 3, VC_OH_MEM_args);
+	VC_OH_MEM_argCount = checkpoint.OH_MEM_argCount;
+	VC_OH_INT_cache = checkpoint.OH_INT_cache;
+	VC_OH_INT_cache_stored = checkpoint.OH_INT_cache_stored;
+	VC_interrupts = checkpoint.interrupts;
+	VC_loop = checkpoint.loop;
+	VC_net = checkpoint.net;
+	VC_events = checkpoint.events;
+	VC_cycleCount = checkpoint.cycles;
+	VC_cycleLatch = checkpoint.cycleLatch;
+	VC_audio = checkpoint.audio;
+	VC_eventQueue = checkpoint.eventQueue;
+	clockSpeed = checkpoint.clockSpeed;
+}
+
+// Rebuild RAM and the IH cache stored in a checkpoint (starting from the keyframe before it)
+void VC_buildCheckpoint(size_t index, int * ram, int * IH_cache)
+{
+	size_t keyframe = index - index % VC_KEYFRAME_PERIOD;
+	std::copy(VC_checkpoints[keyframe].ram.begin(), VC_checkpoints[keyframe].ram.end(), ram);
+	std::copy(VC_checkpoints[keyframe].IH_cache.begin(), VC_checkpoints[keyframe].IH_cache.end(), IH_cache);
+
+	for(size_t k = keyframe + 1; k <= index; k++)
+	{
+		const VC_Checkpoint & delta = VC_checkpoints[k];
+		for(size_t i = 0; i < delta.ram.size(); i += 2)
+			ram[delta.ram[i]] = delta.ram[i + 1];
+		for(size_t i = 0; i < delta.IH_cache.size(); i += 2)
+			IH_cache[delta.IH_cache[i]] = delta.IH_cache[i + 1];
+	}
+}
+
+// Return to the state stored in a checkpoint
+void VC_restoreCheckpoint(size_t index)
+{
+	VC_buildCheckpoint(index, vc.ram, VC_IH_cache);
+
+	// RAM no longer matches the last checkpoint, so the next one compares every page
+	VC_dirtyPages = VC_dirtyIHPages = ~0u;
+
+	// Rebuild extended memory
+	for(int b = 0; b < VC_BANK_COUNT; b++)
+		VC_banks[b].clear();
+	for(size_t k = index - index % VC_KEYFRAME_PERIOD; k <= index; k++)
+	{
+		const std::vector<int> & banks = VC_checkpoints[k].banks;
+		for(size_t i = 0; i < banks.size(); i += 1 + VC_BANK_SIZE)
+			VC_banks[banks[i]].assign(banks.begin() + i + 1, banks.begin() + i + 1 + VC_BANK_SIZE);
+	}
+
+	// Banks written to from here on are stored by the next checkpoint
+	for(size_t i = 0; i < VC_dirtyBanks.size(); i++)
+		VC_bankDirty[VC_dirtyBanks[i]] = false;
+	VC_dirtyBanks.clear();
+
+	const VC_Checkpoint & checkpoint = VC_checkpoints[index];
+	VC_loadState(checkpoint);
+
+	// Events that arrived and edits that were made before the checkpoint are part of its state
+	VC_nextEvent = 0;
+	while(VC_nextEvent < VC_inputEvents.size() && VC_inputEvents[VC_nextEvent].count < checkpoint.count)
+		VC_nextEvent += 1;
+
+	VC_nextEdit = 0;
+	while(VC_nextEdit < VC_edits.size() && VC_edits[VC_nextEdit].count < checkpoint.count)
+		VC_nextEdit += 1;
+
+	// The operation log restarts at the checkpoint
+	opCount = 0;
+	opOverflow = false;
+}
+
+// Move to an instruction count by restoring the checkpoint before it and executing the instructions in between
+void VC_seek(long long count)
+{
+	VC_TraceScope trace("VC_seek");
+
+	if(count < 0)
+		count = 0;
+
+	if(count <= VC_historyEnd)
+	{
+		size_t index = std::min((size_t)(count / VC_CHECKPOINT_PERIOD), VC_checkpoints.size() - 1);
+		if(count < VC_instructionCount || VC_checkpoints[index].count > VC_instructionCount)
+			VC_restoreCheckpoint(index);
+	}
+
+	while(VC_instructionCount < count)
+		VC_step();
+}
+
+// Find the last instruction before the current instruction count that was executed at a breakpoint (address is
+// -1) or that wrote to ram[address]. The search replays one checkpoint period at a time, newest first.
+// Returns the instruction count of that instruction, or -1 if there is none.
+long long VC_searchBack(int address)
+{
+	long long end = VC_instructionCount,
+			  found = -1;
+
+	if(end == 0)
+		return -1;
+
+	for(size_t index = std::min((size_t)((end - 1) / VC_CHECKPOINT_PERIOD), VC_checkpoints.size() - 1); ; index--)
+	{
+		VC_restoreCheckpoint(index);
+		while(VC_instructionCount < end)
+		{
+			long long count = VC_instructionCount;
+			int word = vc.ram[vc.iar],
+				oldValue = (address < 0) ? 0 : vc.ram[address];
+			bool atBreakpoint = VC_testBit(VC_breakpointBits, vc.iar) && !VC_interrupts.waiting;
+
+			VC_step();
+
+			if(address < 0)
+			{
+				if(atBreakpoint)
+					found = count;
+			}
+			else if(vc.ram[address] != oldValue
+					|| (word % 4096 == address && VC_ISA[word >> 12].operand == VC_OPERAND_WRITE))
+			{
+				found = count;
+			}
+		}
+
+		if(found != -1 || index == 0)
+			break;
+		end = VC_checkpoints[index].count;
+	}
+
+	return found;
+}
+
+// Read debug console commands (runs on its own thread)
+void VC_consoleThread(void)
+{
+	VC_traceThreadName = "Debug console";
+	std::string line;
+	while(std::getline(std::cin, line))
+	{
+		VC_consoleMutex.lock();
+		VC_consoleCommands.push_back(line);
+		VC_commandsPending = true;
+		VC_consoleMutex.unlock();
+	}
+}
+
+// Run a debug console command
+	// pause                    Stop executing instructions
+	// continue                 Start executing instructions again
+	// step [n]                 Execute n instructions (default 1)
+	// rstep [n]                Go back n instructions (default 1)
+	// rcontinue                Go back to the last instruction executed at a breakpoint
+	// goto <count>             Go to an instruction count (forwards or backwards)
+	// lastwrite <address>      Go back to the last instruction that wrote to ram[address]
+	// break <address>          Pause before executing the instruction at an address
+	// delete <address>         Remove a breakpoint
+	// watch <address>          Pause after an instruction writes to an address
+	// rwatch <address>         Pause after an instruction reads from an address
+	// unwatch <address>        Remove the watchpoints at an address
+	// set <register> <value>   Change a register (iar, rA, rB, rC, aluOp or flags)
+	// poke <address> <value>   Change a word in RAM
+	// peek <address> [n]       Show n words of RAM (default 1)
+		// poke and peek also take <bank>:<address> for addresses from VC_BANK_START on
+	// state                    Show the registers and instruction count
+	// trace on|off             Start or stop the timeline trace (stopping writes the trace file)
+void VC_runCommand(const std::string & command)
+{
+	std::istringstream tokens(command);
+	std::string name,
+				argument;
+	long long value = -1,
+			  value2 = -1;
+	tokens >> name >> argument >> value2;
+	std::istringstream(argument) >> value;
+
+	if(name.empty())
+		return;
+
+	bool isAddress = value >= 0 && value < VC_RAM_SIZE;
+
+	if(name == "pause")
+		VC_paused = true;
+	else if(name == "continue")
+		VC_resume();
+	else if(name == "step")
+	{
+		VC_paused = true;
+		VC_seek(VC_instructionCount + (value < 1 ? 1 : value));
+	}
+	else if(name == "rstep")
+	{
+		VC_paused = true;
+		VC_seek(VC_instructionCount - (value < 1 ? 1 : value));
+	}
+	else if(name == "rcontinue")
+	{
+		VC_paused = true;
+		long long found = VC_searchBack(-1);
+		VC_seek(found < 0 ? 0 : found);
+	}
+	else if(name == "goto" && value >= 0)
+	{
+		VC_paused = true;
+		VC_seek(value);
+	}
+	else if(name == "lastwrite" && isAddress)
+	{
+		VC_paused = true;
+		long long start = VC_instructionCount,
+				  found = VC_searchBack(value);
+		if(found < 0)
+		{
+			std::cout << "No instruction wrote to ram[" << value << "]" << std::endl;
+			VC_seek(start);
+		}
+		else
+		{
+			VC_seek(found);
+			std::cout << "ram[" << value << "] was last written by the instruction at iar " << vc.iar << std::endl;
+		}
+	}
+	else if((name == "break" || name == "delete") && isAddress)
+		VC_setBit(VC_breakpointBits, value, name == "break");
+	else if(name == "watch" && isAddress)
+		VC_setBit(VC_watchWriteBits, value, true);
+	else if(name == "rwatch" && isAddress)
+		VC_setBit(VC_watchReadBits, value, true);
+	else if(name == "unwatch" && isAddress)
+	{
+		VC_setBit(VC_watchWriteBits, value, false);
+		VC_setBit(VC_watchReadBits, value, false);
+	}
+	else if(name == "set" && value2 >= 0)
+	{
+		int reg = 0;
+		while(reg < VC_REG_COUNT && argument != VC_REG_NAMES[reg])
+			reg++;
+
+		if(reg == VC_REG_COUNT)
+		{
+			std::cout << "Error: Unknown register '" << argument << "'" << std::endl;
+			return;
+		}
+
+		VC_edit(VC_RAM_SIZE + reg, value2);
+	}
+	else if(name == "poke" && value2 >= 0)
+	{
+		int bank,
+			address;
+		if(!VC_parseAddress(argument, bank, address))
+		{
+			std::cout << "Error: Invalid address '" << argument << "'" << std::endl;
+			return;
+		}
+
+		if(bank == VC_bank)
+			VC_edit(address, value2);
+		else
+			VC_edit(VC_EDIT_BANKS + bank * VC_BANK_SIZE + address - VC_BANK_START, value2);
+	}
+	else if(name == "peek")
+	{
+		int bank,
+			address;
+		if(!VC_parseAddress(argument, bank, address))
+		{
+			std::cout << "Error: Invalid address '" << argument << "'" << std::endl;
+			return;
+		}
+
+		for(int i = address; i < address + (value2 < 1 ? 1 : value2) && i < VC_RAM_SIZE; i++)
+		{
+			if(i >= VC_BANK_START)
+				std::cout << "ram[" << bank << ":" << i << "] = " << VC_bankWord(bank, i) << std::endl;
+			else
+				std::cout << "ram[" << i << "] = " << vc.ram[i] << std::endl;
+		}
+		return;
+	}
+	else if(name == "trace" && (argument == "on" || argument == "off"))
+	{
+		if(argument == "on")
+			VC_startTrace();
+		else
+			VC_stopTrace();
+		return;
+	}
+	else if(name != "state")
+	{
+		std::cout << "Error: Unknown command '" << command << "'" << std::endl;
+		return;
+	}
+
+	VC_printState();
+}
+
+// Show the registers and instruction count on the debug console
+void VC_printState(void)
+{
+	std::cout << "count: " << VC_instructionCount << "   | iar: " << vc.iar << "   | rA: " << vc.rA << "   | rB: " << vc.rB
+			  << "   | rC: " << vc.rC << "   | aluOp: " << vc.aluOp << "   | flags: " << vc.flag[0] << vc.flag[1] << vc.flag[2]
+			  << "   | bank: " << VC_bank << (VC_interrupts.waiting ? "   | waiting" : "") << (VC_paused ? "   | paused" : "")
+			  << std::endl;
+}
+
+// Execute one instruction, pausing at breakpoints and watchpoints
+	// Only used while a breakpoint or watchpoint is set so that VC_step doesn't have to check for them
+void VC_debugStep(void)
+{
+	if(VC_testBit(VC_breakpointBits, vc.iar) && !VC_ignoreBreakpoint)
+	{
+		VC_stop("Breakpoint at iar " + std::to_string(vc.iar));
+		return;
+	}
+	VC_ignoreBreakpoint = false;
+
+	int opCode = vc.ram[vc.iar] >> 12,
+		operand = vc.ram[vc.iar] % 4096;
+
+	bool reads = VC_ISA[opCode].operand == VC_OPERAND_READ,
+		 writes = VC_ISA[opCode].operand == VC_OPERAND_WRITE;
+
+	VC_step();
+
+	if(reads && VC_testBit(VC_watchReadBits, operand))
+		VC_stop("Watchpoint: ram[" + std::to_string(operand) + "] was read");
+	else if(writes && VC_testBit(VC_watchWriteBits, operand))
+		VC_stop("Watchpoint: ram[" + std::to_string(operand) + "] = " + std::to_string(vc.ram[operand]));
+}
+
+bool VC_testBit(const uint64_t * bits, int address)
+{
+	return (bits[address >> 6] >> (address & 63)) & 1;
+}
+
+// Set or clear a bit in a breakpoint or watchpoint bitmap
+void VC_setBit(uint64_t * bits, int address, bool value)
+{
+	if(VC_testBit(bits, address) != value)
+		VC_debugBitCount += value ? 1 : -1;
+
+	if(value)
+		bits[address >> 6] |= (uint64_t)1 << (address & 63);
+	else
+		bits[address >> 6] &= ~((uint64_t)1 << (address & 63));
+}
+
+// Pause the virtual computer and report why to the debug console and GDB
+void VC_stop(const std::string & reason)
+{
+	VC_paused = true;
+	std::cout << reason << std::endl;
+	VC_printState();
+
+	if(VC_gdbRunning)
+	{
+		VC_gdbRunning = false;
+		VC_gdbSend("S05"); // SIGTRAP
+	}
+}
+
+// Start executing instructions again (without stopping at the breakpoint the virtual computer is paused at)
+void VC_resume(void)
+{
+	VC_paused = false;
+	VC_ignoreBreakpoint = VC_testBit(VC_breakpointBits, vc.iar);
+}
+
+int VC_getRegister(int reg)
+{
+	switch(reg)
+	{
+		case VC_REG_IAR:
+			return vc.iar;
+		case VC_REG_RA:
+			return vc.rA;
+		case VC_REG_RB:
+			return vc.rB;
+		case VC_REG_RC:
+			return vc.rC;
+		case VC_REG_ALU_OP:
+			return vc.aluOp;
+		case VC_REG_FLAGS:
+			return vc.flag[0] | vc.flag[1] << 1 | vc.flag[2] << 2;
+	}
+
+	return 0;
+}
+
+void VC_setRegister(int reg, int value)
+{
+	value &= 65535;
+
+	switch(reg)
+	{
+		case VC_REG_IAR:
+			vc.iar = value % VC_RAM_SIZE;
+			break;
+		case VC_REG_RA:
+			vc.rA = value;
+			break;
+		case VC_REG_RB:
+			vc.rB = value;
+			break;
+		case VC_REG_RC:
+			vc.rC = value;
+			break;
+		case VC_REG_ALU_OP:
+			vc.aluOp = value;
+			break;
+		case VC_REG_FLAGS:
+			vc.flag[0] = value & 1;
+			vc.flag[1] = (value >> 1) & 1;
+			vc.flag[2] = (value >> 2) & 1;
+			break;
+	}
+}
+
+// Change RAM or a register from the debugger
+	// The change is recorded so that replaying the history reaches the same state
+void VC_edit(int target, int value)
+{
+	VC_truncateHistory();
+
+	VC_EditEvent edit = {VC_instructionCount, target, value};
+	VC_edits.push_back(edit);
+
+	VC_applyEdit(target, value);
+
+	// Edits of registers and of banks that aren't selected are recorded without an address
+	if(VC_execTrace.is_open())
+	{
+		int address = -1;
+		if(target < VC_RAM_SIZE)
+			address = target;
+		else if(target >= VC_EDIT_BANKS && (target - VC_EDIT_BANKS) / VC_BANK_SIZE == VC_bank)
+			address = VC_BANK_START + (target - VC_EDIT_BANKS) % VC_BANK_SIZE;
+		VC_execAt = vc.iar; // The edit is made before this instruction
+		VC_execWord = vc.ram[vc.iar];
+		VC_recordExec(VC_EXEC_EDIT, address);
+	}
+}
+
+void VC_applyEdit(int target, int value)
+{
+	if(target < VC_RAM_SIZE)
+	{
+		vc.ram[target] = value & 65535;
+		VC_markPages(target, 1);
+	}
+	else if(target < VC_EDIT_BANKS)
+		VC_setRegister(target - VC_RAM_SIZE, value);
+	else // A word in a bank of extended memory
+		VC_setBankWord((target - VC_EDIT_BANKS) / VC_BANK_SIZE, VC_BANK_START + (target - VC_EDIT_BANKS) % VC_BANK_SIZE, value & 65535);
+}
+
+// Forget the history after the current instruction count (an edit made in the past changes everything after it)
+void VC_truncateHistory(void)
+{
+	if(VC_instructionCount == VC_historyEnd)
+		return;
+
+	VC_historyEnd = VC_instructionCount;
+
+	while(VC_checkpoints.back().count > VC_instructionCount)
+		VC_checkpoints.pop_back();
+	while(!VC_inputEvents.empty() && VC_inputEvents.back().count > VC_instructionCount)
+		VC_inputEvents.pop_back();
+	while(!VC_edits.empty() && VC_edits.back().count > VC_instructionCount)
+		VC_edits.pop_back();
+
+	// The next checkpoint stores the words that changed since the last remaining checkpoint
+	VC_buildCheckpoint(VC_checkpoints.size() - 1, VC_checkpointRam, VC_checkpointIHCache);
+
+	VC_truncateExecTrace();
+}
+
+// Start the GDB remote serial protocol server
+	// Only connections from this computer are accepted
+bool VC_gdbListen(int port)
+{
+#ifdef _WIN32
+	WSADATA wsaData;
+	if(WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+		return false;
+#endif
+
+	VC_gdbServer = socket(AF_INET, SOCK_STREAM, 0);
+	if(VC_gdbServer == INVALID_SOCKET)
+		return false;
+
+	int reuse = 1;
+	setsockopt(VC_gdbServer, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof(reuse));
+
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if(bind(VC_gdbServer, (sockaddr *)&address, sizeof(address)) != 0 || listen(VC_gdbServer, 1) != 0)
+		return false;
+
+	std::thread(VC_gdbThread).detach();
+	return true;
+}
+
+// Accept GDB connections and read packets (runs on its own thread)
+	// Packets are acknowledged here and handled by VC_main
+void VC_gdbThread(void)
+{
+	VC_traceThreadName = "GDB";
+
+	while(true)
+	{
+		SOCKET client = accept(VC_gdbServer, NULL, NULL);
+		if(client == INVALID_SOCKET)
+			return;
+
+		VC_gdbClient = client;
+		VC_queueGdbPacket("\x03"); // Pause the virtual computer when GDB attaches
+
+		std::string data;
+		char buffer[4096];
+		int received;
+		while((received = recv(client, buffer, sizeof(buffer), 0)) > 0)
+		{
+			data.append(buffer, received);
+
+			while(!data.empty())
+			{
+				if(data[0] == '\x03') // Interrupt
+				{
+					VC_queueGdbPacket("\x03");
+					data.erase(0, 1);
+				}
+				else if(data[0] == '$') // Packet ($data#checksum)
+				{
+					size_t end = data.find('#');
+					if(end == std::string::npos && data.size() > VC_GDB_PACKET_SIZE)
+					{
+						data.clear(); // Drop packets longer than the size given in qSupported
+						break;
+					}
+					if(end == std::string::npos || end + 2 >= data.size())
+						break; // Wait for the rest of the packet
+
+					send(client, "+", 1, 0);
+					VC_queueGdbPacket(data.substr(1, end - 1));
+					data.erase(0, end + 3);
+				}
+				else // Acknowledgements
+				{
+					data.erase(0, 1);
+				}
+			}
+		}
+
+		// Resume the virtual computer when GDB disconnects
+		VC_gdbClient = INVALID_SOCKET;
+		closesocket(client);
+		VC_queueGdbPacket("D");
+	}
+}
+
+void VC_queueGdbPacket(const std::string & packet)
+{
+	VC_consoleMutex.lock();
+	VC_gdbPackets.push_back(packet);
+	VC_commandsPending = true;
+	VC_consoleMutex.unlock();
+}
+
+// Handle a GDB packet
+	// Registers are sent as 16 bit little endian values
+	// GDB addresses bytes, so iar and RAM addresses are doubled (each word is stored low byte first)
+	// Extended memory starts at VC_GDB_BANKS (bank n starts at VC_GDB_BANKS + n * VC_BANK_SIZE * 2)
+void VC_gdbPacket(const std::string & packet)
+{
+	std::string reply;
+	unsigned long address = 0,
+				  length = 0;
+	char hex[8];
+
+	switch(packet[0])
+	{
+		case '\x03': // Interrupt
+			VC_paused = true;
+			if(!VC_gdbRunning)
+				return;
+			VC_gdbRunning = false;
+			reply = "S02"; // SIGINT
+			break;
+		case '?': // Reason for stopping
+			VC_paused = true;
+			reply = "S05";
+			break;
+		case 'g': // Read registers
+			for(int reg = 0; reg < VC_REG_COUNT; reg++)
+			{
+				int value = VC_getRegister(reg) * (reg == VC_REG_IAR ? 2 : 1);
+				std::snprintf(hex, sizeof(hex), "%02x%02x", value & 255, (value >> 8) & 255);
+				reply += hex;
+			}
+			break;
+		case 'G': // Write registers
+		{
+			// Every value is checked before any register is written
+			int values[VC_REG_COUNT],
+				count = std::min((int)(packet.size() - 1) / 4, VC_REG_COUNT);
+			reply = "OK";
+			for(int reg = 0; reg < count; reg++)
+			{
+				int low = VC_hexByte(packet, 1 + 4 * reg),
+					high = VC_hexByte(packet, 3 + 4 * reg);
+				if(low < 0 || high < 0)
+				{
+					reply = "E01";
+					break;
+				}
+				values[reg] = low + high * 256;
+			}
+
+			for(int reg = 0; reg < count && reply == "OK"; reg++)
+				VC_edit(VC_RAM_SIZE + reg, values[reg] / (reg == VC_REG_IAR ? 2 : 1));
+			break;
+		}
+		case 'p': // Read a register
+			std::sscanf(packet.c_str(), "p%lx", &address);
+			if(address < (unsigned long)VC_REG_COUNT)
+			{
+				int value = VC_getRegister(address) * (address == VC_REG_IAR ? 2 : 1);
+				std::snprintf(hex, sizeof(hex), "%02x%02x", value & 255, (value >> 8) & 255);
+				reply = hex;
+			}
+			else
+			{
+				reply = "E01";
+			}
+			break;
+		case 'P': // Write a register
+		{
+			size_t equals = packet.find('=');
+			std::sscanf(packet.c_str(), "P%lx", &address);
+			int low = (equals == std::string::npos) ? -1 : VC_hexByte(packet, equals + 1),
+				high = (equals == std::string::npos) ? -1 : VC_hexByte(packet, equals + 3);
+			if(address < (unsigned long)VC_REG_COUNT && low >= 0 && high >= 0)
+			{
+				VC_edit(VC_RAM_SIZE + address, (low + high * 256) / (address == VC_REG_IAR ? 2 : 1));
+				reply = "OK";
+			}
+			else
+			{
+				reply = "E01";
+			}
+			break;
+		}
+		case 'm': // Read RAM
+			std::sscanf(packet.c_str(), "m%lx,%lx", &address, &length);
+			length = std::min(length, VC_GDB_PACKET_SIZE / 2); // Two hex digits are sent for each byte
+			for(unsigned long i = address; i - address < length; i++)
+			{
+				int word;
+				if(i >= VC_GDB_BANKS) // Extended memory
+				{
+					unsigned long index = ((i - VC_GDB_BANKS) / 2) % (VC_BANK_COUNT * VC_BANK_SIZE);
+					word = VC_bankWord(index / VC_BANK_SIZE, VC_BANK_START + index % VC_BANK_SIZE);
+				}
+				else
+				{
+					word = vc.ram[(i / 2) % VC_RAM_SIZE];
+				}
+				std::snprintf(hex, sizeof(hex), "%02x", (i % 2 == 0) ? word & 255 : (word >> 8) & 255);
+				reply += hex;
+			}
+			break;
+		case 'M': // Write RAM
+		{
+			size_t colon = packet.find(':');
+			std::sscanf(packet.c_str(), "M%lx,%lx", &address, &length);
+
+			// Every byte is checked before any is written
+			bool valid = colon != std::string::npos && length <= (packet.size() - colon - 1) / 2;
+			for(unsigned long i = 0; i < length && valid; i++)
+				valid = VC_hexByte(packet, colon + 1 + 2 * i) >= 0;
+			if(!valid)
+			{
+				reply = "E01";
+				break;
+			}
+
+			for(unsigned long i = 0; i < length; i++)
+			{
+				int byte = VC_hexByte(packet, colon + 1 + 2 * i),
+					target = ((address + i) / 2) % VC_RAM_SIZE,
+					word;
+
+				if(address + i >= VC_GDB_BANKS) // Extended memory
+				{
+					unsigned long index = ((address + i - VC_GDB_BANKS) / 2) % (VC_BANK_COUNT * VC_BANK_SIZE);
+					target = VC_EDIT_BANKS + index;
+					word = VC_bankWord(index / VC_BANK_SIZE, VC_BANK_START + index % VC_BANK_SIZE);
+				}
+				else
+				{
+					word = vc.ram[target];
+				}
+
+				if((address + i) % 2 == 0)
+					word = (word & 0xFF00) | byte;
+				else
+					word = (word & 0x00FF) | byte << 8;
+
+				VC_edit(target, word);
+			}
+			reply = "OK";
+			break;
+		}
+		case 'c': // Continue (the stop reply is sent by VC_stop)
+			VC_resume();
+			VC_gdbRunning = true;
+			return;
+		case 's': // Step
+			VC_step();
+			VC_paused = true;
+			reply = "S05";
+			break;
+		case 'b': // Reverse continue and reverse step
+			VC_paused = true;
+			if(packet == "bc")
+			{
+				long long found = VC_searchBack(-1);
+				VC_seek(found < 0 ? 0 : found);
+				reply = (found < 0) ? "T05replaylog:begin;" : "S05";
+			}
+			else if(packet == "bs")
+			{
+				reply = (VC_instructionCount == 0) ? "T05replaylog:begin;" : "S05";
+				VC_seek(VC_instructionCount - 1);
+			}
+			break;
+		case 'Z': // Insert a breakpoint or watchpoint
+		case 'z': // Remove a breakpoint or watchpoint
+		{
+			int type = -1;
+			std::sscanf(packet.c_str() + 1, "%d,%lx,%lx", &type, &address, &length);
+
+			unsigned long first = address / 2,
+						  last = (address + (length == 0 ? 1 : length) - 1) / 2;
+
+			if(type < 0 || type > 4 || last >= (unsigned long)VC_RAM_SIZE)
+				break;
+
+			for(unsigned long i = first; i <= ((type <= 1) ? first : last); i++)
+			{
+				if(type <= 1) // Software and hardware breakpoints
+					VC_setBit(VC_breakpointBits, i, packet[0] == 'Z');
+				if(type == 2 || type == 4) // Write and access watchpoints
+					VC_setBit(VC_watchWriteBits, i, packet[0] == 'Z');
+				if(type == 3 || type == 4) // Read and access watchpoints
+					VC_setBit(VC_watchReadBits, i, packet[0] == 'Z');
+			}
+			reply = "OK";
+			break;
+		}
+		case 'q': // Queries
+			if(packet.compare(0, 10, "qSupported") == 0)
+			{
+				char supported[80];
+				std::snprintf(supported, sizeof(supported), "PacketSize=%lx;qXfer:features:read+;ReverseStep+;ReverseContinue+", VC_GDB_PACKET_SIZE);
+				reply = supported;
+			}
+			else if(packet == "qAttached")
+				reply = "1";
+			else if(packet.compare(0, 31, "qXfer:features:read:target.xml:") == 0)
+			{
+				std::string xml = VC_GDB_TARGET_XML;
+				std::sscanf(packet.c_str() + 31, "%lx,%lx", &address, &length);
+				if(address >= xml.size())
+					reply = "l";
+				else
+					reply = ((address + length < xml.size()) ? "m" : "l") + xml.substr(address, length);
+			}
+			break;
+		case 'H': // Select a thread (there is only one)
+			reply = "OK";
+			break;
+		case 'D': // Detach
+			VC_gdbRunning = false;
+			VC_resume();
+			reply = "OK";
+			break;
+		case 'k': // Kill (the virtual computer keeps running without GDB)
+			VC_gdbRunning = false;
+			VC_resume();
+			return;
+	}
+
+	VC_gdbSend(reply);
+}
+
+// Send a GDB packet ($data#checksum)
+void VC_gdbSend(const std::string & data)
+{
+	SOCKET client = VC_gdbClient.load();
+	if(client == INVALID_SOCKET)
+		return;
+
+	int checksum = 0;
+	for(size_t i = 0; i < data.size(); i++)
+		checksum += (unsigned char)data[i];
+
+	char hex[4];
+	std::snprintf(hex, sizeof(hex), "%02x", checksum & 255);
+
+	std::string packet = "$" + data + "#" + hex;
+	send(client, packet.c_str(), packet.size(), 0);
+}
+
+// Read a byte written as two hex digits in a GDB packet (-1 if the packet ends or a character isn't a hex digit)
+int VC_hexByte(const std::string & packet, size_t position)
+{
+	int value = 0;
+	for(size_t i = position; i < position + 2; i++)
+	{
+		char c = (i < packet.size()) ? packet[i] : 0;
+		if(c >= '0' && c <= '9')
+			value = value * 16 + c - '0';
+		else if(c >= 'a' && c <= 'f')
+			value = value * 16 + c - 'a' + 10;
+		else if(c >= 'A' && c <= 'F')
+			value = value * 16 + c - 'A' + 10;
+		else
+			return -1;
+	}
+	return value;
+}
+
+// Seconds since an arbitrary point in time (used for metrics)
+double VC_seconds(void)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void VC_observe(VC_Histogram & histogram, double value)
+{
+	int bucket = 0;
+	while(bucket < VC_HISTOGRAM_BUCKETS && value > VC_HISTOGRAM_BOUNDS[bucket])
+		bucket++;
+
+	histogram.buckets[bucket] += 1;
+	histogram.count += 1;
+	histogram.sum += value;
+}
+
+void VC_writeHistogram(std::ofstream & target, const char * name, const char * help, const VC_Histogram & histogram)
+{
+	target << "# HELP " << name << " " << help << "\n";
+	target << "# TYPE " << name << " histogram\n";
+
+	long long cumulative = 0;
+	for(int i = 0; i < VC_HISTOGRAM_BUCKETS; i++)
+	{
+		cumulative += histogram.buckets[i];
+		target << name << "_bucket{le=\"" << VC_HISTOGRAM_BOUNDS[i] << "\"} " << cumulative << "\n";
+	}
+	target << name << "_bucket{le=\"+Inf\"} " << histogram.count << "\n";
+	target << name << "_sum " << histogram.sum << "\n";
+	target << name << "_count " << histogram.count << "\n";
+}
+
+// Write the metrics file in the Prometheus text format
+	// The file is written under a temporary name and then renamed so that readers never see a partial file
+void VC_writeMetrics(void)
+{
+	std::string temporaryPath = VC_metricsPath + ".tmp";
+	std::ofstream target(temporaryPath, std::ios::trunc);
+	if(!target.is_open())
+	{
+		std::cout << "Error: Metrics file failed to open" << std::endl;
+		return;
+	}
+
+	// Cores of a multi-core virtual computer count their own instructions
+	long long instructions = 0,
+			  opCounts[16];
+	for(int i = 0; i < 16; i++)
+	{
+		opCounts[i] = VC_metricOpCounts[i];
+		for(int c = 0; c < VC_coreCount && VC_coreCount > 1; c++)
+			opCounts[i] += VC_cores[c].opCounts[i].load(std::memory_order_relaxed);
+		instructions += opCounts[i];
+	}
+
+	target << "# HELP vc_instructions_total Instructions executed by every core (including instructions replayed by the debugger).\n";
+	target << "# TYPE vc_instructions_total counter\n";
+	target << "vc_instructions_total " << instructions << "\n";
+
+	target << "# HELP vc_opcode_instructions_total Instructions executed per op-code.\n";
+	target << "# TYPE vc_opcode_instructions_total counter\n";
+	for(int i = 0; i < 16; i++)
+		target << "vc_opcode_instructions_total{opcode=\"" << VC_ISA[i].mnemonic << "\"} " << opCounts[i] << "\n";
+
+	target << "# HELP vc_instructions_per_second Instructions executed in the last second.\n";
+	target << "# TYPE vc_instructions_per_second gauge\n";
+	target << "vc_instructions_per_second " << VC_lastIps << "\n";
+
+	if(VC_timingEnabled)
+	{
+		target << "# HELP vc_cycles_total Clock cycles counted by the timing model.\n";
+		target << "# TYPE vc_cycles_total counter\n";
+		target << "vc_cycles_total " << VC_cycleCount << "\n";
+	}
+
+	target << "# HELP vc_clock_speed_hertz Target clock speed (above 1000 means no delay between instructions).\n";
+	target << "# TYPE vc_clock_speed_hertz gauge\n";
+	target << "vc_clock_speed_hertz " << clockSpeed << "\n";
+
+	target << "# HELP vc_paused Whether the debugger has paused the virtual computer.\n";
+	target << "# TYPE vc_paused gauge\n";
+	target << "vc_paused " << (VC_paused ? 1 : 0) << "\n";
+
+	target << "# HELP vc_input_queue_depth Words waiting in the IH cache.\n";
+	target << "# TYPE vc_input_queue_depth gauge\n";
+	target << "vc_input_queue_depth " << VC_IH_cache_stored << "\n";
+
+	target << "# HELP vc_input_words_total Words written to the IH.\n";
+	target << "# TYPE vc_input_words_total counter\n";
+	target << "vc_input_words_total " << VC_metricInputWords << "\n";
+
+	target << "# HELP vc_input_dropped_total Words overwritten in the IH cache before being read.\n";
+	target << "# TYPE vc_input_dropped_total counter\n";
+	target << "vc_input_dropped_total " << VC_metricInputDrops << "\n";
+
+	target << "# HELP vc_audio_dropped_samples_total Audio samples dropped because the audio file couldn't be written fast enough.\n";
+	target << "# TYPE vc_audio_dropped_samples_total counter\n";
+	target << "vc_audio_dropped_samples_total " << VC_audioDrops << "\n";
+
+	target << "# HELP vc_output_calls_total SOT instructions per output device (device 15 also counts higher devices).\n";
+	target << "# TYPE vc_output_calls_total counter\n";
+	for(int i = 0; i < VC_METRIC_DEVICES; i++)
+	{
+		if(VC_metricOutputCalls[i] != 0)
+			target << "vc_output_calls_total{device=\"" << i << "\"} " << VC_metricOutputCalls[i] << "\n";
+	}
+
+	VC_writeHistogram(target, "vc_frame_render_seconds", "Time taken to draw the screen.", VC_frameTime);
+	VC_writeHistogram(target, "vc_timer_jitter_seconds", "Difference between the actual and expected time between instructions.", VC_timerJitter);
+	VC_writeHistogram(target, "vc_input_latency_seconds", "Time between a word being written to the IH and a GIN instruction reading it.", VC_inputLatency);
+
+	target.close();
+
+	std::remove(VC_metricsPath.c_str()); // rename doesn't replace existing files on Windows
+	std::rename(temporaryPath.c_str(), VC_metricsPath.c_str());
+}
+
+// Copy RAM to the shared RAM and start the cores of a multi-core virtual computer
+	// Core n starts at ram[n] with its other registers set to 0 (zero), so a program for several cores starts with
+	// a table of JMP instructions (GIN always writes to RAM, so cores that share code would share those words)
+void VC_startCores(void)
+{
+	for(int i = 0; i < VC_RAM_SIZE; i++)
+		VC_sharedRam[i] = vc.ram[i];
+
+	for(int i = 0; i < VC_coreCount; i++)
+	{
+		VC_Core & core = VC_cores[i];
+		core.ram = VC_sharedRam;
+		core.iar = i;
+		core.rA = core.rB = core.rC = core.aluOp = 0;
+		core.flag[0] = core.flag[1] = core.flag[2] = false;
+		core.id = i;
+		core.replyCount = 0;
+		core.sysArgCount = 0;
+		core.sysCacheStored = false;
+		core.mthCacheStored = false;
+		core.instructions = 0;
+		for(int op = 0; op < 16; op++)
+			core.opCounts[op] = 0;
+	}
+
+	// With -interleave, VC_main runs the cores instead
+	if(!VC_interleave)
+	{
+		for(int i = 0; i < VC_coreCount; i++)
+			VC_coreThreads.push_back(std::thread(VC_coreThread, &VC_cores[i]));
+	}
+}
+
+void VC_stopCores(void)
+{
+	VC_coresStopped = true;
+	for(size_t i = 0; i < VC_coreThreads.size(); i++)
+		VC_coreThreads[i].join();
+	VC_coreThreads.clear();
+}
+
+// Run one core on its own host thread
+	// Each core runs at the clock speed (without a delay if clockSpeed > 1000, like VC_main)
+void VC_coreThread(VC_Core * core)
+{
+	VC_CoreIO io = {core};
+	long long opCounts[16] = {0}; // Counted here and added to the atomic counts of the core after each batch
+
+	while(!VC_coresStopped)
+	{
+		int speed = clockSpeed;
+		if(speed > 1000)
+		{
+			for(int i = 0; i < VC_CORE_BATCH; i++)
+			{
+				VC_execute(*core, io, core->log);
+				opCounts[core->log[1]] += 1;
+			}
+			core->instructions += VC_CORE_BATCH;
+		}
+		else
+		{
+			VC_execute(*core, io, core->log);
+			opCounts[core->log[1]] += 1;
+			core->instructions += 1;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1000 / (speed < 1 ? 1 : speed)));
+		}
+
+		for(int op = 0; op < 16; op++)
+		{
+			if(opCounts[op] != 0)
+			{
+				core->opCounts[op].fetch_add(opCounts[op], std::memory_order_relaxed);
+				opCounts[op] = 0;
+			}
+		}
+	}
+}
+
+// SYS device operations for one core of a multi-core virtual computer
+	// These work like the SYS operations in VC_outputHandler, except that replies go to the reply stack of the
+	// core and the operations take effect on the shared RAM
+	// 0                                      Send the clock speed
+	// 1 <speed>                              Set the clock speed
+	// 3                                      Shut down the computer
+	// 4                                      Send the core ID (0 to the number of cores - 1)
+	// 5                                      Send the number of cores
+	// 6 <address>                            Test-and-set: ram[address] = 1, send the old value
+	// 7 <address> <expected> <desired>       Compare-exchange: if ram[address] == expected then ram[address] = desired, send the old value
+	// Operation 8 (wait for an interrupt) isn't supported since interrupts are only delivered to single core computers
+	// Values sent by SOT are 12 bit operands, so expected and desired values are between 0 and 4095
+void VC_coreSys(VC_Core & core, int operand)
+{
+	int reply = -1;
+
+	if(!core.sysCacheStored)
+	{
+		switch(operand)
+		{
+			case 0:
+				reply = clockSpeed;
+				break;
+			case 1:
+			case 6:
+			case 7:
+				core.sysCache = operand;
+				core.sysCacheStored = true;
+				core.sysArgCount = 0;
+				break;
+			case 3:
+				VC_shutdown = true;
+				break;
+			case 4:
+				reply = core.id;
+				break;
+			case 5:
+				reply = VC_coreCount;
+				break;
+		}
+	}
+	else
+	{
+		bool complete = true;
+		switch(core.sysCache)
+		{
+			case 1:
+				clockSpeed = operand;
+				break;
+			case 6:
+				reply = VC_testAndSet(core.ram[operand]);
+				break;
+			case 7:
+				if(core.sysArgCount < 2)
+				{
+					core.sysArgs[core.sysArgCount] = operand;
+					core.sysArgCount += 1;
+					complete = false;
+				}
+				else
+				{
+					reply = VC_compareExchange(core.ram[core.sysArgs[0]], core.sysArgs[1], operand);
+				}
+				break;
+		}
+		core.sysCacheStored = !complete;
+	}
+
+	// Replies are read like the input handler (the value first, then the device)
+	if(reply != -1 && core.replyCount + 2 <= VC_CORE_REPLIES)
+	{
+		core.replies[core.replyCount] = VC_OH_SYS;
+		core.replies[core.replyCount + 1] = reply;
+		core.replyCount += 2;
+	}
+}
+
+// Instructions executed by every core of a multi-core virtual computer
+long long VC_coreInstructions(void)
+{
+	long long total = 0;
+	for(int i = 0; i < VC_coreCount; i++)
+		total += VC_cores[i].instructions;
+	return total;
+}
+
+int VC_testAndSet(int & word)
+{
+	int old = word;
+	word = 1;
+	return old;
+}
+
+int VC_testAndSet(std::atomic<int> & word)
+{
+	return word.exchange(1);
+}
+
+int VC_compareExchange(int & word, int expected, int desired)
+{
+	int old = word;
+	if(old == expected)
+		word = desired;
+	return old;
+}
+
+int VC_compareExchange(std::atomic<int> & word, int expected, int desired)
+{
+	word.compare_exchange_strong(expected, desired); // expected is set to the old value
+	return expected;
+}
+
+// Show a bank of extended memory in RAM from VC_BANK_START to the end
+	// The window is stored in the bank that was selected and the new bank is copied into it, so instructions that
+	// use the selected bank cost nothing extra and a switch copies 2 * VC_BANK_SIZE words
+void VC_selectBank(int bank)
+{
+	if(bank == VC_bank)
+		return;
+
+	// Run-ahead puts back the banks it changes
+	if(VC_runningAhead)
+	{
+		bool saved = false;
+		for(size_t i = 0; i < VC_runAheadBanks.size(); i++)
+			saved = saved || VC_runAheadBanks[i].first == VC_bank;
+		if(!saved)
+			VC_runAheadBanks.push_back(std::make_pair(VC_bank, VC_banks[VC_bank]));
+	}
+
+	VC_banks[VC_bank].assign(vc.ram + VC_BANK_START, vc.ram + VC_RAM_SIZE);
+	VC_markBankDirty(VC_bank);
+	const std::vector<int> & oldWindow = VC_banks[VC_bank];
+
+	if(VC_banks[bank].empty())
+		std::fill(vc.ram + VC_BANK_START, vc.ram + VC_RAM_SIZE, 0);
+	else
+		std::copy(VC_banks[bank].begin(), VC_banks[bank].end(), vc.ram + VC_BANK_START);
+	VC_markPages(VC_BANK_START, VC_BANK_SIZE);
+
+	// The execution trace only gets the words that are different in the new bank
+	if(VC_execTrace.is_open())
+	{
+		for(int i = VC_BANK_START; i < VC_RAM_SIZE; i++)
+		{
+			if(vc.ram[i] != oldWindow[i - VC_BANK_START])
+				VC_recordWrites(i, 1);
+		}
+	}
+
+	VC_bank = bank;
+}
+
+// Read a word of extended memory (address is between VC_BANK_START and the end of RAM)
+int VC_bankWord(int bank, int address)
+{
+	if(bank == VC_bank)
+		return vc.ram[address];
+	if(VC_banks[bank].empty())
+		return 0;
+	return VC_banks[bank][address - VC_BANK_START];
+}
+
+void VC_setBankWord(int bank, int address, int value)
+{
+	if(bank == VC_bank)
+	{
+		vc.ram[address] = value;
+		VC_markPages(address, 1);
+		return;
+	}
+
+	if(VC_banks[bank].empty())
+		VC_banks[bank].assign(VC_BANK_SIZE, 0);
+	VC_banks[bank][address - VC_BANK_START] = value;
+	VC_markBankDirty(bank);
+}
+
+void VC_markBankDirty(int bank)
+{
+	if(!VC_bankDirty[bank])
+	{
+		VC_bankDirty[bank] = true;
+		VC_dirtyBanks.push_back(bank);
+	}
+}
+
+// Mark the pages of RAM from address to address + length - 1 as written (wrapping past the end of RAM)
+void VC_markPages(int address, int length)
+{
+	for(int page = address / VC_PAGE_SIZE; page <= (address + length - 1) / VC_PAGE_SIZE; page++)
+		VC_dirtyPages |= 1u << (page % VC_PAGE_COUNT);
+}
+
+// Read an address typed in the debug console ("<address>" or "<bank>:<address>")
+	// Addresses without a bank are in the selected bank
+bool VC_parseAddress(const std::string & text, int & bank, int & address)
+{
+	size_t colon = text.find(':');
+	bank = VC_bank;
+
+	std::istringstream tokens(text.substr(colon == std::string::npos ? 0 : colon + 1));
+	if(!(tokens >> address) || address < 0 || address >= VC_RAM_SIZE)
+		return false;
+
+	if(colon != std::string::npos)
+	{
+		std::istringstream bankToken(text.substr(0, colon));
+		if(!(bankToken >> bank) || bank < 0 || bank >= VC_BANK_COUNT || address < VC_BANK_START)
+			return false;
+	}
+
+	return true;
+}
+
+// Math coprocessor operations for one core of a multi-core virtual computer
+	// Results go to the reply stack of the core (like VC_coreSys)
+void VC_coreMath(VC_Core & core, int operand)
+{
+	if(!core.mthCacheStored)
+	{
+		core.mthCache = operand;
+		core.mthCacheStored = true;
+		return;
+	}
+
+	int results[VC_MTH_RESULTS],
+		count = VC_math(core.mthCache, core.ram[operand], core.ram[(operand + 1) % VC_RAM_SIZE], results);
+	core.mthCacheStored = false;
+
+	if(core.replyCount + count + 1 <= VC_CORE_REPLIES)
+	{
+		core.replies[core.replyCount] = VC_OH_MTH;
+		core.replyCount += 1;
+		for(int i = count - 1; i >= 0; i--)
+		{
+			core.replies[core.replyCount] = results[i];
+			core.replyCount += 1;
+		}
+	}
+}
+
+// Math coprocessor (device 4)
+	// SOT sends the operation and then the address of its arguments, x = ram[address] and y = ram[address + 1]
+	// The results are sent to the input handler straight away, so the next GIN reads the first result
+	// Values are 16 bit words, signed operations treat them as two's complement
+	// 0                 Multiply: low word of x * y, then high word
+	// 1                 Divide: x / y, then x % y (dividing by 0 gives 65535 and x)
+	// 2                 Signed multiply: low word of x * y, then high word
+	// 3                 Signed divide: x / y, then x % y rounded towards 0 (dividing by 0 gives 65535 and x)
+	// 4                 Shift left by y (y >= 16 gives 0)
+	// 5                 Shift right by y
+	// 6                 Arithmetic shift right by y (copies the sign bit)
+	// 7                 Rotate left by y % 16
+	// 8                 Rotate right by y % 16
+	// 9                 Population count: number of 1 bits in x
+	// 10                Leading zero count: number of 0 bits above the highest 1 bit in x (16 if x = 0)
+	// Other operations send nothing
+	// Returns the number of results written to results
+int VC_math(int operation, int x, int y, int * results)
+{
+	x &= 65535;
+	y &= 65535;
+	int signedX = x >= 32768 ? x - 65536 : x,
+		signedY = y >= 32768 ? y - 65536 : y;
+
+	switch(operation)
+	{
+		case 0:
+		{
+			unsigned int product = (unsigned int)x * (unsigned int)y;
+			results[0] = product & 65535;
+			results[1] = product >> 16;
+			return 2;
+		}
+		case 1:
+			results[0] = y == 0 ? 65535 : x / y;
+			results[1] = y == 0 ? x : x % y;
+			return 2;
+		case 2:
+		{
+			unsigned int product = (unsigned int)(signedX * signedY);
+			results[0] = product & 65535;
+			results[1] = product >> 16;
+			return 2;
+		}
+		case 3:
+			results[0] = signedY == 0 ? 65535 : (signedX / signedY) & 65535;
+			results[1] = signedY == 0 ? x : (signedX % signedY) & 65535;
+			return 2;
+		case 4:
+			results[0] = y >= 16 ? 0 : (x << y) & 65535;
+			return 1;
+		case 5:
+			results[0] = y >= 16 ? 0 : x >> y;
+			return 1;
+		case 6:
+			results[0] = (signedX >> (y >= 16 ? 15 : y)) & 65535;
+			return 1;
+		case 7:
+			results[0] = ((x << (y % 16)) | (x >> ((16 - y % 16) % 16))) & 65535;
+			return 1;
+		case 8:
+			results[0] = ((x >> (y % 16)) | (x << ((16 - y % 16) % 16))) & 65535;
+			return 1;
+		case 9:
+			results[0] = __builtin_popcount(x);
+			return 1;
+		case 10:
+			results[0] = x == 0 ? 16 : __builtin_clz(x) - 16;
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+// Block memory engine (device 5)
+	// SOT sends the operation, the source address, the destination and the length, and the operation is done when
+	// the length is sent (ranges are shortened so that they end at the end of RAM or the screen)
+	// The status is then sent to the input handler, so the next GIN reads it
+	// 0                 Move: copy length words from source to destination (the ranges can overlap), sends the number of words copied
+	// 1                 Fill: set length words from destination to ram[source], sends the number of words set
+	// 2                 Compare: sends the number of words that are the same before the first difference (the length if every word is the same)
+	// 3                 Blit: copy length words from source to the screen starting at pixel destination, sends the number of pixels set
+		// Pixels are numbered left to right from the top left of the screen and colors are RGB565 (5 bits red, 6 bits green, 5 bits blue)
+	// Other operations send 65535
+	// Returns the status
+int VC_blockOperation(int operation, int source, int destination, int length)
+{
+	const int PIXEL_COUNT = PIXEL_COUNT_X * PIXEL_COUNT_Y;
+
+	if(operation == 3)
+		length = std::min(length, std::min(VC_RAM_SIZE - source, PIXEL_COUNT - destination));
+	else
+		length = std::min(length, std::min(VC_RAM_SIZE - source, VC_RAM_SIZE - destination));
+	if(length < 0)
+		length = 0;
+
+	switch(operation)
+	{
+		case 0:
+			std::memmove(vc.ram + destination, vc.ram + source, length * sizeof(int));
+			VC_markPages(destination, length);
+			VC_recordWrites(destination, length);
+			return length;
+		case 1:
+			std::fill(vc.ram + destination, vc.ram + destination + length, vc.ram[source]);
+			VC_markPages(destination, length);
+			VC_recordWrites(destination, length);
+			return length;
+		case 2:
+			return std::mismatch(vc.ram + source, vc.ram + source + length, vc.ram + destination).first - (vc.ram + source);
+		case 3:
+			for(int i = 0; i < length; i++)
+			{
+				int color = vc.ram[source + i],
+					x = (destination + i) % PIXEL_COUNT_X,
+					y = PIXEL_COUNT_Y - 1 - (destination + i) / PIXEL_COUNT_X; // pixelDisplayColor starts at the bottom
+
+				pixelDisplayColor[x][y][0] = ((color >> 11) & 31) * 255 / 31;
+				pixelDisplayColor[x][y][1] = ((color >> 5) & 63) * 255 / 63;
+				pixelDisplayColor[x][y][2] = (color & 31) * 255 / 31;
+			}
+
+			// Run-ahead counts the frames it blits, and runs ahead again after each frame that is blitted
+			if(VC_runningAhead)
+				VC_runAheadBlits += 1;
+			else
+				VC_runAheadDue = true;
+			glutPostRedisplay();
+			return length;
+		default:
+			return 65535;
+	}
+}
+
+// Interrupt controller (device 6)
+	// 0                 Send the pending interrupts to the input handler and clear them
+	// 1 <mask>          Set the interrupts that run their handler (bit 0 timer, bit 1 input, bit 2 device completion)
+	// 2 <address>       Set the address of the vector table (the handler addresses for the timer, input and device completion interrupts)
+	// 3 <interval>      Start the timer with an interrupt every interval cycles (0 stops the timer)
+	// 4                 Return from the handler (every register is restored and the next interrupt can be delivered)
+	// SYS operation 8 waits for an interrupt
+void VC_interruptControl(int operand)
+{
+	if(VC_OH_INT_cache_stored == false)
+	{
+		// Perform actions that only require one word of data
+		switch(operand)
+		{
+			case 0:
+				VC_inputHandler(true, VC_OH_INT);
+				VC_inputHandler(true, VC_interrupts.pending);
+				VC_interrupts.pending = 0;
+				break;
+			// Store the operand for use in operations that require two words of data
+			case 1:
+			case 2:
+			case 3:
+				VC_OH_INT_cache = operand;
+				VC_OH_INT_cache_stored = true;
+				break;
+			case 4:
+				if(VC_interrupts.handling)
+				{
+					for(int reg = 0; reg < VC_REG_COUNT; reg++)
+						VC_setRegister(reg, VC_interrupts.saved[reg]);
+					vc.iar = (vc.iar + VC_RAM_SIZE - 1) % VC_RAM_SIZE; // VC_execute moves iar past this SOT instruction
+					VC_interrupts.handling = false;
+				}
+				break;
+			default:
+				// Don't do anything
+				break;
+		}
+	}
+	else
+	{
+		// Perform actions that require two words of data
+		switch(VC_OH_INT_cache)
+		{
+			case 1:
+				VC_interrupts.enabled = operand & ((1 << VC_INT_COUNT) - 1);
+				break;
+			case 2:
+				VC_interrupts.vectors = operand;
+				break;
+			case 3:
+				VC_interrupts.interval = operand;
+				VC_interrupts.timer = 0;
+				break;
+		}
+		VC_OH_INT_cache_stored = false;
+	}
+}
+
+// Called by VC_step before an instruction while an interrupt is pending
+	// Waiting ends when any interrupt is pending, but only enabled interrupts run their handler (one at a time)
+	// The registers are saved and iar is set to the handler address in the vector table
+void VC_interrupt(void)
+{
+	VC_interrupts.waiting = false;
+
+	int deliver = VC_interrupts.pending & VC_interrupts.enabled;
+	if(deliver == 0 || VC_interrupts.handling)
+		return;
+
+	int number = 0;
+	while(((deliver >> number) & 1) == 0)
+		number++;
+	VC_interrupts.pending &= ~(1 << number);
+
+	for(int reg = 0; reg < VC_REG_COUNT; reg++)
+		VC_interrupts.saved[reg] = VC_getRegister(reg);
+	VC_interrupts.handling = true;
+
+	vc.iar = vc.ram[(VC_interrupts.vectors + number) % VC_RAM_SIZE] % VC_RAM_SIZE;
+}
+
+// Called by VC_step after a backward jump
+	// If the state is the same as after the last backward jump and nothing was written or sent in between, every
+	// iteration of the loop will do the same until an interrupt is raised (a word arrives in the input handler or the
+	// timer fires), so the virtual computer waits for one instead (the idle cycles are counted like WFI cycles)
+void VC_detectIdleLoop(void)
+{
+	int state[VC_LOOP_STATE_SIZE] = {vc.iar, vc.rA, vc.rB, vc.rC, vc.aluOp, VC_getRegister(VC_REG_FLAGS),
+									 VC_IH_cache_stored, VC_IH_cache_pos, VC_bank, (int)VC_eventQueue.size()};
+
+	if(!VC_loop.changed && std::equal(state, state + VC_LOOP_STATE_SIZE, VC_loop.state))
+		VC_interrupts.waiting = VC_interrupts.idle = true;
+
+	std::copy(state, state + VC_LOOP_STATE_SIZE, VC_loop.state);
+	VC_loop.changed = false;
+}
+
+// Text console (device 7)
+	// SOT sends one character (the low 8 bits of the operand), so printing costs one instruction per character
+	// Characters are stored and written in one call when a newline is sent, the buffer is full, the virtual computer
+	// waits for an interrupt, the title is refreshed or the program closes
+void VC_consoleOutput(int character)
+{
+	VC_consoleBuffer.push_back((char)(character & 255));
+
+	if((character & 255) == '\n' || VC_consoleBuffer.size() >= (size_t)VC_CONSOLE_BUFFER_SIZE)
+		VC_flushConsole();
+}
+
+void VC_flushConsole(void)
+{
+	if(VC_consoleBuffer.empty())
+		return;
+
+	std::fwrite(VC_consoleBuffer.data(), 1, VC_consoleBuffer.size(), VC_consoleFile);
+	std::fflush(VC_consoleFile);
+	VC_consoleBuffer.clear();
+}
+
+// Send a line read from stdin to the guest (with -stdin)
+	// Each character is sent as the console device followed by the character, and the words are recorded in reverse
+	// so that GIN reads the line from the start (the input handler returns the last word written first)
+void VC_consoleInput(const std::string & line)
+{
+	if(!VC_liveInput())
+		return;
+
+	VC_recordInput(VC_OH_CON);
+	VC_recordInput('\n');
+	for(size_t i = line.size(); i > 0; i--)
+	{
+		VC_recordInput(VC_OH_CON);
+		VC_recordInput((unsigned char)line[i - 1]);
+	}
+}
+
+// Local socket (device 8)
+	// 0 <address>             Connect to the loopback TCP port in ram[address]
+	// 1 <address>             Connect to the Unix domain socket whose path is at ram[address] (one character per word, ending with 0)
+	// 2 <byte>                Send a byte
+	// 3 <address> <length>    Send the low bytes of length words from address
+	// 4                       Close the connection
+	// 5 <address> <length>    Store received bytes in RAM instead of the input handler (length 0 goes back to the input handler)
+		// ram[address] is the number of bytes stored and the bytes are stored after it (the guest sets ram[address] to 0
+		// once it has read them), bytes that don't fit wait until there is space
+	// Connecting, sending and closing only queue a request for VC_netThread. The input handler receives
+	// VC_NET_CONNECTED or VC_NET_CLOSED (after VC_OH_NET, like received bytes) when the connection is made, fails or is closed
+	// Nothing is sent while the debugger replays earlier instructions
+void VC_netControl(int operand)
+{
+	if(VC_net.cacheStored == false)
+	{
+		switch(operand)
+		{
+			case 4:
+				if(VC_instructionCount >= VC_historyEnd)
+					VC_netRequestConnection(3, 0, "");
+				break;
+			// Store the operand for use in operations that require two or more words of data
+			case 0:
+			case 1:
+			case 2:
+			case 3:
+			case 5:
+				VC_net.cache = operand;
+				VC_net.cacheStored = true;
+				VC_net.argCount = 0;
+				break;
+			default:
+				// Don't do anything
+				break;
+		}
+		return;
+	}
+
+	// Operations 3 and 5 take two words
+	if((VC_net.cache == 3 || VC_net.cache == 5) && VC_net.argCount == 0)
+	{
+		VC_net.args[0] = operand;
+		VC_net.argCount = 1;
+		return;
+	}
+	VC_net.cacheStored = false;
+
+	if(VC_net.cache == 5)
+	{
+		VC_net.buffer = operand == 0 ? -1 : VC_net.args[0];
+		VC_net.bufferLength = operand;
+		return;
+	}
+
+	if(VC_instructionCount < VC_historyEnd)
+		return;
+
+	switch(VC_net.cache)
+	{
+		case 0:
+			VC_netRequestConnection(1, vc.ram[operand], "");
+			break;
+		case 1:
+		{
+			std::string path;
+			for(int i = operand; i < VC_RAM_SIZE && vc.ram[i] != 0; i++)
+				path.push_back((char)(vc.ram[i] & 255));
+			VC_netRequestConnection(2, 0, path);
+			break;
+		}
+		case 2:
+		{
+			std::lock_guard<std::mutex> lock(VC_netMutex);
+			VC_netSendBuffer.push_back((char)(operand & 255));
+			break;
+		}
+		case 3:
+		{
+			std::lock_guard<std::mutex> lock(VC_netMutex);
+			for(int i = VC_net.args[0]; i < VC_net.args[0] + operand && i < VC_RAM_SIZE; i++)
+				VC_netSendBuffer.push_back((char)(vc.ram[i] & 255));
+			break;
+		}
+	}
+}
+
+// Queue a connect or close request for VC_netThread (starting the thread if needed)
+void VC_netRequestConnection(int request, int port, const std::string & path)
+{
+	std::lock_guard<std::mutex> lock(VC_netMutex);
+	VC_netRequest = request;
+	VC_netPort = port;
+	VC_netPath = path;
+	VC_netSendBuffer.clear();
+
+	if(!VC_netStarted)
+	{
+		VC_netStarted = true;
+		std::thread(VC_netThread).detach();
+	}
+}
+
+// Make every socket call for the local socket (runs on its own thread)
+	// Bytes queued by the guest are sent together, and received bytes are read up to VC_NET_BATCH at a time
+void VC_netThread(void)
+{
+#ifdef _WIN32
+	WSADATA wsaData;
+	WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+
+	SOCKET sock = INVALID_SOCKET;
+	bool connecting = false;
+	std::string sending;
+	char data[VC_NET_BATCH];
+
+	while(true)
+	{
+		std::vector<int> received;
+
+		// Take requests and bytes from the guest
+		VC_netMutex.lock();
+		if(VC_netRequest != 0)
+		{
+			if(sock != INVALID_SOCKET)
+				closesocket(sock);
+			sock = INVALID_SOCKET;
+			sending.clear();
+
+			if(VC_netRequest != 3)
+			{
+				sock = VC_netOpen(VC_netRequest, VC_netPort, VC_netPath, connecting);
+				if(sock == INVALID_SOCKET)
+					received.push_back(VC_NET_CLOSED);
+				else if(!connecting)
+					received.push_back(VC_NET_CONNECTED);
+			}
+			VC_netRequest = 0;
+		}
+		sending += VC_netSendBuffer;
+		VC_netSendBuffer.clear();
+		VC_netMutex.unlock();
+
+		if(sock == INVALID_SOCKET)
+		{
+			sending.clear();
+			std::this_thread::sleep_for(std::chrono::milliseconds(VC_WAIT_POLL_PERIOD));
+		}
+		else
+		{
+			fd_set readable,
+				   writable,
+				   failed; // Windows reports failed connections here
+			FD_ZERO(&readable);
+			FD_ZERO(&writable);
+			FD_ZERO(&failed);
+			if(!connecting)
+				FD_SET(sock, &readable);
+			if(connecting || !sending.empty())
+				FD_SET(sock, &writable);
+			if(connecting)
+				FD_SET(sock, &failed);
+
+			timeval timeout = {0, VC_WAIT_POLL_PERIOD * 1000};
+			if(select((int)sock + 1, &readable, &writable, &failed, &timeout) > 0)
+			{
+				bool closed = false;
+
+				if(connecting && (FD_ISSET(sock, &writable) || FD_ISSET(sock, &failed)))
+				{
+					int error = 0;
+					socklen_t length = sizeof(error);
+					getsockopt(sock, SOL_SOCKET, SO_ERROR, (char *)&error, &length);
+					connecting = false;
+
+					if(error != 0 || FD_ISSET(sock, &failed))
+						closed = true;
+					else
+						received.push_back(VC_NET_CONNECTED);
+				}
+				else
+				{
+					if(FD_ISSET(sock, &readable))
+					{
+						int count = recv(sock, data, VC_NET_BATCH, 0);
+						if(count <= 0)
+							closed = true;
+						for(int i = 0; i < count; i++)
+							received.push_back((unsigned char)data[i]);
+					}
+					if(!closed && FD_ISSET(sock, &writable))
+					{
+						int count = send(sock, sending.data(), (int)sending.size(), MSG_NOSIGNAL);
+						if(count > 0)
+							sending.erase(0, count);
+					}
+				}
+
+				if(closed)
+				{
+					closesocket(sock);
+					sock = INVALID_SOCKET;
+					received.push_back(VC_NET_CLOSED);
+				}
+			}
+		}
+
+		if(!received.empty())
+		{
+			std::lock_guard<std::mutex> lock(VC_netMutex);
+			VC_netReceived.insert(VC_netReceived.end(), received.begin(), received.end());
+			VC_netPending = true;
+		}
+	}
+}
+
+// Create a non-blocking socket and start connecting it
+	// connecting is set if the connection isn't made yet (VC_netThread waits for the socket to become writable)
+SOCKET VC_netOpen(int request, int port, const std::string & path, bool & connecting)
+{
+	SOCKET sock;
+	int result;
+
+	if(request == 1)
+	{
+		sock = socket(AF_INET, SOCK_STREAM, 0);
+		if(sock == INVALID_SOCKET)
+			return INVALID_SOCKET;
+
+		sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_port = htons((unsigned short)port);
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // Only this computer
+
+#ifdef _WIN32
+		u_long nonBlocking = 1;
+		ioctlsocket(sock, FIONBIO, &nonBlocking);
+#else
+		fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+#endif
+		result = connect(sock, (sockaddr *)&address, sizeof(address));
+	}
+	else
+	{
+#ifdef _WIN32
+		return INVALID_SOCKET; // Unix domain sockets aren't supported on Windows
+#else
+		sock = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(sock == INVALID_SOCKET)
+			return INVALID_SOCKET;
+
+		sockaddr_un address = {};
+		address.sun_family = AF_UNIX;
+		std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+		fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+		result = connect(sock, (sockaddr *)&address, sizeof(address));
+#endif
+	}
+
+#ifdef _WIN32
+	connecting = result != 0 && WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+	connecting = result != 0 && (errno == EINPROGRESS || errno == EAGAIN);
+#endif
+
+	if(result != 0 && !connecting)
+	{
+		closesocket(sock);
+		return INVALID_SOCKET;
+	}
+	return sock;
+}
+
+// Send data received by the local socket to the guest (called by VC_main)
+	// Words are recorded like keyboard input so that replays are the same, and bytes stored in a RAM buffer are
+	// recorded as debugger edits
+void VC_netDeliver(void)
+{
+	if(!VC_liveInput())
+		return;
+
+	std::lock_guard<std::mutex> lock(VC_netMutex);
+
+	// Status words and bytes for the input handler are recorded in reverse so that GIN reads them in order
+	std::vector<int> words;
+	while(!VC_netReceived.empty())
+	{
+		int word = VC_netReceived.front();
+		if(word < VC_NET_CONNECTED && VC_net.buffer >= 0)
+		{
+			int stored = vc.ram[VC_net.buffer];
+			if(stored >= VC_net.bufferLength || VC_net.buffer + 1 + stored >= VC_RAM_SIZE)
+				break; // The buffer is full
+			VC_edit(VC_net.buffer + 1 + stored, word);
+			VC_edit(VC_net.buffer, stored + 1);
+		}
+		else
+		{
+			words.push_back(word);
+		}
+		VC_netReceived.pop_front();
+	}
+
+	for(size_t i = words.size(); i > 0; i--)
+	{
+		VC_recordInput(VC_OH_NET);
+		VC_recordInput(words[i - 1]);
+	}
+
+	VC_netPending = !VC_netReceived.empty();
+}
+
+// Record an event record for the event queue (VC_step queues it before the next instruction)
+void VC_recordEvent(int device, int type, int code, int x, int y)
+{
+	VC_InputEvent event = {VC_instructionCount, (device << 12) | (type << 8) | (code & 255), x, y, true};
+	VC_inputEvents.push_back(event);
+	VC_runAheadDue = true;
+}
+
+// Add an event record to the event queue
+	// A mouse motion record replaces the last record if that is a motion record with the same buttons held
+void VC_queueEvent(const VC_InputEvent & event)
+{
+	if(!VC_eventQueue.empty() && ((event.word >> 8) & 15) == VC_EVENT_MOTION && VC_eventQueue.back().word == event.word)
+	{
+		VC_eventQueue.back().x = event.x;
+		VC_eventQueue.back().y = event.y;
+		return;
+	}
+
+	if(!VC_runningAhead)
+		VC_metricInputWords += 1;
+	if(VC_eventQueue.size() >= (size_t)VC_EVENT_QUEUE_SIZE)
+	{
+		if(!VC_runningAhead)
+			VC_metricInputDrops += 1;
+		return;
+	}
+	VC_eventQueue.push_back(event);
+}
+
+// Input event records (device 9)
+	// 0 <mode>          0 sends keyboard and mouse input to the input handler as words (the default), 1 sends event records
+	// 1                 Store the oldest event record at the event address (the first word is 0 if there are none)
+	// 2 <address>       Set the event address
+	// 3 <mask>          Also send key releases (bit 0), special keys (bit 1) and mouse motion (bit 2)
+	// 4                 Send the number of event records waiting to the input handler
+	// An event record is 3 words: device << 12 | type << 8 | code (see VC_EVENT_*), then the x and y position of the
+	// mouse. The code is the key, the mouse button or the mouse buttons held.
+	// With event records, reading an event costs one SOT instead of a GIN for each of 6 or 8 words
+void VC_eventControl(int operand)
+{
+	if(VC_events.cacheStored == false)
+	{
+		switch(operand)
+		{
+			case 1:
+			{
+				int address = VC_events.address;
+				if(VC_eventQueue.empty())
+				{
+					vc.ram[address] = 0;
+					VC_markPages(address, 1);
+					VC_recordWrites(address, 1);
+					break;
+				}
+
+				const VC_InputEvent & event = VC_eventQueue.front();
+				vc.ram[address] = event.word;
+				vc.ram[(address + 1) % VC_RAM_SIZE] = event.x & 65535;
+				vc.ram[(address + 2) % VC_RAM_SIZE] = event.y & 65535;
+				VC_markPages(address, 3);
+				VC_recordWrites(address, 3);
+				VC_eventQueue.pop_front();
+				break;
+			}
+			case 4:
+				VC_inputHandler(true, VC_OH_EVT);
+				VC_inputHandler(true, (int)VC_eventQueue.size());
+				break;
+			// Store the operand for use in operations that require two words of data
+			case 0:
+			case 2:
+			case 3:
+				VC_events.cache = operand;
+				VC_events.cacheStored = true;
+				break;
+			default:
+				// Don't do anything
+				break;
+		}
+	}
+	else
+	{
+		// Perform actions that require two words of data
+		switch(VC_events.cache)
+		{
+			case 0:
+				VC_events.records = operand == 1;
+				break;
+			case 2:
+				VC_events.address = operand;
+				break;
+			case 3:
+				VC_events.send = operand;
+				break;
+		}
+		VC_events.cacheStored = false;
+	}
+}
+
+// Open the audio file and start writing samples to it
+	// The file is a 16 bit mono WAV file, the sizes in its header are written by VC_closeAudio
+bool VC_openAudio(const char * path)
+{
+	VC_audioFile = std::fopen(path, "wb");
+	if(VC_audioFile == NULL)
+		return false;
+
+	// RIFF header, fmt chunk (PCM, 1 channel, 16 bits per sample) and the start of the data chunk
+	unsigned char header[44] = {'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E',
+								'f', 'm', 't', ' ', 16, 0, 0, 0, 1, 0, 1, 0,
+								VC_AUDIO_RATE & 255, (VC_AUDIO_RATE >> 8) & 255, (VC_AUDIO_RATE >> 16) & 255, 0,
+								(VC_AUDIO_RATE * 2) & 255, ((VC_AUDIO_RATE * 2) >> 8) & 255, ((VC_AUDIO_RATE * 2) >> 16) & 255, 0,
+								2, 0, 16, 0, 'd', 'a', 't', 'a', 0, 0, 0, 0};
+	std::fwrite(header, 1, sizeof(header), VC_audioFile);
+
+	VC_audioWriter = std::thread(VC_audioThread);
+	return true;
+}
+
+// PCM audio (device 10)
+	// 0 <frequency>     Play a square wave at frequency Hz (0 is silent)
+	// 1 <duty>          Set the part of each period the square wave is high (1 to 255 256ths, the default is 128)
+	// 2 <volume>        Set the volume (0 to 255, the default is 255)
+	// 3 <sample>        Play a raw sample (0 to 4095, 2048 is silent) until the next sample or square wave
+	// Audio time is the instruction count (the cycle count with the timing model) divided by the clock speed, so the
+	// same program makes the same audio whether or not it runs in real time (idle cycles spent waiting for an
+	// interrupt are counted too)
+void VC_audioControl(int operand)
+{
+	if(VC_audio.cacheStored == false)
+	{
+		VC_audio.cache = operand;
+		VC_audio.cacheStored = true;
+		return;
+	}
+	VC_audio.cacheStored = false;
+
+	// Samples up to this instruction use the old settings
+	VC_synthesizeAudio();
+
+	switch(VC_audio.cache)
+	{
+		case 0:
+			VC_audio.frequency = operand;
+			VC_audio.raw = 0;
+			break;
+		case 1:
+			VC_audio.duty = std::min(std::max(operand, 1), 255);
+			break;
+		case 2:
+			VC_audio.volume = std::min(operand, 255);
+			break;
+		case 3:
+			VC_audio.sample = operand;
+			VC_audio.raw = 1;
+			break;
+		default:
+			// Don't do anything
+			break;
+	}
+}
+
+// Make the samples for the instructions (or cycles) executed since the last call and add them to the ring buffer
+	// Instructions replayed by the debugger are before VC_audioCount, so they don't make samples again
+void VC_synthesizeAudio(void)
+{
+	// clockSpeed is in cycles per second with the timing model
+	long long count = VC_timingEnabled ? VC_cycleCount : VC_instructionCount;
+	if(VC_audioFile == NULL || count <= VC_audioCount || VC_runningAhead)
+		return;
+
+	long long speed = std::max(clockSpeed.load(), 1),
+			  total = VC_audioRemainder + (count - VC_audioCount) * VC_AUDIO_RATE,
+			  samples = total / speed;
+	VC_audioRemainder = total % speed;
+	VC_audioCount = count;
+
+	uint64_t write = VC_audioWrite.load(std::memory_order_relaxed),
+			 space = VC_AUDIO_RING_SIZE - (write - VC_audioRead.load(std::memory_order_acquire));
+	if((uint64_t)samples > space)
+	{
+		VC_audioDrops += samples - space;
+		samples = space;
+	}
+
+	int level = (VC_audio.sample - 2048) * 16 * VC_audio.volume / 255;
+	uint32_t step = (uint32_t)((uint64_t)VC_audio.frequency * 4294967296ULL / VC_AUDIO_RATE),
+			 high = (uint32_t)VC_audio.duty << 24;
+
+	for(long long i = 0; i < samples; i++)
+	{
+		if(!VC_audio.raw)
+		{
+			level = VC_audio.frequency == 0 ? 0 : (VC_audioPhase < high ? 128 : -128) * VC_audio.volume;
+			VC_audioPhase += step;
+		}
+		VC_audioRing[(write + i) % VC_AUDIO_RING_SIZE] = (int16_t)level;
+	}
+
+	VC_audioWrite.store(write + samples, std::memory_order_release);
+}
+
+// Write samples from the ring buffer to the audio file in blocks (runs on its own thread)
+	// Samples are written as they are stored in memory (WAV files are little endian like x86 hosts)
+void VC_audioThread(void)
+{
+	VC_traceThreadName = "Audio writer";
+
+	while(true)
+	{
+		bool stopped = VC_audioStopped; // Read before the write index so the last samples are written
+
+		uint64_t read = VC_audioRead.load(std::memory_order_relaxed),
+				 write = VC_audioWrite.load(std::memory_order_acquire);
+		while(read != write)
+		{
+			// Write up to the end of the ring, then from the start
+			uint64_t start = read % VC_AUDIO_RING_SIZE,
+					 count = std::min(write - read, VC_AUDIO_RING_SIZE - start);
+			VC_TraceScope trace("Audio write");
+			std::fwrite(VC_audioRing + start, sizeof(int16_t), count, VC_audioFile);
+			read += count;
+			VC_audioRead.store(read, std::memory_order_release);
+		}
+
+		if(stopped)
+			return;
+		std::this_thread::sleep_for(std::chrono::milliseconds(VC_AUDIO_DRAIN_PERIOD));
+	}
+}
+
+// Write the remaining samples and the sizes in the WAV header, then close the audio file
+void VC_closeAudio(void)
+{
+	if(VC_audioFile == NULL)
+		return;
+
+	VC_synthesizeAudio();
+	VC_audioStopped = true;
+	VC_audioWriter.join();
+
+	uint32_t dataSize = (uint32_t)(VC_audioWrite.load() * sizeof(int16_t)),
+			 sizes[2] = {36 + dataSize, dataSize};
+	std::fseek(VC_audioFile, 4, SEEK_SET);
+	std::fwrite(&sizes[0], 4, 1, VC_audioFile);
+	std::fseek(VC_audioFile, 40, SEEK_SET);
+	std::fwrite(&sizes[1], 4, 1, VC_audioFile);
+
+	std::fclose(VC_audioFile);
+	VC_audioFile = NULL;
+}
+
+// Start recording the timeline trace
+void VC_startTrace(void)
+{
+	std::lock_guard<std::mutex> lock(VC_traceMutex);
+	if(VC_tracing)
+		return;
+
+	VC_traceStart = VC_seconds();
+	VC_traceTimerDue = 0;
+	VC_tracing = true;
+}
+
+// Stop recording the timeline trace and write every recorded event to the trace file
+	// Events are written as Chrome trace-event "complete" events (times are in microseconds), with a thread name
+	// for each thread that recorded events
+void VC_stopTrace(void)
+{
+	std::lock_guard<std::mutex> lock(VC_traceMutex);
+	if(!VC_tracing)
+		return;
+	VC_tracing = false;
+
+	std::ofstream target(VC_tracePath, std::ios::trunc);
+	if(!target.is_open())
+	{
+		std::cout << "Error: Trace file failed to open" << std::endl;
+		return;
+	}
+
+	target << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	target << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"" << WIN_DEFAULT_TITLE << "\"}}";
+
+	long long dropped = 0;
+	for(size_t b = 0; b < VC_traceBuffers.size(); b++)
+	{
+		VC_TraceBuffer & buffer = *VC_traceBuffers[b];
+		std::vector<VC_TraceEvent> events;
+		{
+			std::lock_guard<std::mutex> bufferLock(buffer.mutex);
+			events.swap(buffer.events);
+			dropped += buffer.dropped;
+			buffer.dropped = 0;
+		}
+
+		target << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer.threadId
+			   << ",\"args\":{\"name\":\"" << buffer.threadName << "\"}}";
+		for(size_t i = 0; i < events.size(); i++)
+		{
+			target << ",\n{\"name\":\"" << events[i].name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer.threadId
+				   << ",\"ts\":" << (long long)events[i].start << ",\"dur\":" << (long long)events[i].duration << "}";
+		}
+	}
+
+	target << "\n]}\n";
+	target.close();
+
+	if(dropped != 0)
+		std::cout << "Trace: " << dropped << " events were dropped (more than " << VC_TRACE_MAX_EVENTS << " in one thread)" << std::endl;
+}
+
+// Record a trace event on the calling thread (start and end are VC_seconds() values)
+void VC_traceEvent(const char * name, double start, double end)
+{
+	if(VC_traceBuffer == NULL)
+	{
+		VC_traceBuffer = new VC_TraceBuffer();
+		VC_traceBuffer->threadName = VC_traceThreadName;
+		VC_traceBuffer->dropped = 0;
+
+		std::lock_guard<std::mutex> lock(VC_traceMutex);
+		VC_traceBuffer->threadId = VC_traceBuffers.size() + 1;
+		VC_traceBuffers.push_back(VC_traceBuffer);
+	}
+
+	// Events that started before tracing did are dropped
+	if(start < VC_traceStart)
+		return;
+
+	VC_TraceEvent event = {name, (start - VC_traceStart) * 1000000, (end - start) * 1000000};
+	std::lock_guard<std::mutex> lock(VC_traceBuffer->mutex);
+	if(VC_traceBuffer->events.size() >= (size_t)VC_TRACE_MAX_EVENTS)
+		VC_traceBuffer->dropped += 1;
+	else
+		VC_traceBuffer->events.push_back(event);
+}
+
+// Allocate the block that holds RAM and the registers (called before main)
+	// The block is page aligned so that VC_openSharedMemory can replace its pages with shared ones at the same address
+VC_SharedBlock * VC_allocateSharedBlock(void)
+{
+#ifdef _WIN32
+	void * memory = VirtualAlloc(NULL, VC_SHARED_SIZE, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+	void * memory = mmap(NULL, VC_SHARED_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#endif
+
+	VC_SharedBlock * block = new (memory) VC_SharedBlock();
+	block->magic = VC_SHARED_MAGIC;
+	block->version = VC_SHARED_VERSION;
+	block->size = sizeof(VC_SharedBlock);
+	block->running = 1;
+	return block;
+}
+
+// Share the block that holds RAM and the registers as a named shared memory object
+	// POSIX: shm_open("/<name>"), Windows: a file mapping named <name>. Other processes map it read-only to watch
+	// the virtual computer, or read-write to change RAM and registers (changes made this way aren't recorded, so
+	// the debugger can't replay them).
+	// A process that changes RAM or registers increments doorbell after the change (with release ordering). The next
+	// VC_step counts the change as an edit, which ends an idle loop the virtual computer is waiting in. Words that the
+	// program writes while they are being changed keep whichever value was written last.
+	// The pages of the block are replaced by shared pages with the same contents at the same address, so nothing is
+	// copied after this.
+bool VC_openSharedMemory(const std::string & name)
+{
+	if(VC_sharing)
+		return false;
+
+	void * address = &VC_shared;
+
+#ifdef _WIN32
+	VC_sharedMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, (DWORD)VC_SHARED_SIZE, name.c_str());
+	if(VC_sharedMapping == NULL)
+		return false;
+
+	void * view = MapViewOfFile(VC_sharedMapping, FILE_MAP_ALL_ACCESS, 0, 0, VC_SHARED_SIZE);
+	if(view == NULL)
+		return false;
+	std::memcpy(view, address, VC_SHARED_SIZE);
+	UnmapViewOfFile(view);
+
+	// No other thread allocates memory yet, so the address is still free when the view is mapped to it
+	VirtualFree(address, 0, MEM_RELEASE);
+	if(MapViewOfFileEx(VC_sharedMapping, FILE_MAP_ALL_ACCESS, 0, 0, VC_SHARED_SIZE, address) != address)
+	{
+		std::cout << "Error: RAM could not be moved to shared memory" << std::endl;
+		std::exit(0);
+	}
+#else
+	std::string path = "/" + name;
+	int file = shm_open(path.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0644);
+	if(file < 0)
+		return false;
+
+	bool copied = ftruncate(file, VC_SHARED_SIZE) == 0 && pwrite(file, address, VC_SHARED_SIZE, 0) == (ssize_t)VC_SHARED_SIZE;
+	if(!copied || mmap(address, VC_SHARED_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, file, 0) == MAP_FAILED)
+	{
+		close(file);
+		shm_unlink(path.c_str());
+		return false;
+	}
+	close(file);
+#endif
+
+	VC_sharing = true;
+	VC_sharedName = name;
+	return true;
+}
+
+VC_SharedWrite::VC_SharedWrite()
+{
+	if(VC_sharing)
+	{
+		VC_shared.sequence.fetch_add(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release); // The odd number is seen before any change
+	}
+}
+
+VC_SharedWrite::~VC_SharedWrite()
+{
+	if(VC_sharing)
+	{
+		VC_publishStatus();
+		VC_shared.sequence.fetch_add(1, std::memory_order_release);
+	}
+}
+
+// Write the status fields of the shared memory block
+void VC_publishStatus(void)
+{
+	VC_shared.instructionCount = VC_instructionCount;
+	VC_shared.cycleCount = VC_timingEnabled ? VC_cycleCount : VC_instructionCount;
+	VC_shared.clockSpeed = clockSpeed;
+	VC_shared.ips = VC_lastIps;
+	VC_shared.bank = VC_bank;
+	VC_shared.paused = VC_paused;
+	VC_shared.waiting = VC_interrupts.waiting;
+}
+
+// Tell readers the virtual computer has stopped and remove the name of the shared memory object
+	// Processes that have it mapped can still read the final state
+void VC_closeSharedMemory(void)
+{
+	if(!VC_sharing)
+		return;
+
+	{
+		VC_SharedWrite sharedWrite;
+		VC_shared.running = 0;
+	}
+
+#ifdef _WIN32
+	CloseHandle(VC_sharedMapping); // The mapping stays until every view of it is unmapped
+#else
+	shm_unlink(("/" + VC_sharedName).c_str());
+#endif
+	VC_sharing = false;
+}
+
+// Open the execution trace file and write the state before the first instruction to it
+bool VC_openExecTrace(const char * path)
+{
+	VC_execTrace.open(path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+	if(!VC_execTrace.is_open())
+		return false;
+
+	VC_ExecHeader header = {};
+	std::memcpy(header.magic, VC_EXEC_MAGIC, 4);
+	header.version = VC_EXEC_VERSION;
+	header.records = VC_EXEC_UNKNOWN; // Written by VC_closeExecTrace
+	header.iar = vc.iar;
+	header.rA = vc.rA;
+	header.rB = vc.rB;
+	header.rC = vc.rC;
+	header.aluOp = vc.aluOp;
+	header.flags = vc.flag[0] | vc.flag[1] << 1 | vc.flag[2] << 2;
+	for(int i = 0; i < VC_RAM_SIZE; i++)
+		header.ram[i] = vc.ram[i];
+
+	VC_execTrace.write((const char *)&header, sizeof(header));
+	return true;
+}
+
+// Write a record to the execution trace with the registers as they are now (address is -1 if RAM wasn't written)
+void VC_recordExec(int type, int address)
+{
+	VC_ExecRecord record = {};
+	record.count = VC_instructionCount;
+	record.type = type;
+	record.at = VC_execAt;
+	record.word = VC_execWord;
+	record.address = address < 0 ? VC_EXEC_NO_ADDRESS : address;
+	record.value = address < 0 ? 0 : vc.ram[address];
+	record.iar = vc.iar;
+	record.rA = vc.rA;
+	record.rB = vc.rB;
+	record.rC = vc.rC;
+	record.aluOp = vc.aluOp;
+	record.flags = vc.flag[0] | vc.flag[1] << 1 | vc.flag[2] << 2;
+
+	VC_execTrace.write((const char *)&record, sizeof(record));
+	VC_execRecords += 1;
+}
+
+// Record words of RAM written by a device (wrapping past the end of RAM)
+	// Writes made while the debugger replays earlier instructions are already in the trace
+void VC_recordWrites(int address, int length)
+{
+	if(!VC_execTrace.is_open() || VC_instructionCount < VC_historyEnd)
+		return;
+
+	for(int i = 0; i < length; i++)
+		VC_recordExec(VC_EXEC_DEVICE, (address + i) % VC_RAM_SIZE);
+}
+
+// Forget the records after the current instruction count (called by VC_truncateHistory)
+	// Edits made before the instruction at the current count are kept like VC_edits. The records that follow are
+	// written over the ones that were forgotten.
+void VC_truncateExecTrace(void)
+{
+	if(!VC_execTrace.is_open())
+		return;
+
+	VC_execTrace.flush();
+	VC_execRecords = VC_searchExecRecords(VC_execTrace, 0, VC_execRecords, VC_execBefore(VC_instructionCount));
+	VC_execTrace.clear();
+	VC_execTrace.seekp(sizeof(VC_ExecHeader) + VC_execRecords * sizeof(VC_ExecRecord));
+}
+
+// Write the number of records to the header and close the execution trace file
+	// Records after that number (forgotten by VC_truncateExecTrace and not written over) are ignored
+void VC_closeExecTrace(void)
+{
+	if(!VC_execTrace.is_open())
+		return;
+
+	VC_execTrace.seekp(offsetof(VC_ExecHeader, records));
+	VC_execTrace.write((const char *)&VC_execRecords, sizeof(VC_execRecords));
+	VC_execTrace.close();
+}
+
+// Show the screen as it will be VC_runAheadFrames frames from now (run-ahead mode)
+	// The state is saved, the virtual computer runs with the input it has now until it has blitted that many frames
+	// (or for VC_RUN_AHEAD_LIMIT cycles), the screen is copied to VC_runAheadPixels and the state is restored. Input
+	// that arrives later is used by the next run-ahead, so a key press shows up as soon as the program would draw it.
+	// Instructions run ahead are treated like instructions replayed by the debugger (VC_historyEnd is out of reach),
+	// so they have no effects outside the virtual computer and aren't recorded. RAM is restored one page at a time
+	// from the pages they marked.
+void VC_runAhead(void)
+{
+	VC_TraceScope trace("VC_runAhead");
+
+	static int ram[VC_RAM_SIZE],
+			   IH_cache[VC_RAM_SIZE],
+			   savedOpLog[VC_RAM_SIZE][4],
+			   savedOpBank[VC_RAM_SIZE];
+	static GLubyte screen[PIXEL_COUNT_X][PIXEL_COUNT_Y][4];
+
+	// Save the state
+	VC_Checkpoint state;
+	VC_saveState(state);
+	std::copy(vc.ram, vc.ram + VC_RAM_SIZE, ram);
+	std::copy(VC_IH_cache, VC_IH_cache + VC_RAM_SIZE, IH_cache);
+	std::memcpy(savedOpLog, opLog, sizeof(savedOpLog));
+	std::memcpy(savedOpBank, opBank, sizeof(savedOpBank));
+	std::memcpy(screen, pixelDisplayColor, sizeof(screen));
+
+	long long historyEnd = VC_historyEnd;
+	size_t nextEvent = VC_nextEvent,
+		   nextEdit = VC_nextEdit,
+		   dirtyBanks = VC_dirtyBanks.size();
+	uint32_t dirtyPages = VC_dirtyPages,
+			 dirtyIHPages = VC_dirtyIHPages;
+	int savedOpCount = opCount,
+		lastCycles = VC_lastCycles;
+	bool savedOpOverflow = opOverflow;
+
+	// Run ahead
+	VC_dirtyPages = VC_dirtyIHPages = 0;
+	VC_historyEnd = LLONG_MAX;
+	VC_runningAhead = true;
+	VC_runAheadBlits = 0;
+	for(int i = 0; i < VC_RUN_AHEAD_LIMIT && VC_runAheadBlits < VC_runAheadFrames; i++)
+		VC_step();
+	VC_runningAhead = false;
+	VC_runAheadDue = false;
+	std::memcpy(VC_runAheadPixels, pixelDisplayColor, sizeof(VC_runAheadPixels));
+
+	// Restore the state
+	for(int page = 0; page < VC_PAGE_COUNT; page++)
+	{
+		int start = page * VC_PAGE_SIZE;
+		if(VC_dirtyPages & (1u << page))
+			std::copy(ram + start, ram + start + VC_PAGE_SIZE, vc.ram + start);
+		if(VC_dirtyIHPages & (1u << page))
+			std::copy(IH_cache + start, IH_cache + start + VC_PAGE_SIZE, VC_IH_cache + start);
+	}
+	VC_dirtyPages = dirtyPages;
+	VC_dirtyIHPages = dirtyIHPages;
+
+	for(size_t i = 0; i < VC_runAheadBanks.size(); i++)
+		VC_banks[VC_runAheadBanks[i].first].swap(VC_runAheadBanks[i].second);
+	VC_runAheadBanks.clear();
+	while(VC_dirtyBanks.size() > dirtyBanks)
+	{
+		VC_bankDirty[VC_dirtyBanks.back()] = false;
+		VC_dirtyBanks.pop_back();
+	}
+
+	VC_loadState(state);
+	std::memcpy(opLog, savedOpLog, sizeof(savedOpLog));
+	std::memcpy(opBank, savedOpBank, sizeof(savedOpBank));
+	std::memcpy(pixelDisplayColor, screen, sizeof(screen));
+	VC_historyEnd = historyEnd;
+	VC_nextEvent = nextEvent;
+	VC_nextEdit = nextEdit;
+	opCount = savedOpCount;
+	opOverflow = savedOpOverflow;
+	VC_lastCycles = lastCycles;
+}
+
+// Load an image from a ROM archive into RAM and send its input script to the input handler
+	// image is <archive file>:<name> (split at the last ':', names can't hold one)
+bool VC_loadArchive(const std::string & image)
+{
+	size_t colon = image.rfind(':');
+	if(colon == std::string::npos)
+	{
+		std::cout << "Error: -archive needs <archive file>:<name>" << std::endl;
+		return false;
+	}
+
+	VC_Archive archive;
+	if(!VC_openArchive(archive, image.substr(0, colon)))
+	{
+		std::cout << "Error: ROM archive failed to open or is not a ROM archive" << std::endl;
+		return false;
+	}
+
+	const VC_ArchiveEntry * entry = VC_findArchiveEntry(archive, image.substr(colon + 1));
+	if(entry == NULL)
+	{
+		std::cout << "Error: '" << image.substr(colon + 1) << "' is not in the ROM archive" << std::endl;
+		VC_closeArchive(archive);
+		return false;
+	}
+
+	VC_loadArchiveImage(archive, *entry, vc.ram);
+
+	// The input handler is last in, first out, so the script is sent backwards for GIN to read it in order
+		// A replayed input log already holds the script
+	if(VC_inputEvents.empty())
+	{
+		for(uint32_t i = entry->inputWords; i > 0; i--)
+			VC_recordInput(VC_archiveWord(archive, entry->inputOffset, i - 1));
+	}
+
+	VC_closeArchive(archive);
+	return true;
+}